@@ -11,8 +11,8 @@
 #define ARITHMETIC_SHIFT(nb, shift) ((nb) >> (shift))
 
 #include "FP32.h"
-// using CType = float;
-// using CType = double;
+// Number type of the application side (map loading, player movement)
+// The renderer itself is templated on its number type, see KDRData::NumberType
 using CType = FP32<FP_SHIFT>;
 
 #endif
\ No newline at end of file
@@ -9,10 +9,23 @@
 
 // #define FP32_DEBUG_ENABLED
 
+// Counts FP32 divisions (for profiling purposes, see src_bench/divisionbench.cpp)
+// #define FP32_DIVISION_COUNTER_ENABLED
+
 #define FP_SHIFT 14
 
 #define FP32_HIGH(a, p) ((a) >> (p))
 
+#ifdef FP32_DIVISION_COUNTER_ENABLED
+namespace FP32Stats
+{
+    inline uint64_t s_NbDivisions = 0;
+}
+#define FP32_COUNT_DIVISION() (FP32Stats::s_NbDivisions++)
+#else
+#define FP32_COUNT_DIVISION()
+#endif
+
 template<unsigned int P>
 class FP32
 {
@@ -37,6 +50,24 @@ public:
 #endif
     }
 
+    constexpr FP32(double iDouble) :
+        m_Val(std::round(iDouble * (1 << P)))
+    {
+#ifdef FP32_DEBUG_ENABLED
+        m_ValStr = GetString();
+#endif
+    }
+
+    // Conversion between precisions, explicit since it may lose bits
+    template<unsigned int Q>
+    constexpr explicit FP32(const FP32<Q> &iOther) :
+        m_Val(Q > P ? iOther.GetRawValue() >> (Q > P ? Q - P : 0u) : iOther.GetRawValue() << (Q > P ? 0u : P - Q))
+    {
+#ifdef FP32_DEBUG_ENABLED
+        m_ValStr = GetString();
+#endif
+    }
+
     static constexpr FP32<P> FromFPVal(int iFPVal)
     {
         FP32<P> ret;
@@ -131,7 +162,7 @@ public:
     friend constexpr int32_t MultiplyIntFpToInt(int32_t iInt, const FP32<P> &iFP)
     {
         int64_t mul = static_cast<int64_t>(iFP.m_Val) * iInt;
-        return static_cast<int32_t>(mul >> FP_SHIFT);
+        return static_cast<int32_t>(mul >> P);
     }
 
     friend constexpr FP32<P> operator*(const int &iN1, const FP32<P> &iN2)
@@ -141,6 +172,7 @@ public:
 
     friend constexpr FP32<P> operator/(const FP32<P> &iN1, const FP32<P> &iN2)
     {
+        FP32_COUNT_DIVISION();
         int64_t num = static_cast<int64_t>(iN1.m_Val) << P;
         int64_t den = static_cast<int64_t>(iN2.m_Val);
         return FromFPVal(static_cast<int32_t>((num / den)));
@@ -148,11 +180,13 @@ public:
 
     friend constexpr FP32<P> operator/(const FP32<P> &iN1, const int &iN2)
     {
+        FP32_COUNT_DIVISION();
         return FromFPVal((iN1.m_Val / iN2));
     }
 
     friend constexpr FP32<P> operator/(const int &iN1, const FP32<P> &iN2)
     {
+        FP32_COUNT_DIVISION();
         int64_t num = static_cast<int64_t>(iN1) << (P * 2u);
         int64_t den = static_cast<int64_t>(iN2.m_Val);
         return FromFPVal(static_cast<int32_t>((num / den)));
@@ -295,7 +329,7 @@ public:
         return std::to_string(static_cast<float>(*this));
     }
 
-    int32_t GetRawValue() const
+    constexpr int32_t GetRawValue() const
     {
         return m_Val;
     }
@@ -313,4 +347,153 @@ private:
 #endif
 };
 
+// Number of significant bits of iVal (0 for 0)
+inline unsigned int FP32BitLength(uint32_t iVal)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return iVal ? 32u - static_cast<unsigned int>(__builtin_clz(iVal)) : 0u;
+#else
+    unsigned int length = 0u;
+    for (; iVal; iVal >>= 1u)
+        length++;
+    return length;
+#endif
+}
+
+// Seeds for the Newton-Raphson reciprocal: 1/d for d in [0.5, 1[, sampled on 256 intervals
+// (value at the middle of each interval), stored in Q30
+struct FP32RecipSeeds
+{
+    constexpr FP32RecipSeeds() : m_Seeds()
+    {
+        for (int64_t i = 0; i < 256; i++)
+            m_Seeds[i] = static_cast<uint32_t>((int64_t(1) << 40) / (513 + 2 * i));
+    }
+
+    uint32_t m_Seeds[256];
+};
+
+inline constexpr FP32RecipSeeds FP32_RECIP_SEEDS{};
+
+// Reciprocal of a FP32 number (or of an integer), to be computed once and then applied
+// to any number of numerators with a multiply and a shift instead of a 64-bit division.
+// 1/x is stored as a normalized mantissa m in ]2^29, 2^30] and a shift s, 1/x = m / 2^s,
+// so that no precision is lost whatever the magnitude of x
+template<unsigned int P>
+class FP32Recip
+{
+    static_assert(P <= 28, "FP32Recip: precision is too high");
+
+public:
+    FP32Recip() {}
+
+    // Exact reciprocal, costs one 64-bit division
+    // The mantissa is rounded up (relative error below 2^-29), so iNum * FP32Recip(iDen) is never below iNum / iDen in
+    // magnitude and is above it by at most 1 + q / 2^29 LSB, q being the raw magnitude of the quotient: 1 LSB while the
+    // quotient is below 2^(29 - P), up to 4 LSB near the top of the range (see src_tests/fp32recip.cpp)
+    explicit FP32Recip(const FP32<P> &iDen)
+    {
+        Build(iDen.GetRawValue(), P);
+    }
+
+    // Reciprocal of an integer, costs one 64-bit division
+    static FP32Recip<P> FromInt(int iDen)
+    {
+        FP32Recip<P> ret;
+        ret.Build(iDen, 0);
+        return ret;
+    }
+
+    // Newton-Raphson refined reciprocal, no division involved
+    // Table seed (~10 bits) + 2 iterations, accurate to about 2^-29 (relative)
+    static FP32Recip<P> Fast(const FP32<P> &iDen)
+    {
+        FP32Recip<P> ret;
+        ret.BuildFast(iDen.GetRawValue(), P);
+        return ret;
+    }
+
+    static FP32Recip<P> FastFromInt(int iDen)
+    {
+        FP32Recip<P> ret;
+        ret.BuildFast(iDen, 0);
+        return ret;
+    }
+
+public:
+    // Rounds towards zero, like operator/
+    friend FP32<P> operator*(const FP32<P> &iNum, const FP32Recip<P> &iRecip)
+    {
+        int64_t mul = static_cast<int64_t>(iNum.GetRawValue()) * iRecip.m_Mantissa;
+        return FP32<P>::FromFPVal(static_cast<int32_t>(mul >= 0 ? (mul >> iRecip.m_Shift) : -((-mul) >> iRecip.m_Shift)));
+    }
+
+    friend FP32<P> operator*(const FP32Recip<P> &iRecip, const FP32<P> &iNum)
+    {
+        return iNum * iRecip;
+    }
+
+    // 1/x as a FP32 number
+    FP32<P> ToFP32() const
+    {
+        return FP32<P>(1) * (*this);
+    }
+
+protected:
+    // iRawDen is the denominator, in 1/2^iDenShift units
+    void Build(int32_t iRawDen, unsigned int iDenShift)
+    {
+        uint32_t absDen = iRawDen < 0 ? static_cast<uint32_t>(-static_cast<int64_t>(iRawDen)) : static_cast<uint32_t>(iRawDen);
+        unsigned int bitLength = FP32BitLength(absDen);
+        if (!absDen)
+        {
+            // Division by zero, saturate
+            m_Mantissa = INT32_MAX;
+            m_Shift = 0;
+            return;
+        }
+
+        m_Mantissa = static_cast<int32_t>(((uint64_t(1) << (29u + bitLength)) + absDen - 1u) / absDen);
+        if (iRawDen < 0)
+            m_Mantissa = -m_Mantissa;
+        m_Shift = 29u + bitLength - iDenShift;
+    }
+
+    void BuildFast(int32_t iRawDen, unsigned int iDenShift)
+    {
+        uint32_t absDen = iRawDen < 0 ? static_cast<uint32_t>(-static_cast<int64_t>(iRawDen)) : static_cast<uint32_t>(iRawDen);
+        unsigned int bitLength = FP32BitLength(absDen);
+        if (!absDen)
+        {
+            m_Mantissa = INT32_MAX;
+            m_Shift = 0;
+            return;
+        }
+
+        // Normalize the denominator to d in [0.5, 1[ (Q32)
+        uint64_t d = static_cast<uint64_t>(absDen) << (32u - bitLength);
+        // y ~ 1/d (Q30)
+        uint64_t y = FP32_RECIP_SEEDS.m_Seeds[(d >> 23u) & 0xFFu];
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            uint64_t dy = (d * y) >> 32u; // Q30, ~1
+            y = (y * ((uint64_t(1) << 31u) - dy)) >> 30u;
+        }
+
+        // 1/|iRawDen| = (1/d) / 2^bitLength = y / 2^(30 + bitLength)
+        // Same mantissa as Build(): y/2, clamped to 2^30
+        uint64_t mantissa = y >> 1u;
+        if (mantissa > (uint64_t(1) << 30u))
+            mantissa = uint64_t(1) << 30u;
+        m_Mantissa = static_cast<int32_t>(mantissa);
+        if (iRawDen < 0)
+            m_Mantissa = -m_Mantissa;
+        m_Shift = 29u + bitLength - iDenShift;
+    }
+
+private:
+    int32_t m_Mantissa;
+    unsigned int m_Shift;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,442 @@
+#ifndef FP32xN_h
+#define FP32xN_h
+
+#include "FP32.h"
+
+#include <cstdint>
+
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Packed FP32<P> numbers, with the same semantics as FP32 (bit for bit), lane by lane
+// - FP32x4: SSE4.1
+// - FP32x8: AVX2
+// - FP32xN: widest one available
+// When the instruction set is not enabled at compile time (see ARCHFLAGS in the Makefile),
+// the portable FP32xScalar is used instead, so the code using these types doesn't need to care
+//
+// Comparison operators return a lane mask: bit k is set if the comparison is true for lane k
+// FP32x4<0>/FP32x8<0> are used for integer lanes (e.g. the result of MultiplyIntFpToInt)
+
+// Portable implementation
+template<unsigned int P, unsigned int N>
+class FP32xScalar
+{
+public:
+    static constexpr unsigned int WIDTH = N;
+    static constexpr unsigned int ALL_LANES = (1u << N) - 1u;
+
+public:
+    FP32xScalar() {}
+
+    explicit FP32xScalar(const FP32<P> &iVal)
+    {
+        for (unsigned int k = 0; k < N; k++)
+            m_Val[k] = iVal.GetRawValue();
+    }
+
+    static FP32xScalar<P, N> FromInt(int iInt)
+    {
+        return FP32xScalar<P, N>(FP32<P>(iInt));
+    }
+
+    // Lane k holds iStart + k
+    static FP32xScalar<P, N> Ramp(int iStart)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = static_cast<int32_t>(iStart + k) << P;
+        return ret;
+    }
+
+    static FP32xScalar<P, N> LoadRaw(const int32_t *ipRaw)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = ipRaw[k];
+        return ret;
+    }
+
+    void StoreRaw(int32_t *opRaw) const
+    {
+        for (unsigned int k = 0; k < N; k++)
+            opRaw[k] = m_Val[k];
+    }
+
+    FP32<P> Get(unsigned int iLane) const
+    {
+        return FP32<P>::FromFPVal(m_Val[iLane]);
+    }
+
+public:
+    friend FP32xScalar<P, N> operator+(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = iN1.m_Val[k] + iN2.m_Val[k];
+        return ret;
+    }
+
+    friend FP32xScalar<P, N> operator-(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = iN1.m_Val[k] - iN2.m_Val[k];
+        return ret;
+    }
+
+    friend FP32xScalar<P, N> operator-(int iN1, const FP32xScalar<P, N> &iN2)
+    {
+        return FromInt(iN1) - iN2;
+    }
+
+    FP32xScalar<P, N> operator-() const
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = -m_Val[k];
+        return ret;
+    }
+
+    friend FP32xScalar<P, N> operator*(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = static_cast<int32_t>((static_cast<int64_t>(iN1.m_Val[k]) * iN2.m_Val[k]) >> P);
+        return ret;
+    }
+
+    friend FP32xScalar<P, N> operator*(const FP32xScalar<P, N> &iN1, int iN2)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = iN1.m_Val[k] * iN2;
+        return ret;
+    }
+
+    friend FP32xScalar<P, N> operator>>(const FP32xScalar<P, N> &iN, unsigned int iShift)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = iN.m_Val[k] >> iShift;
+        return ret;
+    }
+
+    friend FP32xScalar<0, N> MultiplyIntFpToInt(int32_t iInt, const FP32xScalar<P, N> &iFP)
+    {
+        int32_t raw[N];
+        for (unsigned int k = 0; k < N; k++)
+            raw[k] = static_cast<int32_t>((static_cast<int64_t>(iFP.m_Val[k]) * iInt) >> P);
+        return FP32xScalar<0, N>::LoadRaw(raw);
+    }
+
+    friend FP32xScalar<P, N> Min(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = iN1.m_Val[k] < iN2.m_Val[k] ? iN1.m_Val[k] : iN2.m_Val[k];
+        return ret;
+    }
+
+    friend FP32xScalar<P, N> Max(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        FP32xScalar<P, N> ret;
+        for (unsigned int k = 0; k < N; k++)
+            ret.m_Val[k] = iN1.m_Val[k] > iN2.m_Val[k] ? iN1.m_Val[k] : iN2.m_Val[k];
+        return ret;
+    }
+
+    friend unsigned int operator==(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        unsigned int mask = 0u;
+        for (unsigned int k = 0; k < N; k++)
+            mask |= (iN1.m_Val[k] == iN2.m_Val[k] ? 1u : 0u) << k;
+        return mask;
+    }
+
+    friend unsigned int operator<(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2)
+    {
+        unsigned int mask = 0u;
+        for (unsigned int k = 0; k < N; k++)
+            mask |= (iN1.m_Val[k] < iN2.m_Val[k] ? 1u : 0u) << k;
+        return mask;
+    }
+
+    friend unsigned int operator!=(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2) { return ~(iN1 == iN2) & ALL_LANES; }
+    friend unsigned int operator>(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2) { return iN2 < iN1; }
+    friend unsigned int operator<=(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2) { return ~(iN2 < iN1) & ALL_LANES; }
+    friend unsigned int operator>=(const FP32xScalar<P, N> &iN1, const FP32xScalar<P, N> &iN2) { return ~(iN1 < iN2) & ALL_LANES; }
+
+private:
+    int32_t m_Val[N];
+};
+
+#if defined(__SSE4_1__)
+template<unsigned int P>
+class FP32x4
+{
+public:
+    static constexpr unsigned int WIDTH = 4u;
+    static constexpr unsigned int ALL_LANES = 0xFu;
+
+public:
+    FP32x4() {}
+
+    explicit FP32x4(const FP32<P> &iVal) :
+        m_Val(_mm_set1_epi32(iVal.GetRawValue()))
+    {
+    }
+
+    static FP32x4<P> FromInt(int iInt)
+    {
+        return FromRegister(_mm_set1_epi32(iInt << P));
+    }
+
+    static FP32x4<P> Ramp(int iStart)
+    {
+        return FromRegister(_mm_slli_epi32(_mm_add_epi32(_mm_set1_epi32(iStart), _mm_setr_epi32(0, 1, 2, 3)), P));
+    }
+
+    static FP32x4<P> LoadRaw(const int32_t *ipRaw)
+    {
+        return FromRegister(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ipRaw)));
+    }
+
+    void StoreRaw(int32_t *opRaw) const
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(opRaw), m_Val);
+    }
+
+    FP32<P> Get(unsigned int iLane) const
+    {
+        alignas(16) int32_t raw[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(raw), m_Val);
+        return FP32<P>::FromFPVal(raw[iLane]);
+    }
+
+    static FP32x4<P> FromRegister(__m128i iVal)
+    {
+        FP32x4<P> ret;
+        ret.m_Val = iVal;
+        return ret;
+    }
+
+public:
+    friend FP32x4<P> operator+(const FP32x4<P> &iN1, const FP32x4<P> &iN2)
+    {
+        return FromRegister(_mm_add_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x4<P> operator-(const FP32x4<P> &iN1, const FP32x4<P> &iN2)
+    {
+        return FromRegister(_mm_sub_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x4<P> operator-(int iN1, const FP32x4<P> &iN2)
+    {
+        return FromRegister(_mm_sub_epi32(_mm_set1_epi32(iN1 << P), iN2.m_Val));
+    }
+
+    FP32x4<P> operator-() const
+    {
+        return FromRegister(_mm_sub_epi32(_mm_setzero_si128(), m_Val));
+    }
+
+    // 32x32 -> 64 bits products of even and odd lanes, shifted back by P
+    // A logical 64-bit shift is enough since only the low 32 bits of the result are kept
+    friend FP32x4<P> operator*(const FP32x4<P> &iN1, const FP32x4<P> &iN2)
+    {
+        return FromRegister(MulShift(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x4<P> operator*(const FP32x4<P> &iN1, int iN2)
+    {
+        return FromRegister(_mm_mullo_epi32(iN1.m_Val, _mm_set1_epi32(iN2)));
+    }
+
+    friend FP32x4<P> operator>>(const FP32x4<P> &iN, unsigned int iShift)
+    {
+        return FromRegister(_mm_sra_epi32(iN.m_Val, _mm_cvtsi32_si128(static_cast<int>(iShift))));
+    }
+
+    friend FP32x4<0> MultiplyIntFpToInt(int32_t iInt, const FP32x4<P> &iFP)
+    {
+        return FP32x4<0>::FromRegister(MulShift(iFP.m_Val, _mm_set1_epi32(iInt)));
+    }
+
+    friend FP32x4<P> Min(const FP32x4<P> &iN1, const FP32x4<P> &iN2)
+    {
+        return FromRegister(_mm_min_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x4<P> Max(const FP32x4<P> &iN1, const FP32x4<P> &iN2)
+    {
+        return FromRegister(_mm_max_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend unsigned int operator==(const FP32x4<P> &iN1, const FP32x4<P> &iN2) { return MoveMask(_mm_cmpeq_epi32(iN1.m_Val, iN2.m_Val)); }
+    friend unsigned int operator<(const FP32x4<P> &iN1, const FP32x4<P> &iN2) { return MoveMask(_mm_cmplt_epi32(iN1.m_Val, iN2.m_Val)); }
+    friend unsigned int operator>(const FP32x4<P> &iN1, const FP32x4<P> &iN2) { return MoveMask(_mm_cmpgt_epi32(iN1.m_Val, iN2.m_Val)); }
+    friend unsigned int operator!=(const FP32x4<P> &iN1, const FP32x4<P> &iN2) { return ~(iN1 == iN2) & ALL_LANES; }
+    friend unsigned int operator<=(const FP32x4<P> &iN1, const FP32x4<P> &iN2) { return ~(iN1 > iN2) & ALL_LANES; }
+    friend unsigned int operator>=(const FP32x4<P> &iN1, const FP32x4<P> &iN2) { return ~(iN1 < iN2) & ALL_LANES; }
+
+private:
+    static __m128i MulShift(__m128i iA, __m128i iB)
+    {
+        __m128i even = _mm_srli_epi64(_mm_mul_epi32(iA, iB), P);
+        __m128i odd = _mm_srli_epi64(_mm_mul_epi32(_mm_srli_epi64(iA, 32), _mm_srli_epi64(iB, 32)), P);
+        return _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xCC);
+    }
+
+    static unsigned int MoveMask(__m128i iMask)
+    {
+        return static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(iMask)));
+    }
+
+private:
+    __m128i m_Val;
+};
+#else
+template<unsigned int P>
+using FP32x4 = FP32xScalar<P, 4>;
+#endif
+
+#if defined(__AVX2__)
+template<unsigned int P>
+class FP32x8
+{
+public:
+    static constexpr unsigned int WIDTH = 8u;
+    static constexpr unsigned int ALL_LANES = 0xFFu;
+
+public:
+    FP32x8() {}
+
+    explicit FP32x8(const FP32<P> &iVal) :
+        m_Val(_mm256_set1_epi32(iVal.GetRawValue()))
+    {
+    }
+
+    static FP32x8<P> FromInt(int iInt)
+    {
+        return FromRegister(_mm256_set1_epi32(iInt << P));
+    }
+
+    static FP32x8<P> Ramp(int iStart)
+    {
+        return FromRegister(_mm256_slli_epi32(_mm256_add_epi32(_mm256_set1_epi32(iStart), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)), P));
+    }
+
+    static FP32x8<P> LoadRaw(const int32_t *ipRaw)
+    {
+        return FromRegister(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(ipRaw)));
+    }
+
+    void StoreRaw(int32_t *opRaw) const
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(opRaw), m_Val);
+    }
+
+    FP32<P> Get(unsigned int iLane) const
+    {
+        alignas(32) int32_t raw[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(raw), m_Val);
+        return FP32<P>::FromFPVal(raw[iLane]);
+    }
+
+    static FP32x8<P> FromRegister(__m256i iVal)
+    {
+        FP32x8<P> ret;
+        ret.m_Val = iVal;
+        return ret;
+    }
+
+public:
+    friend FP32x8<P> operator+(const FP32x8<P> &iN1, const FP32x8<P> &iN2)
+    {
+        return FromRegister(_mm256_add_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x8<P> operator-(const FP32x8<P> &iN1, const FP32x8<P> &iN2)
+    {
+        return FromRegister(_mm256_sub_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x8<P> operator-(int iN1, const FP32x8<P> &iN2)
+    {
+        return FromRegister(_mm256_sub_epi32(_mm256_set1_epi32(iN1 << P), iN2.m_Val));
+    }
+
+    FP32x8<P> operator-() const
+    {
+        return FromRegister(_mm256_sub_epi32(_mm256_setzero_si256(), m_Val));
+    }
+
+    // Same as FP32x4
+    friend FP32x8<P> operator*(const FP32x8<P> &iN1, const FP32x8<P> &iN2)
+    {
+        return FromRegister(MulShift(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x8<P> operator*(const FP32x8<P> &iN1, int iN2)
+    {
+        return FromRegister(_mm256_mullo_epi32(iN1.m_Val, _mm256_set1_epi32(iN2)));
+    }
+
+    friend FP32x8<P> operator>>(const FP32x8<P> &iN, unsigned int iShift)
+    {
+        return FromRegister(_mm256_sra_epi32(iN.m_Val, _mm_cvtsi32_si128(static_cast<int>(iShift))));
+    }
+
+    friend FP32x8<0> MultiplyIntFpToInt(int32_t iInt, const FP32x8<P> &iFP)
+    {
+        return FP32x8<0>::FromRegister(MulShift(iFP.m_Val, _mm256_set1_epi32(iInt)));
+    }
+
+    friend FP32x8<P> Min(const FP32x8<P> &iN1, const FP32x8<P> &iN2)
+    {
+        return FromRegister(_mm256_min_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend FP32x8<P> Max(const FP32x8<P> &iN1, const FP32x8<P> &iN2)
+    {
+        return FromRegister(_mm256_max_epi32(iN1.m_Val, iN2.m_Val));
+    }
+
+    friend unsigned int operator==(const FP32x8<P> &iN1, const FP32x8<P> &iN2) { return MoveMask(_mm256_cmpeq_epi32(iN1.m_Val, iN2.m_Val)); }
+    friend unsigned int operator>(const FP32x8<P> &iN1, const FP32x8<P> &iN2) { return MoveMask(_mm256_cmpgt_epi32(iN1.m_Val, iN2.m_Val)); }
+    friend unsigned int operator<(const FP32x8<P> &iN1, const FP32x8<P> &iN2) { return iN2 > iN1; }
+    friend unsigned int operator!=(const FP32x8<P> &iN1, const FP32x8<P> &iN2) { return ~(iN1 == iN2) & ALL_LANES; }
+    friend unsigned int operator<=(const FP32x8<P> &iN1, const FP32x8<P> &iN2) { return ~(iN1 > iN2) & ALL_LANES; }
+    friend unsigned int operator>=(const FP32x8<P> &iN1, const FP32x8<P> &iN2) { return ~(iN2 > iN1) & ALL_LANES; }
+
+private:
+    static __m256i MulShift(__m256i iA, __m256i iB)
+    {
+        __m256i even = _mm256_srli_epi64(_mm256_mul_epi32(iA, iB), P);
+        __m256i odd = _mm256_srli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(iA, 32), _mm256_srli_epi64(iB, 32)), P);
+        return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    }
+
+    static unsigned int MoveMask(__m256i iMask)
+    {
+        return static_cast<unsigned int>(_mm256_movemask_ps(_mm256_castsi256_ps(iMask)));
+    }
+
+private:
+    __m256i m_Val;
+};
+
+template<unsigned int P>
+using FP32xN = FP32x8<P>;
+#else
+template<unsigned int P>
+using FP32x8 = FP32xScalar<P, 8>;
+
+template<unsigned int P>
+using FP32xN = FP32x4<P>;
+#endif
+
+#endif
@@ -2,34 +2,36 @@
 #define FlatSurfacesRenderer_h
 
 #include "KDTreeRendererData.h"
+#include "GeomUtils.h"
 
 #include <vector>
-#include <map>
 
+template <typename Number>
 class FlatSurfacesRenderer
 {
 public:
-    FlatSurfacesRenderer(const std::map<CType, std::vector<KDRData::FlatSurface>> &iFlatSurfaces, const KDRData::State &iState, const KDRData::Settings &iSettings, const KDTreeMap &iMap);
+    // iFlatSurfaces are handles in iArena, sorted by height
+    FlatSurfacesRenderer(const KDRData::FlatSurfaceArena<Number> &iArena, const std::vector<uint32_t> &iFlatSurfaces, const KDRData::State<Number> &iState, const KDRData::Settings<Number> &iSettings, const KDTreeMap &iMap);
     virtual ~FlatSurfacesRenderer();
 
 public:
-    void SetBuffers(unsigned char *ipFrameBuffer, unsigned char *ipHorizOcclusionBuffer, int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer);
+    void SetBuffers(unsigned char *ipFrameBuffer, int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer);
 
 public:
     void Render();
 
 protected:
-    inline void DrawLine(int iY, int iMinX, int iMaxX, const KDRData::FlatSurface &iSurface);
+    inline void DrawLine(int iY, int iMinX, int iMaxX, const KDRData::FlatSurface<Number> &iSurface);
     inline void WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b);
 
 protected:
-    const std::map<CType, std::vector<KDRData::FlatSurface>> &m_FlatSurfaces;
-    const KDRData::State &m_State;
-    const KDRData::Settings &m_Settings;
+    const KDRData::FlatSurfaceArena<Number> &m_Arena;
+    const std::vector<uint32_t> &m_FlatSurfaces;
+    const KDRData::State<Number> &m_State;
+    const KDRData::Settings<Number> &m_Settings;
     const KDTreeMap &m_Map;
 
     unsigned char *m_pFrameBuffer;
-    unsigned char *m_pHorizOcclusionBuffer;
     int *m_pTopOcclusionBuffer;
     int *m_pBottomOcclusionBuffer;
 
@@ -37,14 +39,23 @@ protected:
     int m_SectorLightValue;
     int m_MaxLight;
     int m_MinLight;
-    CType m_MaxColorInterpolationDist;
+    Number m_MaxColorInterpolationDist;
+    RecipType<Number> m_MaxColorInterpolationDistRecip;
+
+    // Per-frame constants
+    RecipType<Number> m_WindowWidthRecip;
+
+    // Texture infos
+    Number m_TexelXScale;
+    Number m_TexelYScale;
 
     // Caches
     int m_LinesXStart[WINDOW_HEIGHT];
     char m_PaletteCache[WINDOW_HEIGHT];
-    KDRData::Vertex m_LeftmostTexelCache[WINDOW_HEIGHT];
-    CType m_DeltaTexelYCache[WINDOW_HEIGHT];
-    CType m_DeltaTexelXCache[WINDOW_HEIGHT];
+    KDRData::Vertex<Number> m_CenterTexelCache[WINDOW_HEIGHT];
+    KDRData::Vertex<Number> m_LateralTexelCache[WINDOW_HEIGHT];
+    Number m_DeltaTexelYCache[WINDOW_HEIGHT];
+    Number m_DeltaTexelXCache[WINDOW_HEIGHT];
 
     // TODO textures
     unsigned char m_CurrSectorR;
@@ -54,7 +65,8 @@ protected:
     int m_RDbg, m_GDbg, m_BDbg;
 };
 
-void FlatSurfacesRenderer::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b)
+template <typename Number>
+void FlatSurfacesRenderer<Number>::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b)
 {
     idx = idx << 2u;
     m_pFrameBuffer[idx] = r;
@@ -11,11 +11,17 @@
 #include <cmath>
 #include <algorithm>
 #include <cstdint>
+#include <type_traits>
+#include <utility>
 
 #include "Consts.h"
 #include "FP32.h"
 
-template<typename Vertex, typename Intermediate = CType>
+// Number type of a vertex' coordinates. Default intermediate type of the functions below
+template <typename Vertex>
+using VertexNumber = std::decay_t<decltype(std::declval<Vertex>().m_X)>;
+
+template<typename Vertex, typename Intermediate = VertexNumber<Vertex>>
 inline int WhichSide(const Vertex &iV1, const Vertex &iV2, const Vertex &iP)
 {
     Intermediate normalX = iV2.m_Y - iV1.m_Y;
@@ -30,116 +36,427 @@ inline int WhichSide(const Vertex &iV1, const Vertex &iV2, const Vertex &iP)
         return 1;
 }
 
-inline CType cosInt(int iAngle)
+// Lookup tables for trigonometric functions
+// Angles are integers expressed in 1/(1 << ANGLE_SHIFT) degrees. All tables are generated at
+// compile time, so we don't need libm (nor an FPU) at runtime
+#define ANGLE_QUARTER (90 << ANGLE_SHIFT)
+#define ANGLE_HALF (180 << ANGLE_SHIFT)
+#define ANGLE_FULL (360 << ANGLE_SHIFT)
+
+// atan table: ATAN_TABLE_SIZE + 1 entries sampling atan over [0, 1], linearly interpolated.
+// Values are stored with ATAN_FRAC_SHIFT extra bits of precision
+#define ATAN_TABLE_SHIFT 10
+#define ATAN_TABLE_SIZE (1 << ATAN_TABLE_SHIFT)
+#define ATAN_FRAC_SHIFT 8
+
+namespace TrigTools
 {
-    // Extremely non-optimized
-    // TODO: implement lookup table
-    float iAngleRad = static_cast<float>(iAngle) / (180.0 * static_cast<float>((1 << ANGLE_SHIFT))) * M_PI;
-    float res = cos(iAngleRad);
-    return static_cast<CType>(res);
+    constexpr double PI = 3.14159265358979323846;
+
+    // Taylor series, only valid (and accurate) for small values of iX
+    constexpr double ConstexprSin(double iX)
+    {
+        double term = iX, sum = iX;
+        for (int n = 1; n < 15; n++)
+        {
+            term *= -iX * iX / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double ConstexprCos(double iX)
+    {
+        double term = 1.0, sum = 1.0;
+        for (int n = 1; n < 15; n++)
+        {
+            term *= -iX * iX / ((2 * n - 1) * (2 * n));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double ConstexprSqrt(double iX)
+    {
+        if (iX <= 0.0)
+            return 0.0;
+
+        double x = iX > 1.0 ? iX : 1.0;
+        for (int i = 0; i < 64; i++)
+            x = 0.5 * (x + iX / x);
+        return x;
+    }
+
+    // Valid over [0, 1]. Argument is halved twice (atan(x) = 2 * atan(x / (1 + sqrt(1 + x^2))))
+    // so that the series converges quickly
+    constexpr double ConstexprAtan(double iX)
+    {
+        double x = iX / (1.0 + ConstexprSqrt(1.0 + iX * iX));
+        x = x / (1.0 + ConstexprSqrt(1.0 + x * x));
+
+        double term = x, sum = x;
+        for (int n = 1; n < 20; n++)
+        {
+            term *= -x * x;
+            sum += term / (2 * n + 1);
+        }
+        return 4.0 * sum;
+    }
+
+    constexpr double AngleIntToRad(int iAngle)
+    {
+        return static_cast<double>(iAngle) * PI / static_cast<double>(ANGLE_HALF);
+    }
+
+    constexpr int RoundToInt(double iVal)
+    {
+        return static_cast<int>(iVal >= 0.0 ? iVal + 0.5 : iVal - 0.5);
+    }
+
+    // How table entries are stored for a given number type
+    // FP32 values are stored raw so that the tables can be built at compile time
+    // (FP32's float constructor relies on std::roundf)
+    template <typename Number>
+    struct TableTraits
+    {
+        using Storage = Number;
+        static constexpr Storage FromDouble(double iVal) { return static_cast<Storage>(iVal); }
+        static constexpr Number ToNumber(Storage iVal) { return iVal; }
+    };
+
+    template <unsigned int P>
+    struct TableTraits<FP32<P>>
+    {
+        using Storage = int32_t;
+        static constexpr Storage FromDouble(double iVal) { return RoundToInt(iVal * static_cast<double>(1 << P)); }
+        static constexpr FP32<P> ToNumber(Storage iVal) { return FP32<P>::FromFPVal(iVal); }
+    };
+
+    // sin over [0, 90] degrees (bounds included) and tan over [0, 90[ degrees
+    template <typename Number>
+    struct TrigTables
+    {
+        using Traits = TableTraits<Number>;
+
+        constexpr TrigTables() : m_Sin(), m_Tan()
+        {
+            for (int i = 0; i <= ANGLE_QUARTER; i++)
+            {
+                // Use the series on the half of the quadrant where it is the most accurate
+                double rad = AngleIntToRad(i);
+                double sinVal = 2 * i <= ANGLE_QUARTER ? ConstexprSin(rad) : ConstexprCos(AngleIntToRad(ANGLE_QUARTER - i));
+                double cosVal = 2 * i <= ANGLE_QUARTER ? ConstexprCos(rad) : ConstexprSin(AngleIntToRad(ANGLE_QUARTER - i));
+
+                m_Sin[i] = Traits::FromDouble(sinVal);
+                if (i < ANGLE_QUARTER)
+                    m_Tan[i] = Traits::FromDouble(sinVal / cosVal);
+            }
+        }
+
+        typename Traits::Storage m_Sin[ANGLE_QUARTER + 1];
+        typename Traits::Storage m_Tan[ANGLE_QUARTER];
+    };
+
+    // atan over [0, 1], in 1/(1 << ATAN_FRAC_SHIFT) angle units
+    struct AtanTable
+    {
+        constexpr AtanTable() : m_Atan()
+        {
+            for (int i = 0; i <= ATAN_TABLE_SIZE; i++)
+            {
+                double atanVal = ConstexprAtan(static_cast<double>(i) / ATAN_TABLE_SIZE);
+                m_Atan[i] = RoundToInt(atanVal * static_cast<double>(ANGLE_HALF << ATAN_FRAC_SHIFT) / PI);
+            }
+        }
+
+        int m_Atan[ATAN_TABLE_SIZE + 1];
+    };
+
+    template <typename Number>
+    inline constexpr TrigTables<Number> TRIG_TABLES{};
+
+    inline constexpr AtanTable ATAN_TABLE{};
+
+    // Brings any angle back to [0, 360[ degrees
+    inline int NormalizeAngle(int iAngle)
+    {
+        iAngle %= ANGLE_FULL;
+        return iAngle < 0 ? iAngle + ANGLE_FULL : iAngle;
+    }
+
+    // sin for an angle in [0, 360[ degrees
+    template <typename Number>
+    inline Number SinNormalized(int iAngle)
+    {
+        const auto &table = TRIG_TABLES<Number>;
+        using Traits = TableTraits<Number>;
+
+        if (iAngle <= ANGLE_QUARTER)
+            return Traits::ToNumber(table.m_Sin[iAngle]);
+        else if (iAngle <= ANGLE_HALF)
+            return Traits::ToNumber(table.m_Sin[ANGLE_HALF - iAngle]);
+        else if (iAngle <= ANGLE_HALF + ANGLE_QUARTER)
+            return -Traits::ToNumber(table.m_Sin[iAngle - ANGLE_HALF]);
+        else
+            return -Traits::ToNumber(table.m_Sin[ANGLE_FULL - iAngle]);
+    }
+
+    // atan(iNum / iDen) for 0 <= iNum <= iDen, iDen > 0
+    // Result is in 1/(1 << ATAN_FRAC_SHIFT) angle units
+    template <typename Number>
+    inline int AtanRatio(const Number &iNum, const Number &iDen)
+    {
+        Number scaledRatio = (iNum / iDen) * ATAN_TABLE_SIZE;
+        int idx = static_cast<int>(scaledRatio);
+        if (idx >= ATAN_TABLE_SIZE)
+            return ATAN_TABLE.m_Atan[ATAN_TABLE_SIZE];
+
+        Number frac = scaledRatio - static_cast<Number>(idx);
+        return ATAN_TABLE.m_Atan[idx] + static_cast<int>(frac * static_cast<Number>(ATAN_TABLE.m_Atan[idx + 1] - ATAN_TABLE.m_Atan[idx]));
+    }
+
+    // Integer-only version: the ratio is computed on 64 bits with 30 fractional bits
+    template <unsigned int P>
+    inline int AtanRatio(const FP32<P> &iNum, const FP32<P> &iDen)
+    {
+        int64_t ratio = (static_cast<int64_t>(iNum.GetRawValue()) << 30) / iDen.GetRawValue();
+        int idx = static_cast<int>(ratio >> (30 - ATAN_TABLE_SHIFT));
+        if (idx >= ATAN_TABLE_SIZE)
+            return ATAN_TABLE.m_Atan[ATAN_TABLE_SIZE];
+
+        int64_t frac = ratio & ((1 << (30 - ATAN_TABLE_SHIFT)) - 1);
+        int64_t delta = ATAN_TABLE.m_Atan[idx + 1] - ATAN_TABLE.m_Atan[idx];
+        return ATAN_TABLE.m_Atan[idx] + static_cast<int>((delta * frac) >> (30 - ATAN_TABLE_SHIFT));
+    }
+} // namespace TrigTools
+
+template <typename Number = CType>
+inline Number cosInt(int iAngle)
+{
+    return TrigTools::SinNormalized<Number>(TrigTools::NormalizeAngle(iAngle + ANGLE_QUARTER));
+}
+
+template <typename Number = CType>
+inline Number sinInt(int iAngle)
+{
+    return TrigTools::SinNormalized<Number>(TrigTools::NormalizeAngle(iAngle));
 }
 
-inline CType sinInt(int iAngle)
+// tan is undefined for +/-90 degrees, in which case the largest tabulated value is returned
+template <typename Number = CType>
+inline Number tanInt(int iAngle)
 {
-    // Extremely non-optimized
-    // TODO: implement lookup table
-    double iAngleRad = static_cast<float>(iAngle) / (180.0 * static_cast<float>((1 << ANGLE_SHIFT))) * M_PI;
-    float res = sin(iAngleRad);
-    return static_cast<CType>(res);
+    const auto &table = TrigTools::TRIG_TABLES<Number>;
+    using Traits = TrigTools::TableTraits<Number>;
+
+    int angle = TrigTools::NormalizeAngle(iAngle) % ANGLE_HALF;
+    if (angle < ANGLE_QUARTER)
+        return Traits::ToNumber(table.m_Tan[angle]);
+    else if (angle == ANGLE_QUARTER)
+        return Traits::ToNumber(table.m_Tan[ANGLE_QUARTER - 1]);
+    else
+        return -Traits::ToNumber(table.m_Tan[ANGLE_HALF - angle]);
 }
 
-inline CType tanInt(int iAngle)
+// Same unit as the other angles, truncated towards zero
+template <typename Number>
+inline int atanInt(const Number &iX)
 {
-    // Extremely non-optimized
-    // TODO: implement lookup table
-    double iAngleRad = static_cast<float>(iAngle) / (180.0 * static_cast<float>((1 << ANGLE_SHIFT))) * M_PI;
-    float res = tan(iAngleRad);
-    return static_cast<CType>(res);
+    if (iX == 0)
+        return 0;
+
+    Number absX = iX < 0 ? -iX : iX;
+    int fineAngle = absX <= 1 ? TrigTools::AtanRatio(absX, Number(1)) :
+                                (ANGLE_QUARTER << ATAN_FRAC_SHIFT) - TrigTools::AtanRatio(Number(1), absX);
+    int angle = fineAngle >> ATAN_FRAC_SHIFT;
+    return iX < 0 ? -angle : angle;
 }
 
-inline int atanInt(CType iX)
+// Angle of the (iX, iY) vector, in ]-180, 180] degrees, truncated towards zero
+// Only one division, in order to compute the table index
+template <typename Number>
+inline int atan2Int(const Number &iY, const Number &iX)
 {
-    // Extremely non-optimized
-    // TODO: implement lookup table
-    float x = static_cast<float>(iX);
-    double atanVal = atan(x) * (180.0 * static_cast<float>((1 << ANGLE_SHIFT))) / M_PI;
-    return static_cast<int>(atanVal);
+    Number absX = iX < 0 ? -iX : iX;
+    Number absY = iY < 0 ? -iY : iY;
+
+    if (absX == 0 && absY == 0)
+        return 0;
+
+    // Octant reduction
+    int fineAngle = absY <= absX ? TrigTools::AtanRatio(absY, absX) :
+                                   (ANGLE_QUARTER << ATAN_FRAC_SHIFT) - TrigTools::AtanRatio(absX, absY);
+    if (iX < 0)
+        fineAngle = (ANGLE_HALF << ATAN_FRAC_SHIFT) - fineAngle;
+
+    int angle = fineAngle >> ATAN_FRAC_SHIFT;
+    return iY < 0 ? -angle : angle;
 }
 
 template <typename Vertex>
 inline void GetVector(const Vertex &iOrigin, int iDirection, Vertex &oTo)
 {
-    CType cosDirMult = cosInt(iDirection);
-    CType sinDirMult = sinInt(iDirection);
+    using Number = VertexNumber<Vertex>;
+    Number cosDirMult = cosInt<Number>(iDirection);
+    Number sinDirMult = sinInt<Number>(iDirection);
 
     oTo.m_X = iOrigin.m_X + sinDirMult;
     oTo.m_Y = iOrigin.m_Y + cosDirMult;
 }
 
-template <typename Vertex, typename RetType = CType>
+template <typename Vertex, typename RetType = VertexNumber<Vertex>>
 inline RetType DotProduct(const Vertex &v0, const Vertex &v1, const Vertex &v2, const Vertex &v3)
 {
     return (v1.m_X - v0.m_X) * (v3.m_X - v2.m_X) + (v1.m_Y - v0.m_Y) * (v3.m_Y - v2.m_Y);
 }
 
 template <typename Vertex>
-inline CType Det(const Vertex &v0, const Vertex &v1, const Vertex &v2, const Vertex &v3)
+inline VertexNumber<Vertex> Det(const Vertex &v0, const Vertex &v1, const Vertex &v2, const Vertex &v3)
 {
     return (v1.m_X - v0.m_X) * (v3.m_Y - v2.m_Y) - (v1.m_Y - v0.m_Y) * (v3.m_X - v2.m_X);
 }
 
-// TODO: re-enable
-// From Wikipedia's article on integer square root
-// FP32<FP_SHIFT> SqrtInt(const FP32<FP_SHIFT> &s)
-// {
-//     FP32<FP_SHIFT> x0 = s >> 1; // Initial estimate
+// Integer square root (floor), digit-by-digit method
+// See Wikipedia's article on integer square root
+inline uint64_t ISqrt64(uint64_t iVal)
+{
+    uint64_t res = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > iVal)
+        bit >>= 2;
+
+    // Branchless body, the outcome of the comparison is unpredictable
+    while (bit)
+    {
+        uint64_t trial = res + bit;
+        uint64_t mask = static_cast<uint64_t>(0) - static_cast<uint64_t>(iVal >= trial);
+        iVal -= trial & mask;
+        res = (res >> 1) + (bit & mask);
+        bit >>= 2;
+    }
+
+    return res;
+}
+
+// Same as above, rounded to nearest
+inline uint64_t ISqrt64Rounded(uint64_t iVal)
+{
+    uint64_t res = ISqrt64(iVal);
+    return (iVal - res * res > res) ? res + 1 : res;
+}
+
+template <typename Number>
+inline Number SqrtInt(const Number &iVal)
+{
+    return std::sqrt(iVal);
+}
+
+// No FPU involved: sqrt(raw / 2^P) * 2^P = sqrt(raw * 2^P)
+// Negative inputs yield 0
+template <unsigned int P>
+inline FP32<P> SqrtInt(const FP32<P> &iVal)
+{
+    if (iVal <= 0)
+        return FP32<P>::FromFPVal(0);
+    uint64_t raw = static_cast<uint64_t>(iVal.GetRawValue());
+    return FP32<P>::FromFPVal(static_cast<int32_t>(ISqrt64Rounded(raw << P)));
+}
+
+template <typename Number>
+inline Number InvSqrtInt(const Number &iVal)
+{
+    return Number(1) / std::sqrt(iVal);
+}
+
+// 1 / sqrt(raw / 2^P) * 2^P = sqrt(2^3P / raw)
+// The numerator is shifted as much as 64 bits allow (by an even amount) for extra precision
+// iVal is assumed strictly positive
+template <unsigned int P>
+inline FP32<P> InvSqrtInt(const FP32<P> &iVal)
+{
+    static_assert(3 * P <= 62, "FP32 precision too high for InvSqrtInt");
+    constexpr unsigned int extraShift = (62u - 3u * P) & ~1u;
+
+    uint64_t num = 1ull << (3u * P + extraShift);
+    uint64_t res = ISqrt64Rounded(num / static_cast<uint64_t>(iVal.GetRawValue()));
+    return FP32<P>::FromFPVal(static_cast<int32_t>((res + (1ull << (extraShift / 2u) >> 1u)) >> (extraShift / 2u)));
+}
+
+// Reciprocals: 1/x computed once, then applied with a multiplication
+// FP32 uses FP32Recip, floating point types simply store 1/x
+template <typename Number>
+struct RecipTraits
+{
+    using Type = Number;
+
+    static Type Exact(const Number &iDen) { return Number(1) / iDen; }
+    static Type Fast(const Number &iDen) { return Number(1) / iDen; }
+    static Type ExactFromInt(int iDen) { return Number(1) / static_cast<Number>(iDen); }
+    static Type FastFromInt(int iDen) { return Number(1) / static_cast<Number>(iDen); }
+};
+
+template <unsigned int P>
+struct RecipTraits<FP32<P>>
+{
+    using Type = FP32Recip<P>;
+
+    static Type Exact(const FP32<P> &iDen) { return FP32Recip<P>(iDen); }
+    static Type Fast(const FP32<P> &iDen) { return FP32Recip<P>::Fast(iDen); }
+    static Type ExactFromInt(int iDen) { return FP32Recip<P>::FromInt(iDen); }
+    static Type FastFromInt(int iDen) { return FP32Recip<P>::FastFromInt(iDen); }
+};
+
+template <typename Number>
+using RecipType = typename RecipTraits<Number>::Type;
+
+template <typename Number>
+inline RecipType<Number> MakeRecip(const Number &iDen)
+{
+    return RecipTraits<Number>::Exact(iDen);
+}
 
-//     // Sanity check
-//     if (x0)
-//     {
-//         long x1 = (x0 + s / x0) >> 1; // Update
+template <typename Number>
+inline RecipType<Number> MakeFastRecip(const Number &iDen)
+{
+    return RecipTraits<Number>::Fast(iDen);
+}
 
-//         while (x1 < x0) // This also checks for cycle
-//         {
-//             x0 = x1;
-//             x1 = (x0 + s / x0) >> 1;
-//         }
+template <typename Number = CType>
+inline RecipType<Number> MakeRecipFromInt(int iDen)
+{
+    return RecipTraits<Number>::ExactFromInt(iDen);
+}
 
-//         return x0;
-//     }
-//     else
-//     {
-//         return s;
-//     }
-// }
+template <typename Number = CType>
+inline RecipType<Number> MakeFastRecipFromInt(int iDen)
+{
+    return RecipTraits<Number>::FastFromInt(iDen);
+}
 
 template <typename Vertex>
-inline CType SquareDist(const Vertex &iV1, const Vertex &iV2)
+inline VertexNumber<Vertex> SquareDist(const Vertex &iV1, const Vertex &iV2)
 {
     return (iV2.m_X - iV1.m_X) * (iV2.m_X - iV1.m_X) + (iV2.m_Y - iV1.m_Y) * (iV2.m_Y - iV1.m_Y);
 }
 
 template <typename Vertex>
-inline CType DistInt(const Vertex &iV1, const Vertex &iV2)
+inline VertexNumber<Vertex> DistInt(const Vertex &iV1, const Vertex &iV2)
 {
-    return std::sqrt(static_cast<float>(SquareDist(iV1, iV2)));
+    return SqrtInt(SquareDist(iV1, iV2));
 }
 
 template <typename Vertex>
 inline int Angle(const Vertex &iFrom, const Vertex &iTo1, const Vertex &iTo2)
 {
-    CType dot = DotProduct(iFrom, iTo1, iFrom, iTo2);
-    CType det = Det(iFrom, iTo1, iFrom, iTo2);
-    // Extremely non-optimized
-    // TODO: implement lookup table
-    double angle = -atan2(static_cast<float>(det), static_cast<float>(dot));
-    return static_cast<int>(angle / M_PI * (180.0 * static_cast<float>((1 << ANGLE_SHIFT))));
+    VertexNumber<Vertex> dot = DotProduct(iFrom, iTo1, iFrom, iTo2);
+    VertexNumber<Vertex> det = Det(iFrom, iTo1, iFrom, iTo2);
+    return -atan2Int(det, dot);
 }
 
 // Thanks to http://flassari.is/2008/11/line-line-intersection-in-cplusplus/ for writing
 // this boiler-plate piece of code for me
 // Note: this function returns false if lines are colinear, even if they are the same
-template <typename Vertex, typename Intermediate = CType>
+template <typename Vertex, typename Intermediate = VertexNumber<Vertex>>
 inline bool LineLineIntersection(const Vertex &iV1, const Vertex &iV2, const Vertex &iV3, const Vertex &iV4, Vertex &oIntersection)
 {
     // Store the values for fast access and easy
@@ -165,7 +482,7 @@ inline bool LineLineIntersection(const Vertex &iV1, const Vertex &iV2, const Ver
 
 // Really dirty, just wanted to try this out
 // TODO: code a real intersection solver
-template <typename Vertex, typename Intermediate = CType>
+template <typename Vertex, typename Intermediate = VertexNumber<Vertex>>
 inline bool HalfLineSegmentIntersection(const Vertex &iHalfLineFrom, const Vertex &iHalfLineTo, const Vertex &iV1, const Vertex &iV2, Vertex &oIntersection)
 {
     if (!LineLineIntersection<Vertex, Intermediate>(iHalfLineFrom, iHalfLineTo, iV1, iV2, oIntersection))
@@ -187,7 +504,7 @@ inline bool HalfLineSegmentIntersection(const Vertex &iHalfLineFrom, const Verte
 
 // As shitty as above
 // TODO: code a real intersection solver
-template <typename Vertex, typename Intermediate = CType>
+template <typename Vertex, typename Intermediate = VertexNumber<Vertex>>
 inline bool LineSegmentIntersection(const Vertex &iLineV1, const Vertex &iLineV2, const Vertex &iSegV1, const Vertex &iSegV2, Vertex &oIntersection)
 {
     if (!LineLineIntersection<Vertex, Intermediate>(iLineV1, iLineV2, iSegV1, iSegV2, oIntersection))
@@ -206,7 +523,7 @@ inline bool LineSegmentIntersection(const Vertex &iLineV1, const Vertex &iLineV2
 
 // As shitty as above
 // TODO: code a real intersection solver
-template <typename Vertex, typename Intermediate = CType>
+template <typename Vertex, typename Intermediate = VertexNumber<Vertex>>
 inline bool SegmentSegmentIntersection(const Vertex &iV1, const Vertex &iV2, const Vertex &iV3, const Vertex &iV4, Vertex &oIntersection)
 {
     if (!LineLineIntersection<Vertex, Intermediate>(iV1, iV2, iV3, iV4, oIntersection))
@@ -248,6 +565,81 @@ inline bool VertexOnXYAlignedSegment(Vertex iV1, Vertex iV2, const Vertex &iPoin
         return false;
 }
 
+// Fast paths for axis-aligned segments (all walls are), no multiplication involved unless stated otherwise
+
+// Same as WhichSide, iV1 and iV2 being a X or Y constant segment
+template <typename Vertex>
+inline int WhichSideOfXYAlignedSegment(const Vertex &iV1, const Vertex &iV2, const Vertex &iP)
+{
+    // WhichSide's product reduces to (p.x - v1.x) * (v2.y - v1.y), or (p.y - v1.y) * (v1.x - v2.x)
+    int sign1, sign2;
+    if (iV1.m_X == iV2.m_X)
+    {
+        sign1 = iP.m_X == iV1.m_X ? 0 : (iP.m_X > iV1.m_X ? 1 : -1);
+        sign2 = iV2.m_Y > iV1.m_Y ? 1 : -1;
+    }
+    else
+    {
+        sign1 = iP.m_Y == iV1.m_Y ? 0 : (iP.m_Y > iV1.m_Y ? 1 : -1);
+        sign2 = iV1.m_X > iV2.m_X ? 1 : -1;
+    }
+    return sign1 * sign2;
+}
+
+// Point at iS (in [0, 1]) along the segment. The constant coordinate is copied, one multiplication
+template <typename Vertex, typename Number>
+inline Vertex PointOnXYAlignedSegment(const Vertex &iV1, const Vertex &iV2, const Number &iS)
+{
+    Vertex ret = iV1;
+    if (iV1.m_X == iV2.m_X)
+        ret.m_Y = iV1.m_Y + (iV2.m_Y - iV1.m_Y) * iS;
+    else
+        ret.m_X = iV1.m_X + (iV2.m_X - iV1.m_X) * iS;
+    return ret;
+}
+
+// Same as SegmentSegmentIntersection (parallel segments never intersect), both segments being axis-aligned
+template <typename Vertex>
+inline bool XYAlignedSegmentSegmentIntersection(const Vertex &iV1, const Vertex &iV2, const Vertex &iV3, const Vertex &iV4, Vertex &oIntersection)
+{
+    bool isFirstXConst = iV1.m_X == iV2.m_X;
+    if (isFirstXConst == (iV3.m_X == iV4.m_X))
+        return false;
+
+    oIntersection.m_X = isFirstXConst ? iV1.m_X : iV3.m_X;
+    oIntersection.m_Y = isFirstXConst ? iV3.m_Y : iV1.m_Y;
+    return VertexOnXYAlignedSegment(iV1, iV2, oIntersection) && VertexOnXYAlignedSegment(iV3, iV4, oIntersection);
+}
+
+// Same as HalfLineSegmentIntersection, the segment being axis-aligned (the half line can be anything). One division
+template <typename Vertex, typename Intermediate = VertexNumber<Vertex>>
+inline bool HalfLineXYAlignedSegmentIntersection(const Vertex &iHalfLineFrom, const Vertex &iHalfLineTo, const Vertex &iV1, const Vertex &iV2, Vertex &oIntersection)
+{
+    // u is the segment's constant coordinate, v the other one
+    bool isXConst = iV1.m_X == iV2.m_X;
+    auto u = [isXConst](const Vertex &iV) -> Intermediate { return isXConst ? iV.m_X : iV.m_Y; };
+    auto v = [isXConst](const Vertex &iV) -> Intermediate { return isXConst ? iV.m_Y : iV.m_X; };
+
+    Intermediate du = u(iHalfLineTo) - u(iHalfLineFrom);
+    Intermediate dist = u(iV1) - u(iHalfLineFrom);
+    if (du == 0 || (dist != 0 && (dist < 0) != (du < 0)))
+        return false;
+
+    Intermediate vIntersection = v(iHalfLineFrom) + (v(iHalfLineTo) - v(iHalfLineFrom)) * dist / du;
+    if (isXConst)
+    {
+        oIntersection.m_X = iV1.m_X;
+        oIntersection.m_Y = vIntersection;
+    }
+    else
+    {
+        oIntersection.m_X = vIntersection;
+        oIntersection.m_Y = iV1.m_Y;
+    }
+
+    return VertexOnXYAlignedSegment(iV1, iV2, oIntersection);
+}
+
 template <typename Number>
 inline Number Clamp(Number iVal, Number iMin, Number iMax)
 {
@@ -279,10 +671,54 @@ inline double Mod<double>(const double &iVal, const double &iDiv)
         return iDiv + std::fmod(iVal, iDiv);
 }
 
-template <>
-inline FP32<FP_SHIFT> Mod<FP32<FP_SHIFT>>(const FP32<FP_SHIFT> &iVal, const FP32<FP_SHIFT> &iDiv)
+template <unsigned int P>
+inline FP32<P> Mod(const FP32<P> &iVal, const FP32<P> &iDiv)
 {
     return iVal - (static_cast<int>(iVal / iDiv) * iDiv);
 }
 
+// Helpers hiding the few places where the renderer relies on the fixed-point representation
+// FP32 overloads work on the raw value, floating point types do the equivalent arithmetic
+
+// iVal / 2^iShift
+template <typename Number>
+inline Number ShiftRight(const Number &iVal, unsigned int iShift)
+{
+    return iVal / static_cast<Number>(1 << iShift);
+}
+
+template <unsigned int P>
+inline FP32<P> ShiftRight(const FP32<P> &iVal, unsigned int iShift)
+{
+    return iVal >> iShift;
+}
+
+// Same rounding as FP32's conversion to int. Avoids std::floor, which is a libm call on some targets
+template <typename Number>
+inline int FloorToInt(const Number &iVal)
+{
+    int intPart = static_cast<int>(iVal);
+    return intPart > iVal ? intPart - 1 : intPart;
+}
+
+// floor(iInt * iFP). FP32 has its own (friend) overload
+template <typename Number>
+inline int32_t MultiplyIntFpToInt(int32_t iInt, const Number &iFP)
+{
+    return FloorToInt(iInt * iFP);
+}
+
+// Integer part of iVal, wrapped in [0, 2^iLog2Size[ (texture coordinates)
+template <typename Number>
+inline int WrapToInt(const Number &iVal, unsigned int iLog2Size)
+{
+    return FloorToInt(iVal) & ((1 << iLog2Size) - 1);
+}
+
+template <unsigned int P>
+inline int WrapToInt(const FP32<P> &iVal, unsigned int iLog2Size)
+{
+    return (iVal.GetRawValue() & ((1 << (iLog2Size + P)) - 1)) >> P;
+}
+
 #endif
\ No newline at end of file
@@ -30,6 +30,12 @@ protected:
                       std::list<KDBData::Wall> &oWithinSplitPlane);
     bool IsWallSetConvex(const std::list<KDBData::Wall> &iWalls) const;
     void ComputeWallSetAABB(const std::list<KDBData::Wall> &iWalls, KDMapData::Vertex &oAABBMin, KDMapData::Vertex &oAABBMax) const;
+    KDBData::Error PackWall(const KDBData::Wall &iWall, KDMapData::Wall &oKDWall) const;
+
+protected:
+    void LayoutKDTree(KDTreeMap *ioKDTree) const;
+    void RecursiveLayoutKDTree(const KDTreeNode *ipNode, std::vector<const KDTreeNode *> &oLayout) const;
+    void BuildPortalGraph(KDTreeMap *ioKDTree) const;
 
 protected:
     // Inputs/outputs
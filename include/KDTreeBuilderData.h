@@ -16,6 +16,7 @@ namespace KDBData
         INVALID_POLYGON,
         SECTOR_INTERSECTION,
         CANNOT_BREAK_WALL,
+        CANNOT_PACK_WALL,
         CANNOT_LOAD_TEXTURE,
         CANNOT_LOAD_SPRITE,
         UNKNOWN_FAILURE
@@ -3,9 +3,12 @@
 
 #include "Consts.h"
 #include "Light.h"
+#include "GeomUtils.h"
 
 #include <vector>
 #include <memory>
+#include <type_traits>
+#include <cstdint>
 
 namespace KDMapData
 {
@@ -27,25 +30,43 @@ namespace KDMapData
         int m_Y;
     };
 
-    class Wall
+    // Walls are axis-aligned (see KDTreeBuilder::BuildPolygon): one constant coordinate and a range along
+    // the other axis are enough. Plain data, streamed as is, see KDTreeBuilder::PackWall
+    struct Wall
     {
-    public:
-        Wall() {}
-        virtual ~Wall() {}
-
-    public:
-        Vertex m_From;
-        Vertex m_To;
-
-    public:
-        int m_InSector;
-        int m_OutSector;
-
-    public:
-        int m_TexId;
-        int m_TexUOffset;
-        int m_TexVOffset;
+        enum : uint8_t
+        {
+            X_CONST = 0x1, // Otherwise, y is constant
+            REVERSED = 0x2 // Goes from m_Max to m_Min
+        };
+
+        int16_t m_Const;
+        int16_t m_Min;
+        int16_t m_Max;
+
+        int16_t m_InSector;
+        int16_t m_OutSector;
+
+        int16_t m_TexUOffset;
+        int16_t m_TexVOffset;
+        int8_t m_TexId; // -1 if none
+        uint8_t m_Flags;
+
+        bool IsXConst() const { return m_Flags & X_CONST; }
+
+        Vertex GetFrom() const
+        {
+            int from = (m_Flags & REVERSED) ? m_Max : m_Min;
+            return IsXConst() ? Vertex{m_Const, from} : Vertex{from, m_Const};
+        }
+
+        Vertex GetTo() const
+        {
+            int to = (m_Flags & REVERSED) ? m_Min : m_Max;
+            return IsXConst() ? Vertex{m_Const, to} : Vertex{to, m_Const};
+        }
     };
+    static_assert(sizeof(Wall) == 16, "KDMapData::Wall is streamed as is");
 
     struct Texture
     {
@@ -69,11 +90,6 @@ public:
     KDTreeNode();
     virtual ~KDTreeNode();
 
-public:
-    unsigned int ComputeStreamSize() const;
-    void Stream(char *&ioData, unsigned int &oNbBytesWritten) const;
-    void UnStream(const char *ipData, unsigned int &oNbBytesRead);
-
 public:
     SplitPlane GetSplitPlane() const { return m_SplitPlane; }
     int GetSplitOffset() const { return m_SplitOffset; }
@@ -84,21 +100,6 @@ public:
     const KDMapData::Wall *GetWall(unsigned int iWallIdx) const { return &m_Walls[iWallIdx]; }
     void GetAABB(KDMapData::Vertex &oAABBMin, KDMapData::Vertex &oAABBMax) const;
 
-    template <typename WallType>
-    WallType BuildXYScaledWall(unsigned iWallIdx) const
-    {
-        const KDMapData::Wall &kdWall = m_Walls[iWallIdx];
-        WallType ret;
-
-        ret.m_VertexFrom.m_X = static_cast<CType>(kdWall.m_From.m_X) / POSITION_SCALE;
-        ret.m_VertexFrom.m_Y = static_cast<CType>(kdWall.m_From.m_Y) / POSITION_SCALE;
-
-        ret.m_VertexTo.m_X = static_cast<CType>(kdWall.m_To.m_X) / POSITION_SCALE;
-        ret.m_VertexTo.m_Y = static_cast<CType>(kdWall.m_To.m_Y) / POSITION_SCALE;
-
-        return ret;
-    }
-
 public:
     // For debugging purpose
     int ComputeDepth() const;
@@ -125,11 +126,40 @@ protected:
 
 private:
     friend class KDTreeBuilder;
-    friend class KDTreeRenderer;
+    template <typename Number> friend class KDTreeRenderer;
+};
+
+// Immutable, pointer-free counterpart of KDTreeNode, stored contiguously in KDTreeMap::m_Nodes
+// Children are indices in KDTreeMap::m_Nodes, walls a [m_FirstWall, m_FirstWall + m_NbWalls[ range of KDTreeMap::m_Walls
+// This is what gets streamed, in the order set by KDTreeBuilder (pre-order)
+struct KDTreeFlatNode
+{
+    static constexpr uint32_t NO_CHILD = 0xFFFFFFFFu;
+
+    KDTreeNode::SplitPlane m_SplitPlane;
+    int m_SplitOffset;
+
+    // See KDTreeNode
+    KDMapData::Vertex m_AABBMin;
+    KDMapData::Vertex m_AABBMax;
+
+    uint32_t m_PositiveSide;
+    uint32_t m_NegativeSide;
+
+    // Sector a side of the node is in, when it has no child (-1 if outside of the map)
+    // Leaves (SplitPlane::None) have the same sector on both sides: the inside of their convex wall set
+    int m_PositiveSideSector;
+    int m_NegativeSideSector;
+
+    uint32_t m_FirstWall;
+    uint32_t m_NbWalls;
 };
 
 class KDTreeMap
 {
+public:
+    static constexpr uint32_t NO_PVS = 0xFFFFFFFFu;
+
 public:
     KDTreeMap();
     virtual ~KDTreeMap();
@@ -146,19 +176,122 @@ public:
     CType GetPlayerStartY() const;
     int GetPlayerStartDirection() const;
 
+public:
+    unsigned int GetNbOfNodes() const { return static_cast<unsigned int>(m_Nodes.size()); }
+    const KDTreeFlatNode &GetNode(uint32_t iNodeIdx) const { return m_Nodes[iNodeIdx]; }
+    const KDMapData::Wall *GetWall(uint32_t iWallIdx) const { return &m_Walls[iWallIdx]; }
+
+    template <typename WallType>
+    WallType BuildXYScaledWall(uint32_t iWallIdx) const
+    {
+        const KDMapData::Wall &kdWall = m_Walls[iWallIdx];
+        KDMapData::Vertex from = kdWall.GetFrom();
+        KDMapData::Vertex to = kdWall.GetTo();
+        WallType ret;
+        using Number = std::decay_t<decltype(ret.m_VertexFrom.m_X)>;
+
+        ret.m_VertexFrom.m_X = static_cast<Number>(from.m_X) / POSITION_SCALE;
+        ret.m_VertexFrom.m_Y = static_cast<Number>(from.m_Y) / POSITION_SCALE;
+
+        ret.m_VertexTo.m_X = static_cast<Number>(to.m_X) / POSITION_SCALE;
+        ret.m_VertexTo.m_Y = static_cast<Number>(to.m_Y) / POSITION_SCALE;
+
+        return ret;
+    }
+
+    // Cell the point is in: the childless side of a node (or a leaf) the descent ends on, as 2 * node index + 1
+    // for the positive side, 2 * node index for the negative one (and for leaves)
+    // Coordinates are in render units, i.e. map units / POSITION_SCALE. The descent starts from the
+    // node of the point's sector grid cell, which in most cases is the one with the cell
+    template <typename Number>
+    uint32_t LocateCell(Number iX, Number iY) const
+    {
+        // Cells are [min, min + size[ in map units, the ones of the grid have no split plane going through them
+        uint32_t nodeIdx = 0u;
+        int cellX = (FloorToInt(iX * POSITION_SCALE) - m_SectorGridMin.m_X) >> m_SectorGridCellSizeLog2;
+        int cellY = (FloorToInt(iY * POSITION_SCALE) - m_SectorGridMin.m_Y) >> m_SectorGridCellSizeLog2;
+        if (cellX >= 0 && cellX < m_SectorGridWidth && cellY >= 0 && cellY < m_SectorGridHeight)
+            nodeIdx = m_SectorGrid[cellY * m_SectorGridWidth + cellX];
+
+        while (true)
+        {
+            const KDTreeFlatNode &node = m_Nodes[nodeIdx];
+
+            bool positiveSide = false;
+            if (node.m_SplitPlane == KDTreeNode::SplitPlane::XConst)
+                positiveSide = iX * POSITION_SCALE > Number(node.m_SplitOffset);
+            else if (node.m_SplitPlane == KDTreeNode::SplitPlane::YConst)
+                positiveSide = iY * POSITION_SCALE > Number(node.m_SplitOffset);
+
+            uint32_t childIdx = positiveSide ? node.m_PositiveSide : node.m_NegativeSide;
+            if (childIdx == KDTreeFlatNode::NO_CHILD)
+                return 2u * nodeIdx + (positiveSide ? 1u : 0u);
+            nodeIdx = childIdx;
+        }
+    }
+
+    // Sector (index in m_Sectors) the point is in, -1 if outside of the map. See LocateCell
+    template <typename Number>
+    int LocateSector(Number iX, Number iY) const
+    {
+        if (m_Nodes.empty())
+            return -1;
+
+        uint32_t cellIdx = LocateCell(iX, iY);
+        const KDTreeFlatNode &node = m_Nodes[cellIdx >> 1u];
+        return (cellIdx & 1u) ? node.m_PositiveSideSector : node.m_NegativeSideSector;
+    }
+
+    // Potentially visible set of a cell (see LocateCell), as GetNbOfNodes() node bits followed by one bit per wall
+    // False if there is none, i.e. anything may be visible
+    bool DecompressPVS(uint32_t iCellIdx, std::vector<uint8_t> &oBits) const;
+
 public:
     // For debugging purpose only
     int ComputeDepth() const;
+    // Drops the potentially visible sets, i.e. nothing is culled by them anymore
+    void ClearPVS();
+    // Lights keep their current value, e.g. to compare renders done at different moments
+    void FreezeLights();
 
 protected:
     unsigned int ComputeStreamSize() const;
 
+    void ComputeSideSectors(KDTreeFlatNode &ioNode) const;
+    void BuildSectorGrid();
+
+    int RecursiveComputeFlatDepth(uint32_t iNodeIdx) const;
+
 protected:
     std::vector<KDMapData::Texture> m_Textures;
     std::vector<KDMapData::Sector> m_Sectors;
 
+    // Build-time tree, filled by KDTreeBuilder
     KDTreeNode *m_RootNode;
 
+    // Flattened tree, laid out by KDTreeBuilder, streamed and loaded as is. Root node is m_Nodes[0]
+    std::vector<KDTreeFlatNode> m_Nodes;
+    std::vector<KDMapData::Wall> m_Walls;
+
+    // Uniform grid over the root node's AABB, see LocateSector
+    // Each cell holds the deepest node whose region contains the whole cell
+    std::vector<uint32_t> m_SectorGrid;
+    KDMapData::Vertex m_SectorGridMin;
+    unsigned int m_SectorGridCellSizeLog2;
+    int m_SectorGridWidth;
+    int m_SectorGridHeight;
+
+    // Potentially visible sets, computed by KDTreeBuilder (see PVSOperator)
+    // One offset in m_PVSData per cell (see LocateCell), NO_PVS for the sides of nodes that have a child
+    // Sets are bitsets in which runs of zero bytes are stored as a zero byte followed by their length
+    std::vector<uint32_t> m_PVSOffsets;
+    std::vector<uint8_t> m_PVSData;
+
+    // Sector/portal graph, computed by KDTreeBuilder. The portals (soft walls, indices in m_Walls) of sector i are
+    // m_SectorPortals[m_SectorPortalOffsets[i]] to m_SectorPortals[m_SectorPortalOffsets[i + 1] - 1]
+    std::vector<uint32_t> m_SectorPortalOffsets;
+    std::vector<uint32_t> m_SectorPortals;
+
     int m_PlayerStartX;
     int m_PlayerStartY;
     int m_PlayerStartDirection;
@@ -169,9 +302,9 @@ protected:
 
 private:
     friend class KDTreeBuilder;
-    friend class KDTreeRenderer;
-    friend class WallRenderer;
-    friend class FlatSurfacesRenderer;
+    template <typename Number> friend class KDTreeRenderer;
+    template <typename Number> friend class WallRenderer;
+    template <typename Number> friend class FlatSurfacesRenderer;
 };
 
 #endif
\ No newline at end of file
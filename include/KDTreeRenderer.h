@@ -7,60 +7,163 @@
 
 #include <vector>
 #include <array>
-#include <map>
+#include <memory>
 #include <cstring>
 #include <algorithm>
 
-class KDTreeRenderer
+// Number type agnostic interface, so that the renderer's number type can be picked at runtime
+// Player coordinates are exchanged using the application's number type (CType)
+class KDTreeRendererBase
+{
+public:
+    virtual ~KDTreeRendererBase() {}
+
+public:
+    virtual KDRData::NumberType GetNumberType() const = 0;
+
+    virtual const unsigned char* GetFrameBuffer() const = 0;
+    virtual unsigned char *GetFrameBuffer() = 0;
+
+    virtual void RefreshFrameBuffer() = 0;
+    virtual void ClearBuffers() = 0;
+
+    // The frame buffer is left as is when the view and the lights didn't change since the last frame
+    // Forces the next frame to be rendered from scratch, e.g. after writing to the frame buffer
+    virtual void InvalidateFrame() = 0;
+
+    virtual void SetPlayerCoordinates(const KDRData::Vertex<CType> &iPosition, int iDirection) = 0;
+
+    virtual KDRData::Vertex<CType> GetPlayerPosition() const = 0;
+    virtual int GetPlayerDirection() const = 0;
+
+    virtual KDRData::Vertex<CType> GetLook() const = 0;
+
+    virtual void SetRenderMode(KDRData::RenderMode iRenderMode) = 0;
+    virtual KDRData::RenderMode GetRenderMode() const = 0;
+
+    // Counters of the last rendered frame
+    virtual const KDRData::FrameStats &GetFrameStats() const = 0;
+};
+
+std::unique_ptr<KDTreeRendererBase> CreateKDTreeRenderer(const KDTreeMap &iMap, KDRData::NumberType iNumberType = KDRData::NumberType::FP32_14);
+
+template <typename Number>
+class KDTreeRenderer : public KDTreeRendererBase
 {
 public:
     KDTreeRenderer(const KDTreeMap &iMap);
+    virtual ~KDTreeRenderer();
 
 public:
-    const unsigned char* GetFrameBuffer() const;
-    unsigned char *GetFrameBuffer();
+    KDRData::NumberType GetNumberType() const override;
+
+    const unsigned char* GetFrameBuffer() const override;
+    unsigned char *GetFrameBuffer() override;
+
+    void RefreshFrameBuffer() override;
+    void ClearBuffers() override;
+    void InvalidateFrame() override;
+
+    void SetPlayerCoordinates(const KDRData::Vertex<CType> &iPosition, int iDirection) override;
 
-    void RefreshFrameBuffer();
-    void ClearBuffers();
+    KDRData::Vertex<CType> GetPlayerPosition() const override;
+    int GetPlayerDirection() const override;
 
-    void SetPlayerCoordinates(const KDRData::Vertex &iPosition, int iDirection);
+    KDRData::Vertex<CType> GetLook() const override;
 
-    KDRData::Vertex GetPlayerPosition() const;
-    int GetPlayerDirection() const;
+    void SetRenderMode(KDRData::RenderMode iRenderMode) override;
+    KDRData::RenderMode GetRenderMode() const override;
 
-    KDRData::Vertex GetLook() const;
+    const KDRData::FrameStats &GetFrameStats() const override;
 
 protected:
     void FillFrameBufferWithColor(unsigned char r, unsigned char g, unsigned char b);
     inline void WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b);
 
 protected:
-    CType ComputeZ();
-    CType RecursiveComputeZ(KDTreeNode *ipNode);
+    void BakeWalls();
+    void BakeNodes();
+    void ComputeSubtreeSizes(uint32_t iNodeIdx);
+    void BakePortalGraph();
+
+    Number ComputeZ();
+    void UpdatePVS();
+    inline bool IsInPVS(uint32_t iBitIdx) const;
+
+    void FloodPortals();
+    void ReachSector(int iSectorIdx, int iMinX, int iMaxX);
+    bool ClipPortalWindow(const KDRData::Wall<Number> &iPortal, int &ioMinX, int &ioMaxX) const;
+
+    KDRData::FrameReuse ComputeFrameReuse() const;
+    void CollectLitSectors();
+    void RecordLightValues();
+    void RedrawWalls();
 
     void Render();
-    void RenderNode(KDTreeNode *ipNode);
-    bool AddFlatSurface(KDRData::FlatSurface &iFlatSurface);
+    void RenderNodes();
+    void RenderNodeWalls(const KDRData::Node<Number> &iNode);
+    bool AddFlatSurface(uint32_t iFlatHandle);
     void RenderFlatSurfaces();
 
-    bool DoFrustumCulling(KDTreeNode *pNode) const;
+    bool DoFrustumCulling(const KDRData::Node<Number> &iNode) const;
+    bool DoOcclusionCulling(const KDRData::Node<Number> &iNode) const;
+    bool DoWallCulling(const KDRData::Wall<Number> &iWall, const KDRData::Vertex<Number> &iCameraFrom, const KDRData::Vertex<Number> &iCameraTo);
 
 protected:
     const KDTreeMap &m_Map;
+    std::vector<KDRData::Wall<Number>> m_Walls; // Same indices as the map's walls
+    KDRData::WallEndpoints<Number> m_WallEndpoints; // Same
+    KDRData::VisibleWalls<Number> m_VisibleWalls; // Culling results for the node being rendered
+    std::vector<KDRData::Node<Number>> m_Nodes; // Same indices as the map's nodes
+    std::vector<uint32_t> m_TraversalStack; // See RenderNodes
+
+    // Potentially visible set of the camera's cell, see KDTreeMap::DecompressPVS
+    std::vector<uint8_t> m_PVS;
+    bool m_HasPVS;
+    uint32_t m_PVSCellIdx;
+
+    // Portal mode, see FloodPortals. Sectors and nodes stamped with the current m_PortalFrame are the reached ones
+    KDRData::RenderMode m_RenderMode;
+    bool m_UsePortals; // Portal mode, and the camera is in a sector
+    uint32_t m_PortalFrame;
+    std::vector<uint32_t> m_NodeParents; // KDTreeFlatNode::NO_CHILD for the root
+    std::vector<uint32_t> m_SectorNodeOffsets; // Nodes holding walls of sector i are m_SectorNodes[m_SectorNodeOffsets[i]] onwards
+    std::vector<uint32_t> m_SectorNodes;
+    std::vector<uint32_t> m_NodeFrames;
+    std::vector<uint32_t> m_SectorFrames;
+    std::vector<KDRData::PortalWindow> m_SectorWindows; // Hull of the columns each reached sector is seen through
+    std::vector<int> m_PortalStack; // Sectors whose window grew since they were last flooded from, once each
+    std::vector<bool> m_IsSectorPending; // Whether the sector is in m_PortalStack
+
+    // Frame to frame coherence, see Render. Inputs of the last frame rendered from scratch
+    bool m_IsFrameValid;
+    KDRData::Vertex<Number> m_FramePosition;
+    int m_FrameDirection;
+    Number m_FrameZ;
+    KDRData::RenderMode m_FrameRenderMode;
+    std::vector<KDRData::DrawnWall<Number>> m_DrawnWalls; // In drawing order
+    std::vector<int> m_LitSectors; // Sectors whose light was used
+    std::vector<unsigned int> m_LitSectorValues; // Their light's value when last drawn
+    std::vector<bool> m_IsSectorLit; // Scratch, see CollectLitSectors
 
     unsigned char *m_pFrameBuffer;
-    unsigned char m_pHorizOcclusionBuffer[WINDOW_WIDTH];
     KDRData::HorizontalScreenSegments m_HorizDrawnSegs;
     int m_pTopOcclusionBuffer[WINDOW_WIDTH];
     int m_pBottomOcclusionBuffer[WINDOW_WIDTH];
 
-    std::map<CType, std::vector<KDRData::FlatSurface>> m_FlatSurfaces; // Flat surfaces are stored int the map according to their height
+    // Flat surfaces of the frame, see AddFlatSurface. They live until the next frame rendered from scratch (see Render)
+    static constexpr uint32_t FLAT_SURFACES_RESERVE = 128u; // About 1 MB, the shipped maps need less than 100
+    KDRData::FlatSurfaceArena<Number> m_FlatSurfaceArena;
+    std::vector<uint32_t> m_FlatSurfaces; // Handles, sorted by height
+    std::vector<uint32_t> m_GeneratedFlats; // Handles of the flats of the wall being rendered
 
-    KDRData::State m_State;
-    KDRData::Settings m_Settings;
+    KDRData::State<Number> m_State;
+    KDRData::Settings<Number> m_Settings;
+    KDRData::FrameStats m_FrameStats;
 };
 
-void KDTreeRenderer::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b)
+template <typename Number>
+void KDTreeRenderer<Number>::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b)
 {
     idx = idx << 2u;
     m_pFrameBuffer[idx] = r;
@@ -68,4 +171,10 @@ void KDTreeRenderer::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigne
     m_pFrameBuffer[idx + 2u] = b;
 }
 
-#endif
\ No newline at end of file
+template <typename Number>
+bool KDTreeRenderer<Number>::IsInPVS(uint32_t iBitIdx) const
+{
+    return !m_HasPVS || ((m_PVS[iBitIdx >> 3u] >> (iBitIdx & 7u)) & 1u);
+}
+
+#endif
@@ -4,36 +4,103 @@
 #include "Consts.h"
 #include "FP32.h"
 #include "KDTreeMap.h"
+#include "GeomUtils.h"
+#include "FP32xN.h"
 
-#include <list>
+#include <cstdint>
 #include <vector>
+#include <memory>
 
 namespace KDRData
 {
-    struct Vertex
+    // Number types the renderer is instantiated for, selectable at runtime
+    enum class NumberType
     {
-        CType m_X;
-        CType m_Y;
+        FP32_14, // FP32<14>, default
+        FP32_16, // FP32<16>
+        FLOAT,
+        DOUBLE
     };
 
-    struct Wall
+    // How the renderer finds what may be visible
+    enum class RenderMode
     {
-        Vertex m_VertexFrom;
-        Vertex m_VertexTo;
+        KDTree, // Front to back traversal of the whole KD tree, default
+        Portals // Same traversal, restricted to the sectors seen through soft walls (see KDTreeRenderer::FloodPortals)
+    };
 
-        const KDMapData::Wall *m_pKDWall;
+    // How much of the previous frame is reused, see KDTreeRenderer::Render
+    enum class FrameReuse
+    {
+        None, // Rendered from scratch
+        Shading, // Same view but some lights changed, the walls drawn last frame are drawn again and flats are reused
+        FrameBuffer // Nothing changed, the frame buffer is left as is
     };
 
+    // Per frame counters, reset at the beginning of each frame (for profiling purposes)
+    struct FrameStats
+    {
+        unsigned int m_NbVisitedNodes; // Nodes that made it through culling
+        unsigned int m_NbOcclusionCulledNodes; // Nodes of the subtrees skipped because hidden behind closed columns
+        unsigned int m_NbOcclusionCulledWalls; // Walls of these nodes
+        unsigned int m_NbPVSCulledNodes; // Nodes of the subtrees out of the potentially visible set of the camera's cell
+        unsigned int m_NbPVSCulledWalls; // Walls of these nodes, and walls of the visited nodes out of it
+        unsigned int m_NbReachedSectors; // Portal mode only, sectors seen through the portals (camera's one included)
+        unsigned int m_NbPortalCulledNodes; // Nodes of the subtrees without any wall of these sectors
+        unsigned int m_NbPortalCulledWalls; // Walls of these nodes, and walls of the visited nodes out of the windows
+
+        // Walls of the visited nodes that made it through frustum culling, see KDTreeRenderer::DoWallCulling
+        unsigned int m_NbBackFacingWalls; // Hard walls seen from behind
+        unsigned int m_NbEmptyWalls; // Less than a column wide
+        unsigned int m_NbOccludedWalls; // All of their columns closed
+        unsigned int m_NbRenderedWalls; // Handed over to a WallRenderer
+
+        // Counters above are the ones of the last frame rendered from scratch
+        FrameReuse m_Reuse;
+    };
+
+    // Renderer data is templated on the renderer's number type
+    template <typename Number>
+    struct Vertex
+    {
+        Number m_X;
+        Number m_Y;
+    };
+
+    template <typename Number>
     struct Sector
     {
-        CType m_Floor;
-        CType m_Ceiling;
+        Number m_Floor;
+        Number m_Ceiling;
 
         const KDMapData::Sector *m_pKDSector;
     };
 
+    // Render-ready wall, baked once per map by the renderer (see KDTreeRenderer::BakeWalls)
+    template <typename Number>
+    struct Wall
+    {
+        Vertex<Number> m_VertexFrom;
+        Vertex<Number> m_VertexTo;
+        bool m_IsXConst; // Walls are axis aligned, false means m_VertexFrom.m_Y == m_VertexTo.m_Y
+
+        int m_InSectorIdx;
+        int m_OutSectorIdx;
+        Sector<Number> m_InSector; // Zeroed, with a null m_pKDSector, when the index is -1
+        Sector<Number> m_OutSector; // Same
+
+        const KDMapData::Texture *m_pTexture; // nullptr if the wall is not textured
+        int m_TexUOffset;
+        int m_TexVOffset;
+        Number m_TexelXScale;
+        Number m_TexelYScale;
+
+        const KDMapData::Wall *m_pKDWall;
+    };
+
     // Totally Doom-inspired (Doom calls these 'Visplanes')
     // See Fabien Sanglard's really good book about the Doom Engine :)
+    template <typename Number>
     class FlatSurface
     {
     public:
@@ -41,6 +108,7 @@ namespace KDRData
         FlatSurface(const FlatSurface &iOther);
 
     public:
+        // Columns out of [m_MinX, m_MaxX] hold no data, they are not even initialised when coming from a FlatSurfaceArena
         bool Absorb(const FlatSurface &iOther);
         void Tighten();
 
@@ -51,11 +119,44 @@ namespace KDRData
         int m_MinY[WINDOW_WIDTH];
         int m_MaxY[WINDOW_WIDTH];
 
-        CType m_Height;
+        Number m_Height;
         int m_SectorIdx;
         int m_TexId;
     };
 
+    // Flat surfaces of a frame, built in place and referenced by handle
+    // Storage grows by blocks up to the most surfaces a frame needed and is kept from frame to frame, so that surfaces
+    // never move and steady-state frames don't allocate anything
+    template <typename Number>
+    class FlatSurfaceArena
+    {
+    public:
+        FlatSurfaceArena();
+        virtual ~FlatSurfaceArena();
+
+    public:
+        // Blocks for that many surfaces at a time, up front
+        void Reserve(uint32_t iNbSurfaces);
+
+        // Columns of [iMinX, iMaxX] are empty, the others are left as is
+        uint32_t Allocate(int iMinX, int iMaxX);
+        void Release(uint32_t iHandle);
+        void Reset();
+
+        FlatSurface<Number> &Get(uint32_t iHandle) { return m_Blocks[iHandle / BLOCK_SIZE][iHandle % BLOCK_SIZE]; }
+        const FlatSurface<Number> &Get(uint32_t iHandle) const { return m_Blocks[iHandle / BLOCK_SIZE][iHandle % BLOCK_SIZE]; }
+
+    protected:
+        void AddBlock();
+
+    protected:
+        static constexpr uint32_t BLOCK_SIZE = 32u;
+
+        std::vector<std::unique_ptr<FlatSurface<Number>[]>> m_Blocks;
+        uint32_t m_NbAllocated; // Handles below it are in use, but for the released ones
+        std::vector<uint32_t> m_ReleasedHandles;
+    };
+
     // For sprite clipping
     // Doom-inspired as well
     class SpriteClippingSegment
@@ -85,6 +186,8 @@ namespace KDRData
     };
 
     // For horizontal occlusion
+    // Columns closed by hard walls, or by the floor and ceiling clips of soft walls meeting, as a sorted array of disjoint, non-adjacent [start, end] runs.
+    // Two runs are at least one open column apart, so WINDOW_WIDTH / 2 + 1 runs are always enough: no allocation
     class HorizontalScreenSegments
     {
     public:
@@ -94,52 +197,261 @@ namespace KDRData
     public:
         void AddScreenSegment(unsigned int iMinX, unsigned int iMaxX);
         bool IsScreenEntirelyDrawn() const;
+        bool IsSegmentEntirelyDrawn(unsigned int iMinX, unsigned int iMaxX) const;
+        // First open column of [iMinX, iMaxX], iMaxX + 1 if none. oOpenRunEnd is the last column of
+        // the open run it starts, clipped to iMaxX (iMaxX if none). O(log n)
+        unsigned int NextOpenColumn(unsigned int iMinX, unsigned int iMaxX, unsigned int &oOpenRunEnd) const;
         void Clear();
 
     protected:
-        struct IntervalEnd
-        {
-            unsigned int m_X;
-            int m_Direction; // +1 or -1
-
-            friend bool operator < (const IntervalEnd &iEnd1, const IntervalEnd &iEnd2)
-            {
-                if(iEnd1.m_X != iEnd2.m_X)
-                    return iEnd1.m_X < iEnd2.m_X;
-                else
-                    return iEnd1.m_Direction > iEnd2.m_Direction; // Yup, this way
-            }
-        };
+        // Index of the first run ending at or after iX
+        unsigned int FindRun(unsigned int iX) const;
 
     protected:
-        void InsertIntervalEnd(const IntervalEnd &iEnd);
+        static constexpr unsigned int MAX_NB_RUNS = WINDOW_WIDTH / 2 + 1;
 
-    protected:
-        std::list<IntervalEnd> m_Segments;
+        uint16_t m_Starts[MAX_NB_RUNS];
+        uint16_t m_Ends[MAX_NB_RUNS];
+        unsigned int m_NbRuns;
+    };
+
+    // Camera space: depth along the look direction, lateral offset towards the right of the screen
+    // The slope (lateral offset / depth) of a point gives its column:
+    // x = WINDOW_WIDTH / 2 + WINDOW_WIDTH * m_HorizontalDistortionCst * slope
+    template <typename Number>
+    struct ColumnRays
+    {
+        Number m_Slopes[WINDOW_WIDTH]; // Ray going through the left side of each column
+        Number m_EdgeSlope; // Frustum edges are at -m_EdgeSlope and m_EdgeSlope
     };
 
+    template <typename Number>
     struct Settings
     {
         int m_PlayerHorizontalFOV;
         int m_PlayerVerticalFOV;
-        CType m_PlayerHeight;
-        CType m_HorizontalDistortionCst;
-        CType m_VerticalDistortionCst;
+        Number m_PlayerHeight;
+        Number m_NearPlane; // Depth, in camera space
+
+        // Derived from the above, see UpdateDerivedSettings
+        Number m_HorizontalDistortionCst;
+        Number m_VerticalDistortionCst;
+        ColumnRays<Number> m_ColumnRays;
     };
 
+    // Needs to be called whenever the FOVs change. This is the only place where the renderer needs trigonometry,
+    // frames only use the results
+    template <typename Number>
+    void UpdateDerivedSettings(Settings<Number> &ioSettings)
+    {
+        Number tanHalfHorizontalFOV = tanInt<Number>(ioSettings.m_PlayerHorizontalFOV / 2);
+        ioSettings.m_HorizontalDistortionCst = 1 / (2 * tanHalfHorizontalFOV);
+        ioSettings.m_VerticalDistortionCst = 1 / (2 * tanInt<Number>(ioSettings.m_PlayerVerticalFOV / 2));
+
+        ColumnRays<Number> &rays = ioSettings.m_ColumnRays;
+        rays.m_EdgeSlope = tanHalfHorizontalFOV;
+        RecipType<Number> windowWidthRecip = MakeRecipFromInt<Number>(WINDOW_WIDTH);
+        for (int x = 0; x < WINDOW_WIDTH; x++)
+            rays.m_Slopes[x] = (Number(2 * x - WINDOW_WIDTH) * tanHalfHorizontalFOV) * windowWidthRecip;
+    }
+
+    template <typename Number>
     struct State
     {
-        KDRData::Vertex m_PlayerPosition;
-        CType m_PlayerZ;
+        KDRData::Vertex<Number> m_PlayerPosition;
+        Number m_PlayerZ;
         int m_PlayerDirection;
-        KDRData::Vertex m_FrustumToLeft;
-        KDRData::Vertex m_FrustumToRight;
-        KDRData::Vertex m_Look;
+        KDRData::Vertex<Number> m_Look;
+        KDRData::Vertex<Number> m_Right; // Lateral axis of the camera space, same convention as m_Look
+
+        // Camera space rotation: sin/cos of m_PlayerDirection
+        Number m_CameraSin;
+        Number m_CameraCos;
+
+        // Frustum planes, as world space normals: (vertex - m_PlayerPosition) . normal is >= 0 inside of the frustum
+        // (>= Settings::m_NearPlane for the near plane)
+        KDRData::Vertex<Number> m_FrustumLeftNormal;
+        KDRData::Vertex<Number> m_FrustumRightNormal;
+        KDRData::Vertex<Number> m_FrustumNearNormal;
+
+        // 1 if both frustum edges go towards increasing X from the player, -1 if both go towards decreasing X, 0 otherwise
+        int m_FrustumXSign;
+        int m_FrustumYSign; // Same
     };
 
-    Wall GetWallFromNode(KDTreeNode *ipNode, unsigned int iWallIdx);
-    void GetAABBFromNode(KDTreeNode *ipNode, KDRData::Vertex &oAABBMin,  KDRData::Vertex &oAABBMax);
-    Sector GetSectorFromKDSector(const KDMapData::Sector &iSector);
+    // Sector reached through portals, along with the columns it may be seen through (see KDTreeRenderer::FloodPortals)
+    struct PortalWindow
+    {
+        int m_SectorIdx;
+        int m_MinX;
+        int m_MaxX;
+    };
+
+    // Camera space (see ColumnRays): m_X is the lateral offset, m_Y the depth
+    template <typename Number>
+    Vertex<Number> ToCameraSpace(const State<Number> &iState, const Vertex<Number> &iVertex)
+    {
+        Number dX = iVertex.m_X - iState.m_PlayerPosition.m_X;
+        Number dY = iVertex.m_Y - iState.m_PlayerPosition.m_Y;
+
+        Vertex<Number> ret;
+        ret.m_X = dX * iState.m_CameraCos - dY * iState.m_CameraSin;
+        ret.m_Y = dX * iState.m_CameraSin + dY * iState.m_CameraCos;
+        return ret;
+    }
+
+    // KDTreeFlatNode in render units, baked once per map by the renderer (see KDTreeRenderer::BakeNodes)
+    template <typename Number>
+    struct Node
+    {
+        KDTreeNode::SplitPlane m_SplitPlane;
+        Number m_SplitOffset;
+
+        Vertex<Number> m_AABBMin;
+        Vertex<Number> m_AABBMax;
+
+        uint32_t m_PositiveSide; // KDTreeFlatNode::NO_CHILD if none
+        uint32_t m_NegativeSide; // Same
+
+        uint32_t m_FirstWall;
+        uint32_t m_NbWalls;
+
+        // Node included, for FrameStats
+        uint32_t m_NbSubtreeNodes;
+        uint32_t m_NbSubtreeWalls;
+    };
+
+    // Endpoints of the baked walls, as a structure of arrays so that the walls of a node can be culled in batches
+    template <typename Number>
+    struct WallEndpoints
+    {
+        std::vector<Number> m_XFrom;
+        std::vector<Number> m_YFrom;
+        std::vector<Number> m_XTo;
+        std::vector<Number> m_YTo;
+    };
+
+    // Walls of a node that survived CullWalls, along with their camera space vertices
+    // Arrays are sized once for the biggest node, m_Count is the number of valid entries
+    template <typename Number>
+    struct VisibleWalls
+    {
+        std::vector<uint32_t> m_Indices;
+        std::vector<Vertex<Number>> m_CameraFrom;
+        std::vector<Vertex<Number>> m_CameraTo;
+        unsigned int m_Count;
+    };
+
+    // Wall handed over to a WallRenderer, kept so that it can be drawn again with other lights
+    template <typename Number>
+    struct DrawnWall
+    {
+        uint32_t m_WallIdx;
+        Vertex<Number> m_CameraFrom;
+        Vertex<Number> m_CameraTo;
+    };
+
+    // Frustum culling, in camera space: the frustum edges are lateral = -/+ edgeSlope * depth
+    template <typename Number>
+    void CullWall(const WallEndpoints<Number> &iWalls, uint32_t iWallIdx, const State<Number> &iState, const Settings<Number> &iSettings, VisibleWalls<Number> &ioVisible)
+    {
+        Vertex<Number> from = ToCameraSpace(iState, {iWalls.m_XFrom[iWallIdx], iWalls.m_YFrom[iWallIdx]});
+        Vertex<Number> to = ToCameraSpace(iState, {iWalls.m_XTo[iWallIdx], iWalls.m_YTo[iWallIdx]});
+
+        Number edgeSlope = iSettings.m_ColumnRays.m_EdgeSlope;
+        if ((from.m_Y < iSettings.m_NearPlane && to.m_Y < iSettings.m_NearPlane) ||
+            (from.m_X + from.m_Y * edgeSlope <= 0 && to.m_X + to.m_Y * edgeSlope <= 0) ||
+            (from.m_X - from.m_Y * edgeSlope >= 0 && to.m_X - to.m_Y * edgeSlope >= 0))
+            return;
+
+        ioVisible.m_Indices[ioVisible.m_Count] = iWallIdx;
+        ioVisible.m_CameraFrom[ioVisible.m_Count] = from;
+        ioVisible.m_CameraTo[ioVisible.m_Count] = to;
+        ioVisible.m_Count++;
+    }
+
+    // Culls the walls [iFirst, iFirst + iCount[ (i.e. a node's walls), survivors are written to oVisible
+    template <typename Number>
+    void CullWalls(const WallEndpoints<Number> &iWalls, uint32_t iFirst, uint32_t iCount, const State<Number> &iState, const Settings<Number> &iSettings, VisibleWalls<Number> &oVisible)
+    {
+        oVisible.m_Count = 0u;
+        for (uint32_t i = iFirst; i < iFirst + iCount; i++)
+            CullWall(iWalls, i, iState, iSettings, oVisible);
+    }
+
+    // Same, FP32xN::WIDTH walls at a time. Bit for bit identical to CullWall
+    template <unsigned int P>
+    void CullWalls(const WallEndpoints<FP32<P>> &iWalls, uint32_t iFirst, uint32_t iCount, const State<FP32<P>> &iState, const Settings<FP32<P>> &iSettings, VisibleWalls<FP32<P>> &oVisible)
+    {
+        using Pack = FP32xN<P>;
+        static_assert(sizeof(FP32<P>) == sizeof(int32_t), "FP32 arrays are loaded as raw values");
+
+        const int32_t *pXFrom = reinterpret_cast<const int32_t *>(iWalls.m_XFrom.data());
+        const int32_t *pYFrom = reinterpret_cast<const int32_t *>(iWalls.m_YFrom.data());
+        const int32_t *pXTo = reinterpret_cast<const int32_t *>(iWalls.m_XTo.data());
+        const int32_t *pYTo = reinterpret_cast<const int32_t *>(iWalls.m_YTo.data());
+
+        const Pack playerX(iState.m_PlayerPosition.m_X);
+        const Pack playerY(iState.m_PlayerPosition.m_Y);
+        const Pack cameraSin(iState.m_CameraSin);
+        const Pack cameraCos(iState.m_CameraCos);
+        const Pack edgeSlope(iSettings.m_ColumnRays.m_EdgeSlope);
+        const Pack nearPlane(iSettings.m_NearPlane);
+        const Pack zero = Pack::FromInt(0);
+
+        oVisible.m_Count = 0u;
+        uint32_t i = iFirst;
+        for (; i + Pack::WIDTH <= iFirst + iCount; i += Pack::WIDTH)
+        {
+            Pack dXFrom = Pack::LoadRaw(pXFrom + i) - playerX;
+            Pack dYFrom = Pack::LoadRaw(pYFrom + i) - playerY;
+            Pack dXTo = Pack::LoadRaw(pXTo + i) - playerX;
+            Pack dYTo = Pack::LoadRaw(pYTo + i) - playerY;
+
+            Pack fromX = dXFrom * cameraCos - dYFrom * cameraSin;
+            Pack fromY = dXFrom * cameraSin + dYFrom * cameraCos;
+            Pack toX = dXTo * cameraCos - dYTo * cameraSin;
+            Pack toY = dXTo * cameraSin + dYTo * cameraCos;
+
+            unsigned int culled = ((fromY < nearPlane) & (toY < nearPlane)) |
+                                  ((fromX + fromY * edgeSlope <= zero) & (toX + toY * edgeSlope <= zero)) |
+                                  ((fromX - fromY * edgeSlope >= zero) & (toX - toY * edgeSlope >= zero));
+            if (culled == Pack::ALL_LANES)
+                continue;
+
+            int32_t rawFromX[Pack::WIDTH], rawFromY[Pack::WIDTH], rawToX[Pack::WIDTH], rawToY[Pack::WIDTH];
+            fromX.StoreRaw(rawFromX);
+            fromY.StoreRaw(rawFromY);
+            toX.StoreRaw(rawToX);
+            toY.StoreRaw(rawToY);
+            for (unsigned int k = 0; k < Pack::WIDTH; k++)
+            {
+                if (culled & (1u << k))
+                    continue;
+
+                oVisible.m_Indices[oVisible.m_Count] = i + k;
+                oVisible.m_CameraFrom[oVisible.m_Count] = {FP32<P>::FromFPVal(rawFromX[k]), FP32<P>::FromFPVal(rawFromY[k])};
+                oVisible.m_CameraTo[oVisible.m_Count] = {FP32<P>::FromFPVal(rawToX[k]), FP32<P>::FromFPVal(rawToY[k])};
+                oVisible.m_Count++;
+            }
+        }
+
+        // Remaining walls
+        for (; i < iFirst + iCount; i++)
+            CullWall(iWalls, i, iState, iSettings, oVisible);
+    }
+
+    template <typename Number>
+    Sector<Number> GetSectorFromKDSector(const KDMapData::Sector &iSector)
+    {
+        Sector<Number> sector;
+
+        sector.m_pKDSector = &iSector;
+        sector.m_Ceiling = Number(iSector.ceiling) / POSITION_SCALE;
+        sector.m_Floor = Number(iSector.floor) / POSITION_SCALE;
+
+        return sector;
+    }
 } // namespace KDRData
 
 #endif
\ No newline at end of file
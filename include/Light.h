@@ -3,6 +3,8 @@
 
 #include "Consts.h"
 
+#include <algorithm>
+
 #ifdef __EXPERIMENGINE__
 #include <engine/utils/Timer.hpp>
 #else
@@ -43,7 +45,12 @@ Light* UnstreamLight(const char* ipData, unsigned int& oNbBytesRead);
 
 namespace LightTools
 {
-	CType GetMaxInterpolationDist(unsigned int iLightValue);
+	template <typename Number = CType>
+	Number GetMaxInterpolationDist(unsigned int iLightValue)
+	{
+		return std::max<Number>(Number(static_cast<int>(iLightValue)) * Number(3) / POSITION_SCALE, Number(100) / POSITION_SCALE);
+	}
+
 	unsigned int GetMinLight(unsigned int iLightValue);
 } // namespace LightTools
 
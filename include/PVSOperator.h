@@ -0,0 +1,110 @@
+#ifndef PVSOperator_h
+#define PVSOperator_h
+
+#include "KDTreeBuilderData.h"
+#include "KDTreeMap.h"
+
+#include <vector>
+#include <cstdint>
+
+// Offline potentially visible sets
+// A cell is a childless side of a node (or a leaf), i.e. a box of the KD partition. Walls only lie on the boundaries
+// of cells, but for the ones of leaves, so a line of sight goes from cell to cell through the parts of their common
+// boundaries which are not hard walls seen from the front (portals). Whatever can be seen from a cell is found by
+// flooding from portal to portal, the part of each portal which may be seen through the previous one being narrowed
+// by the lines separating the cell from it. Walls inside leaves are not taken into account, so the result is
+// conservative: a wall out of the set of a cell cannot be seen from anywhere in it.
+// Cells outside of the map get a set too: hard walls are back face culled, so they are seen through from there
+class PVSOperator
+{
+public:
+    PVSOperator(const std::vector<KDTreeFlatNode> &iNodes, const std::vector<KDMapData::Wall> &iWalls);
+    virtual ~PVSOperator();
+
+public:
+    KDBData::Error Run();
+
+    // See KDTreeMap::m_PVSOffsets and KDTreeMap::m_PVSData
+    const std::vector<uint32_t> &GetOffsets() const { return m_Offsets; }
+    const std::vector<uint8_t> &GetData() const { return m_Data; }
+
+protected:
+    struct Point
+    {
+        double m_X;
+        double m_Y;
+    };
+
+    struct Box
+    {
+        int m_MinX;
+        int m_MinY;
+        int m_MaxX;
+        int m_MaxY;
+    };
+
+    struct Cell
+    {
+        uint32_t m_Idx; // 2 * node index, + 1 for the positive side
+        Box m_Box;
+    };
+
+    // Points p such that m_A * p.x + m_B * p.y + m_C <= 0 are kept. (m_A, m_B) is a unit vector
+    struct HalfPlane
+    {
+        double m_A;
+        double m_B;
+        double m_C;
+    };
+
+    // Part of the common boundary of two cells (indices in m_Cells)
+    // m_IsOpen[i] tells whether lines of sight go through it towards m_Cells[i], i.e. no hard wall faces the other cell
+    struct Portal
+    {
+        Point m_From;
+        Point m_To;
+        unsigned int m_Cells[2];
+        bool m_IsOpen[2];
+    };
+
+    // Part of a portal already flooded through, towards one of its cells
+    struct FloodedRange
+    {
+        double m_Min;
+        double m_Max;
+        unsigned int m_NbFloods;
+    };
+
+protected:
+    void CollectCells(uint32_t iNodeIdx, const Box &iRegion);
+    void CollectCells(uint32_t iNodeIdx, const Box &iRegion, const Box &iQuery, std::vector<unsigned int> &oCells) const;
+    void BuildPortals();
+    void AddPortals(unsigned int iCell1, unsigned int iCell2, bool iIsXConst, int iConst, int iMin, int iMax);
+    void ComputeCellPVS(unsigned int iCell, std::vector<bool> &oVisibleWalls);
+    void Flood(unsigned int iPortalIdx, unsigned int iToSide, double iMin, double iMax, std::vector<bool> &ioVisibleWalls);
+    bool ComputeSubtreeVisibility(uint32_t iNodeIdx, const std::vector<bool> &iVisibleWalls, std::vector<bool> &oVisibleNodes) const;
+
+    void ComputeClipPlanes(const Point &iFrom, const Point &iTo, std::vector<HalfPlane> &oPlanes) const;
+    bool ClipSegment(const Point &iFrom, const Point &iTo, const std::vector<HalfPlane> &iPlanes, double &oMin, double &oMax) const;
+
+    static void Compress(const std::vector<uint8_t> &iBits, std::vector<uint8_t> &oCompressed);
+
+protected:
+    const std::vector<KDTreeFlatNode> &m_Nodes;
+    const std::vector<KDMapData::Wall> &m_Walls;
+
+    std::vector<Cell> m_Cells;
+    std::vector<unsigned int> m_CellIndices; // Index in m_Cells of each Cell::m_Idx
+    std::vector<Portal> m_Portals;
+    std::vector<std::vector<unsigned int>> m_CellWalls; // Walls crossing the closed box of each cell
+    std::vector<std::vector<unsigned int>> m_CellPortals;
+
+    // Current cell, see ComputeCellPVS
+    Point m_CellCorners[4];
+    std::vector<FloodedRange> m_FloodedRanges; // Two per portal
+
+    std::vector<uint32_t> m_Offsets;
+    std::vector<uint8_t> m_Data;
+};
+
+#endif
@@ -9,12 +9,12 @@
 #include <SFML/Window/Event.hpp>
 #include <SFML/System.hpp>
 
-class KDTreeRenderer;
+class KDTreeRendererBase;
 
 class Screen : public sf::Drawable
 {
 public:
-    Screen(const KDTreeRenderer &iRenderer);
+    Screen(const KDTreeRendererBase &iRenderer);
 
     void refresh();
 
@@ -27,7 +27,7 @@ private:
     sf::Sprite _sprite;
 
 private:
-    const KDTreeRenderer &m_Renderer;
+    const KDTreeRendererBase &m_Renderer;
 };
 
 #endif
\ No newline at end of file
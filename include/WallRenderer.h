@@ -5,90 +5,176 @@
 #include "GeomUtils.h"
 
 #include <vector>
+#include <cstdint>
+#include <cstring>
 
+// Incremental (forward differenced) evaluation of the render parameters that only depend on the column.
+// Deltas are set up once per wall, then moving to the next column only costs additions.
+// Moving anywhere else (e.g. over occluded columns) seeds the stepper again from the exact formulas, in O(1)
+template <typename Number>
+class ColumnStepper
+{
+public:
+    // u/z and 1/z accumulate rounding errors, they are seeded again every RESEED_INTERVAL columns
+    // Seeds are not worth packing with FP32xN: computing the next ones of a run ahead measured slower than doing them one by one
+    static constexpr int RESEED_INTERVAL = 16;
+    // Extra precision bits of the u/z and 1/z deltas
+    static constexpr unsigned int EXTRA_SHIFT = 4u;
+
+public:
+    ColumnStepper(int iMinX, int iMaxX, Number iInvMinMaxXRange, int64_t iInvMinMaxXRangeInt,
+                  int iMinVertexBottomPixel, int iMaxVertexBottomPixel,
+                  int iMinVertexTopPixel, int iMaxVertexTopPixel);
+
+    // Perspective correct texturing: u/z and 1/z at both ends of the wall
+    void SetupTexture(Number iMinUOverZ, Number iMaxUOverZ, Number iMinInvZ, Number iMaxInvZ);
+
+    // Texturing is a template parameter so that column loops don't test it, u/z and 1/z are left as is without it
+    template <bool iIsTextured>
+    inline void MoveTo(int iX);
+
+    Number GetT() const { return ShiftRight(m_TScaled, 7u); }
+    int GetMinYUnclamped() const { return static_cast<int>(m_MinY >> 16); }
+    int GetMaxYUnclamped() const { return static_cast<int>(m_MaxY >> 16); }
+    Number GetUOverZ() const { return m_UOverZ + ShiftRight(m_UOverZOffset, EXTRA_SHIFT); }
+    Number GetInvZ() const { return m_InvZ + ShiftRight(m_InvZOffset, EXTRA_SHIFT); }
+
+protected:
+    template <bool iIsTextured>
+    void Seed(int iX);
+
+protected:
+    int m_X;
+    int m_LastSeedX;
+
+    int m_MinX;
+    Number m_InvMinMaxXRange; // Shifted by 7 bits, see WallRenderer::RenderWall
+
+    // Pixels are stepped as 48.16 fixed point integers, whatever the number type
+    int64_t m_MinYFrom;
+    int64_t m_MaxYFrom;
+    int64_t m_MinYDelta;
+    int64_t m_MaxYDelta;
+
+    Number m_MinUOverZ;
+    Number m_MaxUOverZ;
+    Number m_MinInvZ;
+    Number m_MaxInvZ;
+    Number m_UOverZDelta; // Shifted by EXTRA_SHIFT bits
+    Number m_InvZDelta;   // Shifted by EXTRA_SHIFT bits
+
+    // Current column
+    Number m_TScaled;
+    int64_t m_MinY;
+    int64_t m_MaxY;
+    Number m_UOverZ;
+    Number m_UOverZOffset;
+    Number m_InvZ;
+    Number m_InvZOffset;
+};
+
+// Parts of a wall drawn by the same column loop, see WallRenderer::RenderColumns
+enum class WallPart
+{
+    Hard, // Floor and ceiling on both ends of the columns
+    SoftTop, // Raises the top occlusion buffer, ceiling above
+    SoftBottom // Raises the bottom occlusion buffer, floor below
+};
+
+template <typename Number>
 class WallRenderer
 {
 public:
-    WallRenderer(KDRData::Wall &iWall, const KDRData::State &iState, const KDRData::Settings &iSettings, const KDTreeMap &iMap);
+    WallRenderer(const KDRData::Wall<Number> &iWall, const KDRData::Vertex<Number> &iCameraFrom, const KDRData::Vertex<Number> &iCameraTo,
+                 const KDRData::State<Number> &iState, const KDRData::Settings<Number> &iSettings, const KDTreeMap &iMap);
     virtual ~WallRenderer();
 
 public:
-    void SetBuffers(unsigned char *ipFrameBuffer, unsigned char *ipHorizOcclusionBuffer, 
-                    KDRData::HorizontalScreenSegments *ipHorizDrawnSegs, int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer);
-    void Render(std::vector<KDRData::FlatSurface> &oGeneratedFlats);
+    void SetBuffers(unsigned char *ipFrameBuffer, KDRData::HorizontalScreenSegments *ipHorizDrawnSegs,
+                    int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer,
+                    KDRData::FlatSurfaceArena<Number> *ipFlatSurfaces);
+    // Flats are allocated in the arena given to SetBuffers, the handles of the non empty ones are appended
+    void Render(std::vector<uint32_t> &oGeneratedFlats);
 
 protected:
-    void RenderWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats);
-    void RenderHardWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats);
-    void RenderSoftWallTop(std::vector<KDRData::FlatSurface> &oGeneratedFlats);
-    void RenderSoftWallBottom(std::vector<KDRData::FlatSurface> &oGeneratedFlats);
+    void RenderWall(std::vector<uint32_t> &oGeneratedFlats);
+    void RenderHardWall(std::vector<uint32_t> &oGeneratedFlats);
+    void RenderSoftWallTop(std::vector<uint32_t> &oGeneratedFlats);
+    void RenderSoftWallBottom(std::vector<uint32_t> &oGeneratedFlats);
+    template <WallPart iPart, bool iIsTextured, bool iIsVisible>
+    void RenderColumns(ColumnStepper<Number> &ioColumns, Number iBottomTexelY, Number iTopTexelY,
+                       KDRData::FlatSurface<Number> &ioFloorSurface, KDRData::FlatSurface<Number> &ioCeilingSurface,
+                       bool &ioAddFloorSurface, bool &ioAddCeilingSurface);
+    void CloseFilledColumns();
 
 protected:
-    bool isInsideFrustum(const KDRData::Vertex &iVertex) const;
     inline void WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b);
 
     // TODO: Refactor!
-    inline void ComputeRenderParameters(int iX, int iMinX, int iMaxX, CType iInvMinMaxXRange,
-                                        int iMinVertexBottomPixel, int iMaxVertexBottomPixel,
-                                        int iMinVertexTopPixel, int iMaxVertexTopPixel,
-                                        CType &oT, int &oMinY, int &oMaxY,
+    inline int NextVisibleColumn(int iX, int &oOpenRunEnd) const;
+    inline ColumnStepper<Number> MakeColumnStepper(int iMinVertexBottomPixel, int iMaxVertexBottomPixel,
+                                                   int iMinVertexTopPixel, int iMaxVertexTopPixel) const;
+    template <bool iIsTextured>
+    inline void ComputeRenderParameters(int iX, ColumnStepper<Number> &ioColumns,
+                                        Number &oT, int &oMinY, int &oMaxY,
                                         int &oMinYUnclamped, int &oMaxYUnclamped) const;
-    inline void ComputeTextureParameters(CType iT, int iMinY, int iMaxY,
-                                         CType iBottomZ, CType iTopZ,
+    inline void ComputeTextureParameters(const ColumnStepper<Number> &iColumns, int iMinY, int iMaxY,
+                                         Number iBottomTexelY, Number iTopTexelY,
                                          int iMinYUnclamped, int iMaxYUnclamped,
-                                         int &oTexelXClamped, CType &oMinTexelY, CType &oMaxTexelY) const;
-    inline void RenderColumn(CType iT, int iMinVertexColor, int iMaxVertexColor,
+                                         int &oTexelXClamped, Number &oMinTexelY, Number &oMaxTexelY) const;
+    inline void RenderColumn(Number iT, int iMinVertexColor, int iMaxVertexColor,
                                    int iMinY, int iMaxY, int iX,
                                    int iR, int iG, int iB);
-    inline void RenderColumnWithTexture(CType iT, int iMinVertexLight, int iMaxVertexLight,
+    inline void RenderColumnWithTexture(Number iT, int iMinVertexLight, int iMaxVertexLight,
                                         int iMinY, int iMaxY, int iX,
-                                        int iTexelXClamped, CType iMinTexelY, CType iMaxTexelY);
+                                        int iTexelXClamped, Number iMinTexelY, Number iMaxTexelY);
 
 protected:
-    const KDRData::Wall &m_Wall;
-    const KDRData::State &m_State;
-    const KDRData::Settings &m_Settings;
+    const KDRData::Wall<Number> &m_Wall;
+    KDRData::Vertex<Number> m_CameraFrom; // See KDRData::ToCameraSpace
+    KDRData::Vertex<Number> m_CameraTo;
+    const KDRData::State<Number> &m_State;
+    const KDRData::Settings<Number> &m_Settings;
     const KDTreeMap &m_Map;
 
     unsigned char *m_pFrameBuffer;
-    unsigned char *m_pHorizOcclusionBuffer;
-    KDRData::HorizontalScreenSegments *m_pHorizDrawnSegs; // TODO: makes m_pHorizOcclusionBuffer, get rid of m_pHorizOcclusionBuffer
+    KDRData::HorizontalScreenSegments *m_pHorizDrawnSegs; // Closed columns
     int *m_pTopOcclusionBuffer;
     int *m_pBottomOcclusionBuffer;
+    KDRData::FlatSurfaceArena<Number> *m_pFlatSurfaces;
 
 protected:
     // Intermediate computations results
-    KDRData::Vertex m_MinVertex;
-    KDRData::Vertex m_MaxVertex;
+    KDRData::Vertex<Number> m_MinVertex;
+    KDRData::Vertex<Number> m_MaxVertex;
 
-    int m_MinAngle;
-    int m_MaxAngle;
+    Number m_MinSlope;
+    Number m_MaxSlope;
 
     int m_MinX;
     int m_maxX;
-    CType m_InvMinMaxXRange;
+    Number m_InvMinMaxXRange;
+    int64_t m_InvMinMaxXRangeInt; // 2^32 / (m_maxX - m_MinX), for the column stepper
+
+    Number m_MinTexelX;
+    Number m_MaxTexelX;
 
-    CType m_MinTexelX;
-    CType m_MaxTexelX;
+    Number m_MinDist;
+    Number m_MaxDist;
 
-    CType m_MinDist;
-    CType m_MaxDist;
+    // Per-wall reciprocals, so that columns don't need any division
+    RecipType<Number> m_MinDistRecip;
+    RecipType<Number> m_MaxDistRecip;
+    Number m_MinDistInv;
+    Number m_MaxDistInv;
+    Number m_MinTexelXOverDist;
+    Number m_MaxTexelXOverDist;
 
     int m_MinVertexColor;
     int m_MaxVertexColor;
 
     int m_WhichSide;
 
-    int m_InSectorIdx;
-    KDRData::Sector m_InSector;
-    int m_OutSectorIdx;
-    KDRData::Sector m_OutSector;
-
-    const KDMapData::Texture *m_pTexture;
-    int m_TexUOffset;
-    int m_TexVOffset;
-    unsigned int m_YModShift;
-
 protected:
     // Debug only
     char r,
@@ -96,7 +182,8 @@ protected:
         b;
 };
 
-void WallRenderer::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b)
+template <typename Number>
+void WallRenderer<Number>::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned char g, unsigned char b)
 {
     idx = idx << 2u;
     m_pFrameBuffer[idx] = r;
@@ -104,87 +191,185 @@ void WallRenderer::WriteFrameBuffer(unsigned int idx, unsigned char r, unsigned
     m_pFrameBuffer[idx + 2u] = b;
 }
 
-void WallRenderer::ComputeRenderParameters(int iX, int iMinX, int iMaxX, CType iInvMinMaxXRange,
-                                           int iMinVertexBottomPixel, int iMaxVertexBottomPixel,
-                                           int iMinVertexTopPixel, int iMaxVertexTopPixel,
-                                           CType &oT, int &oMinY, int &oMaxY,
-                                           int &oMinYUnclamped, int &oMaxYUnclamped) const
+template <typename Number>
+ColumnStepper<Number>::ColumnStepper(int iMinX, int iMaxX, Number iInvMinMaxXRange, int64_t iInvMinMaxXRangeInt,
+                                     int iMinVertexBottomPixel, int iMaxVertexBottomPixel,
+                                     int iMinVertexTopPixel, int iMaxVertexTopPixel) :
+    m_X(iMinX - 2),
+    m_LastSeedX(iMinX - 2),
+    m_MinX(iMinX),
+    m_InvMinMaxXRange(iMaxX == iMinX ? Number(0) : iInvMinMaxXRange),
+    m_MinYFrom(static_cast<int64_t>(iMinVertexBottomPixel) << 16),
+    m_MaxYFrom(static_cast<int64_t>(iMinVertexTopPixel) << 16),
+    m_MinYDelta((static_cast<int64_t>(iMaxVertexBottomPixel - iMinVertexBottomPixel) * iInvMinMaxXRangeInt) >> 16),
+    m_MaxYDelta((static_cast<int64_t>(iMaxVertexTopPixel - iMinVertexTopPixel) * iInvMinMaxXRangeInt) >> 16)
+{
+}
+
+template <typename Number>
+void ColumnStepper<Number>::SetupTexture(Number iMinUOverZ, Number iMaxUOverZ, Number iMinInvZ, Number iMaxInvZ)
+{
+    m_MinUOverZ = iMinUOverZ;
+    m_MaxUOverZ = iMaxUOverZ;
+    m_MinInvZ = iMinInvZ;
+    m_MaxInvZ = iMaxInvZ;
+    m_UOverZDelta = ShiftRight((iMaxUOverZ - iMinUOverZ) * m_InvMinMaxXRange, 7u - EXTRA_SHIFT);
+    m_InvZDelta = ShiftRight((iMaxInvZ - iMinInvZ) * m_InvMinMaxXRange, 7u - EXTRA_SHIFT);
+}
+
+template <typename Number>
+template <bool iIsTextured>
+void ColumnStepper<Number>::Seed(int iX)
 {
-    // For extra precision, the inverse range has been shifted. Need to shift it back
-    oT = iMaxX == iMinX ? CType(0) : (static_cast<CType>(iX - iMinX) * iInvMinMaxXRange) >> 7u;
-    // oT = iMaxX == iMinX ? CType(0) : (static_cast<CType>(iX - iMinX) * iInvMinMaxXRange) / (1 << 7u); // For float/double
+    m_X = iX;
+    m_LastSeedX = iX;
+
+    m_TScaled = static_cast<Number>(iX - m_MinX) * m_InvMinMaxXRange;
+    m_MinY = m_MinYFrom + (iX - m_MinX) * m_MinYDelta;
+    m_MaxY = m_MaxYFrom + (iX - m_MinX) * m_MaxYDelta;
+
+    if constexpr (iIsTextured)
+    {
+        Number t = GetT();
+        m_UOverZ = (1 - t) * m_MinUOverZ + t * m_MaxUOverZ;
+        m_InvZ = (1 - t) * m_MinInvZ + t * m_MaxInvZ;
+        m_UOverZOffset = 0;
+        m_InvZOffset = 0;
+    }
+}
 
-    oMinYUnclamped = MultiplyIntFpToInt(iMinVertexBottomPixel, 1 - oT) + MultiplyIntFpToInt(iMaxVertexBottomPixel, oT);
-    oMaxYUnclamped = MultiplyIntFpToInt(iMinVertexTopPixel, 1 - oT) + MultiplyIntFpToInt(iMaxVertexTopPixel, oT);
+template <typename Number>
+template <bool iIsTextured>
+void ColumnStepper<Number>::MoveTo(int iX)
+{
+    if (iX != m_X + 1 || iX - m_LastSeedX >= RESEED_INTERVAL)
+    {
+        Seed<iIsTextured>(iX);
+        return;
+    }
+
+    m_X = iX;
+    m_TScaled = m_TScaled + m_InvMinMaxXRange;
+    m_MinY += m_MinYDelta;
+    m_MaxY += m_MaxYDelta;
+    if constexpr (iIsTextured)
+    {
+        m_UOverZOffset = m_UOverZOffset + m_UOverZDelta;
+        m_InvZOffset = m_InvZOffset + m_InvZDelta;
+    }
+}
+
+// First column >= iX of the wall which is not closed, m_maxX + 1 if none
+// Columns up to oOpenRunEnd are open as well, callers step through them without asking again (m_maxX if none)
+template <typename Number>
+int WallRenderer<Number>::NextVisibleColumn(int iX, int &oOpenRunEnd) const
+{
+    if (iX > m_maxX)
+    {
+        oOpenRunEnd = m_maxX;
+        return m_maxX + 1;
+    }
+    unsigned int openRunEnd;
+    int x = static_cast<int>(m_pHorizDrawnSegs->NextOpenColumn(iX, m_maxX, openRunEnd));
+    oOpenRunEnd = static_cast<int>(openRunEnd);
+    return x;
+}
+
+template <typename Number>
+ColumnStepper<Number> WallRenderer<Number>::MakeColumnStepper(int iMinVertexBottomPixel, int iMaxVertexBottomPixel,
+                                                              int iMinVertexTopPixel, int iMaxVertexTopPixel) const
+{
+    ColumnStepper<Number> columns(m_MinX, m_maxX, m_InvMinMaxXRange, m_InvMinMaxXRangeInt,
+                                  iMinVertexBottomPixel, iMaxVertexBottomPixel,
+                                  iMinVertexTopPixel, iMaxVertexTopPixel);
+    if (m_Wall.m_pTexture)
+        columns.SetupTexture(m_MinTexelXOverDist, m_MaxTexelXOverDist, m_MinDistInv, m_MaxDistInv);
+    return columns;
+}
+
+template <typename Number>
+template <bool iIsTextured>
+void WallRenderer<Number>::ComputeRenderParameters(int iX, ColumnStepper<Number> &ioColumns,
+                                           Number &oT, int &oMinY, int &oMaxY,
+                                           int &oMinYUnclamped, int &oMaxYUnclamped) const
+{
+    ioColumns.template MoveTo<iIsTextured>(iX);
+    oT = ioColumns.GetT();
+    oMinYUnclamped = ioColumns.GetMinYUnclamped();
+    oMaxYUnclamped = ioColumns.GetMaxYUnclamped();
     oMinY = std::max<int>(oMinYUnclamped, m_pBottomOcclusionBuffer[iX]);
     oMaxY = std::min<int>(oMaxYUnclamped, WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[iX]);
 }
 
-void WallRenderer::ComputeTextureParameters(CType iT, int iMinY, int iMaxY,
-                                            CType iBottomZ, CType iTopZ,
+template <typename Number>
+void WallRenderer<Number>::ComputeTextureParameters(const ColumnStepper<Number> &iColumns, int iMinY, int iMaxY,
+                                            Number iBottomTexelY, Number iTopTexelY,
                                             int iMinYUnclamped, int iMaxYUnclamped,
-                                            int &oTexelXClamped, CType &oMinTexelY, CType &oMaxTexelY) const
+                                            int &oTexelXClamped, Number &oMinTexelY, Number &oMaxTexelY) const
 {
-    if (!m_pTexture)
-        return;
-
     // Affine mapping (nausea-inducing)
-    // CType texelX = (1 - oT) * m_MinTexelX + oT * m_MaxTexelX;
-    // Perspective correct
-    CType texelX = ((1 - iT) * (m_MinTexelX / m_MinDist) + iT * (m_MaxTexelX / m_MaxDist)) / ((1 - iT) / m_MinDist + iT / m_MaxDist);
-    unsigned int xModShift = m_pTexture->m_Width + FP_SHIFT;
-    oTexelXClamped = texelX - ((texelX >> xModShift) << xModShift);
-    oMinTexelY = ((iBottomZ + m_TexVOffset) * CType(int(1u << m_pTexture->m_Height)) * CType(POSITION_SCALE)) / CType(TEXEL_SCALE);
-    oMaxTexelY = ((iTopZ + m_TexVOffset) * CType(int(1u << m_pTexture->m_Height)) * CType(POSITION_SCALE)) / CType(TEXEL_SCALE);
-    if (m_pTexture && iMaxYUnclamped - iMinYUnclamped)
+    // Number texelX = (1 - oT) * m_MinTexelX + oT * m_MaxTexelX;
+    // Perspective correct: u/z and 1/z are interpolated linearly, u/z and 1/z at both ends are per-wall constants
+    // Number texelX = ((1 - iT) * (m_MinTexelX / m_MinDist) + iT * (m_MaxTexelX / m_MaxDist)) / ((1 - iT) / m_MinDist + iT / m_MaxDist);
+    // Both interpolations are stepped by the column stepper
+    Number texelX = iColumns.GetUOverZ() * MakeFastRecip(iColumns.GetInvZ());
+    oTexelXClamped = WrapToInt(texelX, m_Wall.m_pTexture->m_Width);
+    oMinTexelY = iBottomTexelY;
+    oMaxTexelY = iTopTexelY;
+    if (iMaxYUnclamped - iMinYUnclamped)
     {
         // Clamp
-        // 13-bit left shift has been chosen to minimize glitches
-        CType tMin = (((iMinY - iMinYUnclamped) << 13) / (iMaxYUnclamped - iMinYUnclamped)) / CType(1 << 13);
-        CType minTexelYBackup = oMinTexelY;
+        RecipType<Number> invRange = MakeFastRecipFromInt<Number>(iMaxYUnclamped - iMinYUnclamped);
+        Number tMin = Number(iMinY - iMinYUnclamped) * invRange;
+        Number minTexelYBackup = oMinTexelY;
         oMinTexelY = (1 - tMin) * oMinTexelY + tMin * oMaxTexelY;
-        CType tMax = (((iMaxYUnclamped - iMaxY) << 13) / (iMaxYUnclamped - iMinYUnclamped)) / CType(1 << 13);
+        Number tMax = Number(iMaxYUnclamped - iMaxY) * invRange;
         oMaxTexelY = (1 - tMax) * oMaxTexelY + tMax * minTexelYBackup;
     }
 }
 
-void WallRenderer::RenderColumn(CType iT, int iMinVertexColor, int iMaxVertexColor,
+template <typename Number>
+void WallRenderer<Number>::RenderColumn(Number iT, int iMinVertexColor, int iMaxVertexColor,
                                 int iMinY, int iMaxY, int iX,
                                 int iR, int iG, int iB)
 {
     int color = (iMinVertexColor * (1 - iT)) + iT * iMaxVertexColor;
     // int color = 255 * iT;
-    for (unsigned int y = iMinY; y <= iMaxY; y++)
+    unsigned char red = color * iR, green = color * iG, blue = color * iB;
+    unsigned char *dest = m_pFrameBuffer + (((WINDOW_HEIGHT - 1 - iMinY) * WINDOW_WIDTH + iX) << 2u);
+    for (int y = iMinY; y <= iMaxY; y++)
     {
-        WriteFrameBuffer((WINDOW_HEIGHT - 1 - y) * WINDOW_WIDTH + iX, color * iR, color * iG, color * iB);
+        dest[0] = red;
+        dest[1] = green;
+        dest[2] = blue;
+        dest -= WINDOW_WIDTH * 4;
     }
 }
 
-void WallRenderer::RenderColumnWithTexture(CType iT, int iMinVertexLight, int iMaxVertexLight,
+template <typename Number>
+void WallRenderer<Number>::RenderColumnWithTexture(Number iT, int iMinVertexLight, int iMaxVertexLight,
                                            int iMinY, int iMaxY, int iX,
-                                           int iTexelXClamped, CType iMinTexelY, CType iMaxTexelY)
+                                           int iTexelXClamped, Number iMinTexelY, Number iMaxTexelY)
 {
     unsigned int light = static_cast<int>((iMinVertexLight * (1 - iT)) + iT * iMaxVertexLight);
     const uint32_t *pPalette = m_Map.m_DynamicColorPalettes[light >> 4u];
 
-    CType tY, texelY = iMinTexelY;
+    Number texelY = iMinTexelY;
     int texelYClamped;
-    CType deltaTexelY = iMaxY == iMinY ? CType(1) : (iMaxTexelY - iMinTexelY) / CType(iMaxY - iMinY);
+    Number deltaTexelY = iMaxY == iMinY ? Number(1) : (iMaxTexelY - iMinTexelY) * MakeFastRecipFromInt<Number>(iMaxY - iMinY);
+
+    // Frame buffer writes may alias the texture as far as the compiler knows, hence the locals
+    const unsigned int textureHeight = m_Wall.m_pTexture->m_Height;
+    const unsigned char *pTexels = m_Wall.m_pTexture->m_pData + (iTexelXClamped << textureHeight);
 
     unsigned int frameBuffIdx = (WINDOW_HEIGHT - 1 - iMinY) * WINDOW_WIDTH + iX;
-    unsigned int textureIdxX = iTexelXClamped << m_pTexture->m_Height;
-    unsigned int textureIdxY;
-    unsigned int r, g, b;
-    const uint32_t *src;
     uint32_t *dest = reinterpret_cast<uint32_t *>(m_pFrameBuffer) + frameBuffIdx;
     for (unsigned int y = iMaxY - iMinY + 1; y; --y)
     {
         texelY = texelY + deltaTexelY;
-        texelYClamped = texelY - ((texelY >> (m_YModShift)) << (m_YModShift));
-        textureIdxY = textureIdxX + texelYClamped;
+        texelYClamped = WrapToInt(texelY, textureHeight);
 
-        src = &pPalette[m_pTexture->m_pData[textureIdxY]];
-        *dest = *src;
+        *dest = pPalette[pTexels[texelYClamped]];
         dest -= WINDOW_WIDTH;
     }
 }
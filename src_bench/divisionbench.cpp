@@ -0,0 +1,111 @@
+// FP32 divisions per frame (see FP32_DIVISION_COUNTER_ENABLED in FP32.h) on the maps given as arguments (.kdm)
+// Frames are rendered from scratch from random views in the maps, with both fixed point types and both render modes
+// The renderer has to be built with the counter as well, see the divisionbench target of the Makefile
+
+#include "KDTreeMap.h"
+#include "KDTreeRenderer.h"
+#include "GeomUtils.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#ifndef FP32_DIVISION_COUNTER_ENABLED
+#error "divisionbench needs FP32_DIVISION_COUNTER_ENABLED"
+#endif
+
+namespace
+{
+    const unsigned int NB_VIEWS = 200u;
+
+    bool LoadMap(const char *iPath, KDTreeMap &oMap)
+    {
+        std::ifstream mapStream(iPath, std::ios::binary | std::ios::in);
+        if (!mapStream.is_open())
+            return false;
+
+        mapStream.seekg(0, mapStream.end);
+        std::vector<char> data(static_cast<size_t>(mapStream.tellg()));
+        mapStream.seekg(0, mapStream.beg);
+        mapStream.read(data.data(), data.size());
+
+        unsigned int nbBytesRead;
+        oMap.UnStream(data.data(), nbBytesRead);
+        return true;
+    }
+
+    // Views in a sector, as they are when playing
+    std::vector<std::pair<KDRData::Vertex<CType>, int>> PickViews(const KDTreeMap &iMap)
+    {
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views;
+        if (!iMap.GetNbOfNodes())
+            return views;
+
+        const KDTreeFlatNode &root = iMap.GetNode(0u);
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> xDist(root.m_AABBMin.m_X, root.m_AABBMax.m_X);
+        std::uniform_real_distribution<float> yDist(root.m_AABBMin.m_Y, root.m_AABBMax.m_Y);
+        std::uniform_int_distribution<int> directionDist(0, ANGLE_FULL - 1);
+        for (unsigned int i = 0; i < 100u * NB_VIEWS && views.size() < NB_VIEWS; i++)
+        {
+            KDRData::Vertex<CType> position;
+            position.m_X = CType(xDist(rng) / POSITION_SCALE);
+            position.m_Y = CType(yDist(rng) / POSITION_SCALE);
+            int direction = directionDist(rng);
+            if (iMap.LocateSector(position.m_X, position.m_Y) >= 0)
+                views.push_back({position, direction});
+        }
+        return views;
+    }
+
+    double CountDivisions(const KDTreeMap &iMap, const std::vector<std::pair<KDRData::Vertex<CType>, int>> &iViews, KDRData::NumberType iNumberType, KDRData::RenderMode iRenderMode)
+    {
+        std::unique_ptr<KDTreeRendererBase> renderer = CreateKDTreeRenderer(iMap, iNumberType);
+        renderer->SetRenderMode(iRenderMode);
+
+        FP32Stats::s_NbDivisions = 0u;
+        for (const std::pair<KDRData::Vertex<CType>, int> &view : iViews)
+        {
+            renderer->InvalidateFrame();
+            renderer->SetPlayerCoordinates(view.first, view.second);
+            renderer->ClearBuffers();
+            renderer->RefreshFrameBuffer();
+        }
+        return static_cast<double>(FP32Stats::s_NbDivisions) / iViews.size();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: divisionbench <.kdm> [<.kdm> ...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        KDTreeMap map;
+        if (!LoadMap(argv[i], map))
+        {
+            std::cout << "Error: could not open " << argv[i] << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views = PickViews(map);
+        if (views.empty())
+            continue;
+
+        std::cout << argv[i] << ", " << views.size() << " views, divisions per frame" << std::endl;
+        for (KDRData::NumberType numberType : {KDRData::NumberType::FP32_14, KDRData::NumberType::FP32_16})
+        {
+            std::cout << "    " << (numberType == KDRData::NumberType::FP32_14 ? "FP32<14>" : "FP32<16>") << ": "
+                      << CountDivisions(map, views, numberType, KDRData::RenderMode::KDTree) << " (KD tree), "
+                      << CountDivisions(map, views, numberType, KDRData::RenderMode::Portals) << " (portals)" << std::endl;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+// Writes a map (.map) made of a grid of n x n square rooms, neighbouring rooms being linked by narrow corridors
+// Many rooms are hidden behind the others from anywhere, which is what the portal render mode is meant for
+// Usage: gridmap <n> <output .map>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace
+{
+    // Map units
+    const int ROOM_SIZE = 200;
+    const int CORRIDOR_LENGTH = 40;
+    const int CORRIDOR_FROM = 80; // Corridors run along the middle of the rooms' sides
+    const int CORRIDOR_TO = 120;
+
+    void WriteSector(std::ofstream &ioMap, int iMinX, int iMinY, int iMaxX, int iMaxY, int iFloor, int iCeiling)
+    {
+        ioMap << "sector" << std::endl;
+        ioMap << "{" << std::endl;
+        ioMap << "    outline" << std::endl;
+        ioMap << "    {" << std::endl;
+        ioMap << "        vertices {{" << iMinX << ", " << iMinY << "} {" << iMinX << ", " << iMaxY << "} {" << iMaxX << ", " << iMaxY << "} {" << iMaxX << ", " << iMinY << "}}" << std::endl;
+        ioMap << "    }" << std::endl;
+        ioMap << "    elevation" << std::endl;
+        ioMap << "    {" << std::endl;
+        ioMap << "        ceiling {" << iCeiling << "}" << std::endl;
+        ioMap << "        floor {" << iFloor << "}" << std::endl;
+        ioMap << "    }" << std::endl;
+        ioMap << "    defaultWallTexture {Bricks}" << std::endl;
+        ioMap << "    ceilingTexture {Bricks}" << std::endl;
+        ioMap << "    floorTexture {Bricks}" << std::endl;
+        ioMap << "}" << std::endl << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int n = argc == 3 ? std::atoi(argv[1]) : 0;
+    if (n <= 0)
+    {
+        std::cout << "Usage: gridmap <n> <output .map>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream map(argv[2]);
+    if (!map.is_open())
+    {
+        std::cout << "Error: could not open " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Player starts in the first room, facing the others
+    map << "player" << std::endl;
+    map << "{" << std::endl;
+    map << "    start" << std::endl;
+    map << "    {" << std::endl;
+    map << "        position {" << ROOM_SIZE / 2 << ", " << ROOM_SIZE / 2 << "}" << std::endl;
+    map << "        direction {45}" << std::endl;
+    map << "    }" << std::endl;
+    map << "}" << std::endl << std::endl;
+
+    map << "texture" << std::endl;
+    map << "{" << std::endl;
+    map << "    name {Bricks}" << std::endl;
+    map << "    path {maps/textures/brick.png}" << std::endl;
+    map << "}" << std::endl << std::endl;
+
+    // Floors vary from room to room so that the corridors have steps
+    const int step = ROOM_SIZE + CORRIDOR_LENGTH;
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            int x = i * step;
+            int y = j * step;
+            WriteSector(map, x, y, x + ROOM_SIZE, y + ROOM_SIZE, (i * 7 + j * 13) % 20, 100);
+            if (i + 1 < n)
+                WriteSector(map, x + ROOM_SIZE, y + CORRIDOR_FROM, x + step, y + CORRIDOR_TO, 10, 80);
+            if (j + 1 < n)
+                WriteSector(map, x + CORRIDOR_FROM, y + ROOM_SIZE, x + CORRIDOR_TO, y + step, 10, 80);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+// KD tree against portal render mode (see KDTreeRenderer::FloodPortals) on the maps given as arguments (.kdm)
+// Frames are rendered from scratch from random views in the maps. Prints the time per frame of both modes and
+// how many nodes and walls each of them gets through
+
+#include "KDTreeMap.h"
+#include "KDTreeRenderer.h"
+#include "GeomUtils.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+    const unsigned int NB_VIEWS = 200u;
+
+    bool LoadMap(const char *iPath, KDTreeMap &oMap)
+    {
+        std::ifstream mapStream(iPath, std::ios::binary | std::ios::in);
+        if (!mapStream.is_open())
+            return false;
+
+        mapStream.seekg(0, mapStream.end);
+        std::vector<char> data(static_cast<size_t>(mapStream.tellg()));
+        mapStream.seekg(0, mapStream.beg);
+        mapStream.read(data.data(), data.size());
+
+        unsigned int nbBytesRead;
+        oMap.UnStream(data.data(), nbBytesRead);
+        return true;
+    }
+
+    // Views in a sector, the portal mode needs one
+    std::vector<std::pair<KDRData::Vertex<CType>, int>> PickViews(const KDTreeMap &iMap)
+    {
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views;
+        if (!iMap.GetNbOfNodes())
+            return views;
+
+        const KDTreeFlatNode &root = iMap.GetNode(0u);
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> xDist(root.m_AABBMin.m_X, root.m_AABBMax.m_X);
+        std::uniform_real_distribution<float> yDist(root.m_AABBMin.m_Y, root.m_AABBMax.m_Y);
+        std::uniform_int_distribution<int> directionDist(0, ANGLE_FULL - 1);
+        for (unsigned int i = 0; i < 100u * NB_VIEWS && views.size() < NB_VIEWS; i++)
+        {
+            KDRData::Vertex<CType> position;
+            position.m_X = CType(xDist(rng) / POSITION_SCALE);
+            position.m_Y = CType(yDist(rng) / POSITION_SCALE);
+            int direction = directionDist(rng);
+            if (iMap.LocateSector(position.m_X, position.m_Y) >= 0)
+                views.push_back({position, direction});
+        }
+        return views;
+    }
+
+    struct ModeResult
+    {
+        double m_MsPerFrame; // Best of a few runs
+        double m_NbVisitedNodes; // Per frame
+        double m_NbRenderedWalls;
+    };
+
+    ModeResult RunMode(const KDTreeMap &iMap, const std::vector<std::pair<KDRData::Vertex<CType>, int>> &iViews, KDRData::RenderMode iRenderMode)
+    {
+        std::unique_ptr<KDTreeRendererBase> renderer = CreateKDTreeRenderer(iMap);
+        renderer->SetRenderMode(iRenderMode);
+
+        ModeResult result = {0.0, 0.0, 0.0};
+        for (unsigned int run = 0; run < 3; run++)
+        {
+            unsigned int nbVisitedNodes = 0u, nbRenderedWalls = 0u;
+            auto start = std::chrono::steady_clock::now();
+            for (const std::pair<KDRData::Vertex<CType>, int> &view : iViews)
+            {
+                renderer->InvalidateFrame();
+                renderer->SetPlayerCoordinates(view.first, view.second);
+                renderer->ClearBuffers();
+                renderer->RefreshFrameBuffer();
+
+                nbVisitedNodes += renderer->GetFrameStats().m_NbVisitedNodes;
+                nbRenderedWalls += renderer->GetFrameStats().m_NbRenderedWalls;
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iViews.size();
+            if (run == 0 || ms < result.m_MsPerFrame)
+                result.m_MsPerFrame = ms;
+            result.m_NbVisitedNodes = static_cast<double>(nbVisitedNodes) / iViews.size();
+            result.m_NbRenderedWalls = static_cast<double>(nbRenderedWalls) / iViews.size();
+        }
+        return result;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: portalbench <.kdm> [<.kdm> ...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        KDTreeMap map;
+        if (!LoadMap(argv[i], map))
+        {
+            std::cout << "Error: could not open " << argv[i] << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views = PickViews(map);
+        if (views.empty())
+            continue;
+
+        ModeResult kdTree = RunMode(map, views, KDRData::RenderMode::KDTree);
+        ModeResult portals = RunMode(map, views, KDRData::RenderMode::Portals);
+        std::cout << argv[i] << " (" << map.GetNbOfNodes() << " nodes), " << views.size() << " views" << std::endl;
+        std::cout << "    KD tree: " << kdTree.m_MsPerFrame << " ms, " << kdTree.m_NbVisitedNodes << " visited nodes, " << kdTree.m_NbRenderedWalls << " rendered walls" << std::endl;
+        std::cout << "    Portals: " << portals.m_MsPerFrame << " ms, " << portals.m_NbVisitedNodes << " visited nodes, " << portals.m_NbRenderedWalls << " rendered walls" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,102 @@
+// Lookup table trigonometry (see GeomUtils.h) against the libm based functions it replaced
+// Prints the time per call of both and the largest deviation of the tables from libm
+
+#include "Consts.h"
+#include "FP32.h"
+#include "GeomUtils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+    const double ANGLE_TO_RAD = M_PI / (180.0 * static_cast<double>(1 << ANGLE_SHIFT));
+
+    // libm versions, as they were before the tables
+    CType LibmCos(int iAngle)
+    {
+        float angleRad = static_cast<float>(iAngle) / (180.0 * static_cast<float>((1 << ANGLE_SHIFT))) * M_PI;
+        return static_cast<CType>(cosf(angleRad));
+    }
+
+    CType LibmTan(int iAngle)
+    {
+        double angleRad = static_cast<float>(iAngle) / (180.0 * static_cast<float>((1 << ANGLE_SHIFT))) * M_PI;
+        return static_cast<CType>(static_cast<float>(tan(angleRad)));
+    }
+
+    int LibmAtan2(CType iY, CType iX)
+    {
+        return static_cast<int>(atan2(static_cast<float>(iY), static_cast<float>(iX)) / ANGLE_TO_RAD);
+    }
+
+    // Best of a few runs, in ns per call
+    template <typename Func>
+    double TimePerCall(unsigned int iNbCalls, Func &&iFunc)
+    {
+        double best = 0.0;
+        for (unsigned int run = 0; run < 5; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < iNbCalls; i++)
+                iFunc(i);
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iNbCalls;
+            if (run == 0 || ns < best)
+                best = ns;
+        }
+        return best;
+    }
+}
+
+int main()
+{
+    const unsigned int nbCalls = 1u << 20;
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> angleDist(0, ANGLE_FULL - 1);
+    std::uniform_real_distribution<float> coordDist(-10.f, 10.f);
+
+    // Neighbouring angles (e.g. a sweep over the screen columns) keep the tables in cache, random ones don't
+    std::vector<int> sweepAngles(nbCalls), randomAngles(nbCalls);
+    std::vector<CType> ys(nbCalls), xs(nbCalls);
+    for (unsigned int i = 0; i < nbCalls; i++)
+    {
+        sweepAngles[i] = (i * 7) % ANGLE_FULL;
+        randomAngles[i] = angleDist(rng);
+        ys[i] = CType(coordDist(rng));
+        xs[i] = CType(coordDist(rng));
+    }
+
+    // Results are summed so that the calls are not optimised away
+    int64_t sink = 0;
+    for (const std::vector<int> *pAngles : {&sweepAngles, &randomAngles})
+    {
+        const std::vector<int> &angles = *pAngles;
+        double libmCosTan = TimePerCall(nbCalls, [&](unsigned int i) { sink += (LibmCos(angles[i]) + LibmTan(angles[i])).GetRawValue(); });
+        double tableCosTan = TimePerCall(nbCalls, [&](unsigned int i) { sink += (cosInt(angles[i]) + tanInt(angles[i])).GetRawValue(); });
+        std::cout << "cos + tan, " << (pAngles == &sweepAngles ? "sweep" : "random") << " angles: libm " << libmCosTan << " ns, tables " << tableCosTan << " ns" << std::endl;
+    }
+    double libmAtan2 = TimePerCall(nbCalls, [&](unsigned int i) { sink += LibmAtan2(ys[i], xs[i]); });
+    double tableAtan2 = TimePerCall(nbCalls, [&](unsigned int i) { sink += atan2Int(ys[i], xs[i]); });
+
+    // Deviations, in CType units for cos (all angles) and in angle units for atan2
+    double maxCosError = 0.0;
+    for (int angle = 0; angle < ANGLE_FULL; angle++)
+        maxCosError = std::max(maxCosError, std::abs(static_cast<double>(cosInt(angle)) - std::cos(angle * ANGLE_TO_RAD)));
+    int maxAtan2Error = 0;
+    for (unsigned int i = 0; i < nbCalls; i++)
+    {
+        double reference = std::atan2(static_cast<double>(ys[i]), static_cast<double>(xs[i])) / ANGLE_TO_RAD;
+        maxAtan2Error = std::max(maxAtan2Error, std::abs(atan2Int(ys[i], xs[i]) - static_cast<int>(reference)));
+    }
+
+    std::cout << "atan2: libm " << libmAtan2 << " ns, tables " << tableAtan2 << " ns" << std::endl;
+    std::cout << "Max cos error " << maxCosError << ", max atan2 error " << maxAtan2Error << " angle units (1/" << (1 << ANGLE_SHIFT) << " degree)" << std::endl;
+    std::cout << "(checksum " << sink << ")" << std::endl;
+
+    return EXIT_SUCCESS;
+}
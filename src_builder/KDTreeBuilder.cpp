@@ -5,6 +5,7 @@
 #include "KDTreeMap.h"
 #include "SectorInclusionOperator.h"
 #include "WallBreakerOperator.h"
+#include "PVSOperator.h"
 #include "ImageFromFileOperator.h"
 
 #include <vector>
@@ -267,6 +268,23 @@ KDBData::Error KDTreeBuilder::BuildKDTree(KDTreeMap *&oKDTree)
                 allWalls.clear();
                 ret = RecursiveBuildKDTree(allWallsList, KDTreeNode::SplitPlane::XConst, oKDTree->m_RootNode);
 
+                if(ret == KDBData::Error::OK)
+                {
+                    LayoutKDTree(oKDTree);
+                    BuildPortalGraph(oKDTree);
+                }
+
+                if(ret == KDBData::Error::OK)
+                {
+                    PVSOperator pvsOper(oKDTree->m_Nodes, oKDTree->m_Walls);
+                    ret = pvsOper.Run();
+                    if (ret == KDBData::Error::OK)
+                    {
+                        oKDTree->m_PVSOffsets = pvsOper.GetOffsets();
+                        oKDTree->m_PVSData = pvsOper.GetData();
+                    }
+                }
+
                 // Build color palette
                 if(ret == KDBData::Error::OK)
                 {
@@ -285,6 +303,111 @@ KDBData::Error KDTreeBuilder::BuildKDTree(KDTreeMap *&oKDTree)
     return ret;
 }
 
+// Fails if the map does not fit in KDMapData::Wall's fields
+KDBData::Error KDTreeBuilder::PackWall(const KDBData::Wall &iWall, KDMapData::Wall &oKDWall) const
+{
+    bool isXConst = iWall.m_VertexFrom.m_X == iWall.m_VertexTo.m_X;
+    int constCoord = isXConst ? iWall.m_VertexFrom.m_X : iWall.m_VertexFrom.m_Y;
+    int from = isXConst ? iWall.m_VertexFrom.m_Y : iWall.m_VertexFrom.m_X;
+    int to = isXConst ? iWall.m_VertexTo.m_Y : iWall.m_VertexTo.m_X;
+
+    auto fitsInShort = [](int iVal) { return iVal >= SHRT_MIN && iVal <= SHRT_MAX; };
+    if (!fitsInShort(constCoord) || !fitsInShort(from) || !fitsInShort(to) ||
+        !fitsInShort(iWall.m_InSector) || !fitsInShort(iWall.m_OutSector) ||
+        !fitsInShort(iWall.m_TexUOffset) || !fitsInShort(iWall.m_TexVOffset) ||
+        iWall.m_TexId < -1 || iWall.m_TexId > SCHAR_MAX)
+        return KDBData::Error::CANNOT_PACK_WALL;
+
+    oKDWall.m_Const = static_cast<int16_t>(constCoord);
+    oKDWall.m_Min = static_cast<int16_t>(std::min(from, to));
+    oKDWall.m_Max = static_cast<int16_t>(std::max(from, to));
+
+    oKDWall.m_InSector = static_cast<int16_t>(iWall.m_InSector);
+    oKDWall.m_OutSector = static_cast<int16_t>(iWall.m_OutSector);
+
+    oKDWall.m_TexUOffset = static_cast<int16_t>(iWall.m_TexUOffset);
+    oKDWall.m_TexVOffset = static_cast<int16_t>(iWall.m_TexVOffset);
+    oKDWall.m_TexId = static_cast<int8_t>(iWall.m_TexId);
+
+    oKDWall.m_Flags = 0u;
+    if (isXConst)
+        oKDWall.m_Flags |= KDMapData::Wall::X_CONST;
+    if (from > to)
+        oKDWall.m_Flags |= KDMapData::Wall::REVERSED;
+
+    return KDBData::Error::OK;
+}
+
+// Flattens the tree into oKDTree->m_Nodes/m_Walls, in pre-order.
+// A cache-oblivious (van Emde Boas) order made no difference: a frame only visits a few dozen nodes, even on large maps
+void KDTreeBuilder::LayoutKDTree(KDTreeMap *ioKDTree) const
+{
+    std::vector<const KDTreeNode *> layout;
+    RecursiveLayoutKDTree(ioKDTree->m_RootNode, layout);
+
+    std::map<const KDTreeNode *, uint32_t> nodeIndices;
+    for (unsigned int i = 0; i < layout.size(); i++)
+        nodeIndices[layout[i]] = i;
+
+    ioKDTree->m_Nodes.clear();
+    ioKDTree->m_Walls.clear();
+    for (const KDTreeNode *pNode : layout)
+    {
+        KDTreeFlatNode node;
+        node.m_SplitPlane = pNode->m_SplitPlane;
+        node.m_SplitOffset = pNode->m_SplitOffset;
+        node.m_AABBMin = pNode->m_AABBMin;
+        node.m_AABBMax = pNode->m_AABBMax;
+        node.m_PositiveSide = pNode->m_PositiveSide ? nodeIndices[pNode->m_PositiveSide] : KDTreeFlatNode::NO_CHILD;
+        node.m_NegativeSide = pNode->m_NegativeSide ? nodeIndices[pNode->m_NegativeSide] : KDTreeFlatNode::NO_CHILD;
+        node.m_PositiveSideSector = -1; // Computed upon loading
+        node.m_NegativeSideSector = -1;
+
+        // Walls follow the node order
+        node.m_FirstWall = static_cast<uint32_t>(ioKDTree->m_Walls.size());
+        node.m_NbWalls = pNode->GetNbOfWalls();
+        ioKDTree->m_Walls.insert(ioKDTree->m_Walls.end(), pNode->m_Walls.begin(), pNode->m_Walls.end());
+
+        ioKDTree->m_Nodes.push_back(node);
+    }
+}
+
+// Soft walls are the portals between the sectors they separate, they get listed for both of them
+void KDTreeBuilder::BuildPortalGraph(KDTreeMap *ioKDTree) const
+{
+    unsigned int nbSectors = static_cast<unsigned int>(ioKDTree->m_Sectors.size());
+    std::vector<std::vector<uint32_t>> sectorPortals(nbSectors);
+    for (uint32_t i = 0; i < ioKDTree->m_Walls.size(); i++)
+    {
+        const KDMapData::Wall &wall = ioKDTree->m_Walls[i];
+        if (wall.m_OutSector == -1)
+            continue;
+
+        sectorPortals[wall.m_InSector].push_back(i);
+        sectorPortals[wall.m_OutSector].push_back(i);
+    }
+
+    ioKDTree->m_SectorPortalOffsets.clear();
+    ioKDTree->m_SectorPortals.clear();
+    for (const std::vector<uint32_t> &portals : sectorPortals)
+    {
+        ioKDTree->m_SectorPortalOffsets.push_back(static_cast<uint32_t>(ioKDTree->m_SectorPortals.size()));
+        ioKDTree->m_SectorPortals.insert(ioKDTree->m_SectorPortals.end(), portals.begin(), portals.end());
+    }
+    ioKDTree->m_SectorPortalOffsets.push_back(static_cast<uint32_t>(ioKDTree->m_SectorPortals.size()));
+}
+
+// Pre-order, positive side first
+void KDTreeBuilder::RecursiveLayoutKDTree(const KDTreeNode *ipNode, std::vector<const KDTreeNode *> &oLayout) const
+{
+    if (!ipNode)
+        return;
+
+    oLayout.push_back(ipNode);
+    RecursiveLayoutKDTree(ipNode->m_PositiveSide, oLayout);
+    RecursiveLayoutKDTree(ipNode->m_NegativeSide, oLayout);
+}
+
 bool KDTreeBuilder::IsWallSetConvex(const std::list<KDBData::Wall> &iWalls) const
 {
     bool isConvex = true;
@@ -399,21 +522,10 @@ KDBData::Error KDTreeBuilder::RecursiveBuildKDTree(std::list<KDBData::Wall> &iWa
 
         for (const KDBData::Wall &wall : iWalls)
         {
-            // TODO :refacto
             KDMapData::Wall kdWall;
-
-            kdWall.m_From.m_X = wall.m_VertexFrom.m_X;
-            kdWall.m_From.m_Y = wall.m_VertexFrom.m_Y;
-
-            kdWall.m_To.m_X = wall.m_VertexTo.m_X;
-            kdWall.m_To.m_Y = wall.m_VertexTo.m_Y;
-
-            kdWall.m_InSector = wall.m_InSector;
-            kdWall.m_OutSector = wall.m_OutSector;
-
-            kdWall.m_TexId = wall.m_TexId;
-            kdWall.m_TexUOffset = wall.m_TexUOffset;
-            kdWall.m_TexVOffset = wall.m_TexVOffset;
+            KDBData::Error ret = PackWall(wall, kdWall);
+            if (ret != KDBData::Error::OK)
+                return ret;
 
             ioKDTreeNode->m_Walls.push_back(kdWall);
         }
@@ -447,21 +559,10 @@ KDBData::Error KDTreeBuilder::RecursiveBuildKDTree(std::list<KDBData::Wall> &iWa
             ioKDTreeNode->m_SplitOffset = splitOffset;
             for (const KDBData::Wall &wall : withinPlane)
             {
-                // TODO: refacto
                 KDMapData::Wall kdWall;
-
-                kdWall.m_From.m_X = wall.m_VertexFrom.m_X;
-                kdWall.m_From.m_Y = wall.m_VertexFrom.m_Y;
-
-                kdWall.m_To.m_X = wall.m_VertexTo.m_X;
-                kdWall.m_To.m_Y = wall.m_VertexTo.m_Y;
-
-                kdWall.m_InSector = wall.m_InSector;
-                kdWall.m_OutSector = wall.m_OutSector;
-
-                kdWall.m_TexId = wall.m_TexId;
-                kdWall.m_TexUOffset = wall.m_TexUOffset;
-                kdWall.m_TexVOffset = wall.m_TexVOffset;
+                KDBData::Error ret = PackWall(wall, kdWall);
+                if (ret != KDBData::Error::OK)
+                    return ret;
 
                 ioKDTreeNode->m_Walls.push_back(kdWall);
             }
@@ -0,0 +1,503 @@
+#include "PVSOperator.h"
+
+#include "GeomUtils.h"
+
+#include <algorithm>
+#include <map>
+#include <cmath>
+
+namespace
+{
+    // Map units. Points this close to a clip plane are kept
+    const double EPSILON = 1e-6;
+
+    // Past this number of floods through a portal towards a cell, the whole portal is flooded through
+    // (the flooded ranges only grow, this bounds the number of floods)
+    const unsigned int MAX_NB_FLOODS = 4u;
+
+    // Map units added on each side of a cell for the positions lines of sight start from. Walls closer than the near
+    // plane (one map unit) are clipped away, so what is behind them is seen from up to sqrt(1 + edgeSlope^2) map units
+    // away, which this covers for horizontal FOVs up to 120 degrees. It also covers the camera's position rounding
+    const int CELL_MARGIN = 2;
+} // namespace
+
+PVSOperator::PVSOperator(const std::vector<KDTreeFlatNode> &iNodes, const std::vector<KDMapData::Wall> &iWalls) :
+    m_Nodes(iNodes),
+    m_Walls(iWalls)
+{
+}
+
+PVSOperator::~PVSOperator()
+{
+}
+
+KDBData::Error PVSOperator::Run()
+{
+    m_Offsets.assign(2 * m_Nodes.size(), KDTreeMap::NO_PVS);
+    m_Data.clear();
+    if (m_Nodes.empty())
+        return KDBData::Error::OK;
+
+    const KDTreeFlatNode &root = m_Nodes[0];
+    m_Cells.clear();
+    CollectCells(0u, {root.m_AABBMin.m_X, root.m_AABBMin.m_Y, root.m_AABBMax.m_X, root.m_AABBMax.m_Y});
+    m_CellIndices.assign(2 * m_Nodes.size(), 0u);
+    for (unsigned int c = 0; c < m_Cells.size(); c++)
+        m_CellIndices[m_Cells[c].m_Idx] = c;
+    BuildPortals();
+
+    // Identical sets (e.g. both sides of a leaf) are stored once
+    std::map<std::vector<uint8_t>, uint32_t> storedSets;
+    for (unsigned int c = 0; c < m_Cells.size(); c++)
+    {
+        std::vector<bool> visibleWalls(m_Walls.size(), false);
+        ComputeCellPVS(c, visibleWalls);
+
+        std::vector<bool> visibleNodes(m_Nodes.size(), false);
+        ComputeSubtreeVisibility(0u, visibleWalls, visibleNodes);
+
+        // Nodes first, then walls
+        std::vector<uint8_t> bits((m_Nodes.size() + m_Walls.size() + 7u) / 8u, 0u);
+        for (unsigned int i = 0; i < m_Nodes.size(); i++)
+        {
+            if (visibleNodes[i])
+                bits[i >> 3u] |= 1u << (i & 7u);
+        }
+        for (unsigned int i = 0; i < m_Walls.size(); i++)
+        {
+            unsigned int bit = static_cast<unsigned int>(m_Nodes.size()) + i;
+            if (visibleWalls[i])
+                bits[bit >> 3u] |= 1u << (bit & 7u);
+        }
+
+        std::vector<uint8_t> compressed;
+        Compress(bits, compressed);
+
+        auto found = storedSets.find(compressed);
+        if (found == storedSets.end())
+        {
+            found = storedSets.insert({compressed, static_cast<uint32_t>(m_Data.size())}).first;
+            m_Data.insert(m_Data.end(), compressed.begin(), compressed.end());
+        }
+        m_Offsets[m_Cells[c].m_Idx] = found->second;
+    }
+
+    return KDBData::Error::OK;
+}
+
+// Same partition as KDTreeMap::LocateCell: the positive side of a node is > its split offset
+void PVSOperator::CollectCells(uint32_t iNodeIdx, const Box &iRegion)
+{
+    const KDTreeFlatNode &node = m_Nodes[iNodeIdx];
+    if (node.m_SplitPlane == KDTreeNode::SplitPlane::None)
+    {
+        m_Cells.push_back({2u * iNodeIdx, iRegion});
+        m_Cells.push_back({2u * iNodeIdx + 1u, iRegion});
+        return;
+    }
+
+    Box positiveRegion = iRegion;
+    Box negativeRegion = iRegion;
+    if (node.m_SplitPlane == KDTreeNode::SplitPlane::XConst)
+    {
+        positiveRegion.m_MinX = std::max(iRegion.m_MinX, node.m_SplitOffset);
+        negativeRegion.m_MaxX = std::min(iRegion.m_MaxX, node.m_SplitOffset);
+    }
+    else
+    {
+        positiveRegion.m_MinY = std::max(iRegion.m_MinY, node.m_SplitOffset);
+        negativeRegion.m_MaxY = std::min(iRegion.m_MaxY, node.m_SplitOffset);
+    }
+
+    if (node.m_PositiveSide != KDTreeFlatNode::NO_CHILD)
+        CollectCells(node.m_PositiveSide, positiveRegion);
+    else
+        m_Cells.push_back({2u * iNodeIdx + 1u, positiveRegion});
+
+    if (node.m_NegativeSide != KDTreeFlatNode::NO_CHILD)
+        CollectCells(node.m_NegativeSide, negativeRegion);
+    else
+        m_Cells.push_back({2u * iNodeIdx, negativeRegion});
+}
+
+// Cells (indices in m_Cells) whose closed box intersects the closed query box. They are visited in the same order
+// as when collecting them, so they come in increasing order
+// A cell's box is within the regions of its ancestors, so the subtrees whose region misses the query are skipped
+void PVSOperator::CollectCells(uint32_t iNodeIdx, const Box &iRegion, const Box &iQuery, std::vector<unsigned int> &oCells) const
+{
+    if (iRegion.m_MaxX < iQuery.m_MinX || iRegion.m_MinX > iQuery.m_MaxX || iRegion.m_MaxY < iQuery.m_MinY || iRegion.m_MinY > iQuery.m_MaxY)
+        return;
+
+    const KDTreeFlatNode &node = m_Nodes[iNodeIdx];
+    if (node.m_SplitPlane == KDTreeNode::SplitPlane::None)
+    {
+        oCells.push_back(m_CellIndices[2u * iNodeIdx]);
+        oCells.push_back(m_CellIndices[2u * iNodeIdx + 1u]);
+        return;
+    }
+
+    Box positiveRegion = iRegion;
+    Box negativeRegion = iRegion;
+    if (node.m_SplitPlane == KDTreeNode::SplitPlane::XConst)
+    {
+        positiveRegion.m_MinX = std::max(iRegion.m_MinX, node.m_SplitOffset);
+        negativeRegion.m_MaxX = std::min(iRegion.m_MaxX, node.m_SplitOffset);
+    }
+    else
+    {
+        positiveRegion.m_MinY = std::max(iRegion.m_MinY, node.m_SplitOffset);
+        negativeRegion.m_MaxY = std::min(iRegion.m_MaxY, node.m_SplitOffset);
+    }
+
+    if (node.m_PositiveSide != KDTreeFlatNode::NO_CHILD)
+        CollectCells(node.m_PositiveSide, positiveRegion, iQuery, oCells);
+    else if (positiveRegion.m_MaxX >= iQuery.m_MinX && positiveRegion.m_MinX <= iQuery.m_MaxX && positiveRegion.m_MaxY >= iQuery.m_MinY && positiveRegion.m_MinY <= iQuery.m_MaxY)
+        oCells.push_back(m_CellIndices[2u * iNodeIdx + 1u]);
+
+    if (node.m_NegativeSide != KDTreeFlatNode::NO_CHILD)
+        CollectCells(node.m_NegativeSide, negativeRegion, iQuery, oCells);
+    else if (negativeRegion.m_MaxX >= iQuery.m_MinX && negativeRegion.m_MinX <= iQuery.m_MaxX && negativeRegion.m_MaxY >= iQuery.m_MinY && negativeRegion.m_MinY <= iQuery.m_MaxY)
+        oCells.push_back(m_CellIndices[2u * iNodeIdx]);
+}
+
+void PVSOperator::BuildPortals()
+{
+    m_Portals.clear();
+    m_CellWalls.assign(m_Cells.size(), {});
+    m_CellPortals.assign(m_Cells.size(), {});
+
+    const KDTreeFlatNode &root = m_Nodes[0];
+    const Box rootRegion = {root.m_AABBMin.m_X, root.m_AABBMin.m_Y, root.m_AABBMax.m_X, root.m_AABBMax.m_Y};
+
+    // Walls are visited in order, so that they are in order in each cell
+    std::vector<unsigned int> cells;
+    for (unsigned int i = 0; i < m_Walls.size(); i++)
+    {
+        const KDMapData::Wall &wall = m_Walls[i];
+        int minX = wall.IsXConst() ? wall.m_Const : wall.m_Min;
+        int maxX = wall.IsXConst() ? wall.m_Const : wall.m_Max;
+        int minY = wall.IsXConst() ? wall.m_Min : wall.m_Const;
+        int maxY = wall.IsXConst() ? wall.m_Max : wall.m_Const;
+
+        cells.clear();
+        CollectCells(0u, rootRegion, {minX, minY, maxX, maxY}, cells);
+        for (unsigned int c : cells)
+            m_CellWalls[c].push_back(i);
+    }
+
+    // Neighbours are the cells touching each other's box
+    for (unsigned int c1 = 0; c1 < m_Cells.size(); c1++)
+    {
+        const Box &box1 = m_Cells[c1].m_Box;
+        cells.clear();
+        CollectCells(0u, rootRegion, box1, cells);
+        for (unsigned int c2 : cells)
+        {
+            if (c2 <= c1)
+                continue;
+
+            const Box &box2 = m_Cells[c2].m_Box;
+            if (box1.m_MaxX == box2.m_MinX || box1.m_MinX == box2.m_MaxX)
+                AddPortals(c1, c2, true, box1.m_MaxX == box2.m_MinX ? box1.m_MaxX : box1.m_MinX,
+                           std::max(box1.m_MinY, box2.m_MinY), std::min(box1.m_MaxY, box2.m_MaxY));
+            if (box1.m_MaxY == box2.m_MinY || box1.m_MinY == box2.m_MaxY)
+                AddPortals(c1, c2, false, box1.m_MaxY == box2.m_MinY ? box1.m_MaxY : box1.m_MinY,
+                           std::max(box1.m_MinX, box2.m_MinX), std::min(box1.m_MaxX, box2.m_MaxX));
+        }
+    }
+}
+
+// Common boundary [iMin, iMax] along the line x = iConst (or y = iConst), cut where the hard walls lying on it start
+// and end. A hard wall only stops the lines of sight coming from its front side, see KDTreeRenderer::DoWallCulling
+void PVSOperator::AddPortals(unsigned int iCell1, unsigned int iCell2, bool iIsXConst, int iConst, int iMin, int iMax)
+{
+    if (iMin >= iMax)
+        return;
+
+    const Box &box1 = m_Cells[iCell1].m_Box;
+    int cell1Side = (iIsXConst ? box1.m_MinX : box1.m_MinY) == iConst ? 1 : -1;
+
+    // Such walls lie on the boundary of the first cell
+    std::vector<unsigned int> hardWalls;
+    std::vector<int> bounds = {iMin, iMax};
+    for (unsigned int i : m_CellWalls[iCell1])
+    {
+        const KDMapData::Wall &wall = m_Walls[i];
+        if (wall.m_OutSector == -1 && wall.IsXConst() == iIsXConst && wall.m_Const == iConst && wall.m_Max > iMin && wall.m_Min < iMax)
+        {
+            hardWalls.push_back(i);
+            bounds.push_back(std::max<int>(wall.m_Min, iMin));
+            bounds.push_back(std::min<int>(wall.m_Max, iMax));
+        }
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    auto addPortal = [&](int iFrom, int iTo, const bool iIsOpen[2]) {
+        if (iFrom >= iTo || (!iIsOpen[0] && !iIsOpen[1]))
+            return;
+
+        Portal portal;
+        portal.m_From = iIsXConst ? Point{double(iConst), double(iFrom)} : Point{double(iFrom), double(iConst)};
+        portal.m_To = iIsXConst ? Point{double(iConst), double(iTo)} : Point{double(iTo), double(iConst)};
+        portal.m_Cells[0] = iCell1;
+        portal.m_Cells[1] = iCell2;
+        portal.m_IsOpen[0] = iIsOpen[0];
+        portal.m_IsOpen[1] = iIsOpen[1];
+
+        m_CellPortals[iCell1].push_back(static_cast<unsigned int>(m_Portals.size()));
+        m_CellPortals[iCell2].push_back(static_cast<unsigned int>(m_Portals.size()));
+        m_Portals.push_back(portal);
+    };
+
+    // Consecutive intervals open the same ways are merged
+    int from = iMin;
+    bool isOpen[2] = {true, true};
+    for (unsigned int b = 0; b + 1 < bounds.size(); b++)
+    {
+        bool intervalIsOpen[2] = {true, true};
+        for (unsigned int wallIdx : hardWalls)
+        {
+            const KDMapData::Wall &wall = m_Walls[wallIdx];
+            if (wall.m_Min > bounds[b] || wall.m_Max < bounds[b + 1])
+                continue;
+
+            KDMapData::Vertex cell1Point = wall.GetFrom();
+            if (iIsXConst)
+                cell1Point.m_X += cell1Side;
+            else
+                cell1Point.m_Y += cell1Side;
+            if (WhichSideOfXYAlignedSegment(wall.GetFrom(), wall.GetTo(), cell1Point) > 0)
+                intervalIsOpen[1] = false;
+            else
+                intervalIsOpen[0] = false;
+        }
+
+        if (b > 0 && (intervalIsOpen[0] != isOpen[0] || intervalIsOpen[1] != isOpen[1]))
+        {
+            addPortal(from, bounds[b], isOpen);
+            from = bounds[b];
+        }
+        isOpen[0] = intervalIsOpen[0];
+        isOpen[1] = intervalIsOpen[1];
+    }
+    addPortal(from, iMax, isOpen);
+}
+
+void PVSOperator::ComputeCellPVS(unsigned int iCell, std::vector<bool> &oVisibleWalls)
+{
+    Box box = m_Cells[iCell].m_Box;
+    box.m_MinX -= CELL_MARGIN;
+    box.m_MinY -= CELL_MARGIN;
+    box.m_MaxX += CELL_MARGIN;
+    box.m_MaxY += CELL_MARGIN;
+    m_CellCorners[0] = {double(box.m_MinX), double(box.m_MinY)};
+    m_CellCorners[1] = {double(box.m_MaxX), double(box.m_MinY)};
+    m_CellCorners[2] = {double(box.m_MaxX), double(box.m_MaxY)};
+    m_CellCorners[3] = {double(box.m_MinX), double(box.m_MaxY)};
+
+    m_FloodedRanges.assign(2 * m_Portals.size(), {1.0, 0.0, 0u});
+
+    // Lines of sight start from any of the cells the enlarged box overlaps
+    const KDTreeFlatNode &root = m_Nodes[0];
+    std::vector<unsigned int> cells;
+    CollectCells(0u, {root.m_AABBMin.m_X, root.m_AABBMin.m_Y, root.m_AABBMax.m_X, root.m_AABBMax.m_Y}, box, cells);
+    for (unsigned int c : cells)
+    {
+        const Box &cellBox = m_Cells[c].m_Box;
+        if (cellBox.m_MinX >= box.m_MaxX || cellBox.m_MaxX <= box.m_MinX || cellBox.m_MinY >= box.m_MaxY || cellBox.m_MaxY <= box.m_MinY)
+            continue;
+
+        for (unsigned int wallIdx : m_CellWalls[c])
+            oVisibleWalls[wallIdx] = true;
+
+        for (unsigned int portalIdx : m_CellPortals[c])
+        {
+            unsigned int toSide = m_Portals[portalIdx].m_Cells[0] == c ? 1u : 0u;
+            if (m_Portals[portalIdx].m_IsOpen[toSide])
+                Flood(portalIdx, toSide, 0.0, 1.0, oVisibleWalls);
+        }
+    }
+}
+
+// Whatever can be seen from the cell through the [iMin, iMax] part of the portal, in m_Cells[iToSide] and beyond
+void PVSOperator::Flood(unsigned int iPortalIdx, unsigned int iToSide, double iMin, double iMax, std::vector<bool> &ioVisibleWalls)
+{
+    // What is seen through a part of a portal is seen through any bigger part of it as well
+    FloodedRange &flooded = m_FloodedRanges[2 * iPortalIdx + iToSide];
+    if (flooded.m_Min <= flooded.m_Max && iMin >= flooded.m_Min && iMax <= flooded.m_Max)
+        return;
+
+    bool wasFlooded = flooded.m_Min <= flooded.m_Max;
+    flooded.m_Min = wasFlooded ? std::min(flooded.m_Min, iMin) : iMin;
+    flooded.m_Max = wasFlooded ? std::max(flooded.m_Max, iMax) : iMax;
+    if (++flooded.m_NbFloods > MAX_NB_FLOODS)
+    {
+        flooded.m_Min = 0.0;
+        flooded.m_Max = 1.0;
+    }
+
+    const Portal &portal = m_Portals[iPortalIdx];
+    auto getPoint = [&](double iT) {
+        return Point{portal.m_From.m_X + (portal.m_To.m_X - portal.m_From.m_X) * iT,
+                     portal.m_From.m_Y + (portal.m_To.m_Y - portal.m_From.m_Y) * iT};
+    };
+
+    std::vector<HalfPlane> planes;
+    ComputeClipPlanes(getPoint(flooded.m_Min), getPoint(flooded.m_Max), planes);
+
+    unsigned int cell = portal.m_Cells[iToSide];
+    double min, max;
+    for (unsigned int wallIdx : m_CellWalls[cell])
+    {
+        if (ioVisibleWalls[wallIdx])
+            continue;
+
+        const KDMapData::Wall &wall = m_Walls[wallIdx];
+        KDMapData::Vertex from = wall.GetFrom();
+        KDMapData::Vertex to = wall.GetTo();
+        if (ClipSegment({double(from.m_X), double(from.m_Y)}, {double(to.m_X), double(to.m_Y)}, planes, min, max))
+            ioVisibleWalls[wallIdx] = true;
+    }
+
+    // A line crosses a portal once, no need to go back through it
+    for (unsigned int portalIdx : m_CellPortals[cell])
+    {
+        if (portalIdx == iPortalIdx)
+            continue;
+
+        const Portal &next = m_Portals[portalIdx];
+        unsigned int toSide = next.m_Cells[0] == cell ? 1u : 0u;
+        if (next.m_IsOpen[toSide] && ClipSegment(next.m_From, next.m_To, planes, min, max))
+            Flood(portalIdx, toSide, min, max, ioVisibleWalls);
+    }
+}
+
+// Anything seen from the cell through the [iFrom, iTo] segment is within the half planes it gives:
+// - the separating lines, going through a corner of the cell and an end of the segment, with the cell on one side
+//   and the segment on the other one. Whatever is seen is on the segment's side
+// - the segment's line, if the cell is entirely on one side of it. Whatever is seen is on the other side
+void PVSOperator::ComputeClipPlanes(const Point &iFrom, const Point &iTo, std::vector<HalfPlane> &oPlanes) const
+{
+    // Signed distance of a point to the line going through two others
+    auto makeLine = [](const Point &iP1, const Point &iP2, HalfPlane &oLine) {
+        double dX = iP2.m_X - iP1.m_X;
+        double dY = iP2.m_Y - iP1.m_Y;
+        double length = std::sqrt(dX * dX + dY * dY);
+        if (length < EPSILON)
+            return false;
+        oLine.m_A = -dY / length;
+        oLine.m_B = dX / length;
+        oLine.m_C = -(oLine.m_A * iP1.m_X + oLine.m_B * iP1.m_Y);
+        return true;
+    };
+    auto dist = [](const HalfPlane &iLine, const Point &iP) {
+        return iLine.m_A * iP.m_X + iLine.m_B * iP.m_Y + iLine.m_C;
+    };
+    // +1 (resp. -1) if all the cell corners are on the positive (resp. negative) side, 0 otherwise
+    auto getCellSide = [&](const HalfPlane &iLine, double iTolerance) {
+        bool allPositive = true, allNegative = true;
+        for (const Point &corner : m_CellCorners)
+        {
+            double d = dist(iLine, corner);
+            allPositive = allPositive && d >= iTolerance;
+            allNegative = allNegative && d <= -iTolerance;
+        }
+        return allPositive == allNegative ? 0 : (allPositive ? 1 : -1);
+    };
+
+    const Point *pEnds[2] = {&iFrom, &iTo};
+    for (unsigned int e = 0; e < 2; e++)
+    {
+        const Point &end = *pEnds[e];
+        const Point &otherEnd = *pEnds[1 - e];
+        for (const Point &corner : m_CellCorners)
+        {
+            HalfPlane line;
+            if (!makeLine(corner, end, line))
+                continue;
+
+            int side = getCellSide(line, -EPSILON);
+            if (side == 0 || side * dist(line, otherEnd) > EPSILON)
+                continue;
+
+            oPlanes.push_back({side * line.m_A, side * line.m_B, side * line.m_C - EPSILON});
+        }
+    }
+
+    HalfPlane line;
+    if (makeLine(iFrom, iTo, line))
+    {
+        int side = getCellSide(line, EPSILON);
+        if (side != 0)
+            oPlanes.push_back({side * line.m_A, side * line.m_B, side * line.m_C - EPSILON});
+    }
+}
+
+// [oMin, oMax] is the part of the segment (0 being iFrom, 1 iTo) within all the half planes
+bool PVSOperator::ClipSegment(const Point &iFrom, const Point &iTo, const std::vector<HalfPlane> &iPlanes, double &oMin, double &oMax) const
+{
+    oMin = 0.0;
+    oMax = 1.0;
+    for (const HalfPlane &plane : iPlanes)
+    {
+        double distFrom = plane.m_A * iFrom.m_X + plane.m_B * iFrom.m_Y + plane.m_C;
+        double distTo = plane.m_A * iTo.m_X + plane.m_B * iTo.m_Y + plane.m_C;
+        if (distFrom > 0 && distTo > 0)
+            return false;
+        if (distFrom <= 0 && distTo <= 0)
+            continue;
+
+        double t = distFrom / (distFrom - distTo);
+        if (distFrom > 0)
+            oMin = std::max(oMin, t);
+        else
+            oMax = std::min(oMax, t);
+        if (oMin > oMax)
+            return false;
+    }
+
+    return true;
+}
+
+bool PVSOperator::ComputeSubtreeVisibility(uint32_t iNodeIdx, const std::vector<bool> &iVisibleWalls, std::vector<bool> &oVisibleNodes) const
+{
+    if (iNodeIdx == KDTreeFlatNode::NO_CHILD)
+        return false;
+
+    const KDTreeFlatNode &node = m_Nodes[iNodeIdx];
+    bool isVisible = false;
+    for (uint32_t i = node.m_FirstWall; i < node.m_FirstWall + node.m_NbWalls; i++)
+        isVisible = isVisible || iVisibleWalls[i];
+
+    // Both subtrees are always visited, so that all the nodes get their flag
+    bool positiveSideVisible = ComputeSubtreeVisibility(node.m_PositiveSide, iVisibleWalls, oVisibleNodes);
+    bool negativeSideVisible = ComputeSubtreeVisibility(node.m_NegativeSide, iVisibleWalls, oVisibleNodes);
+    isVisible = isVisible || positiveSideVisible || negativeSideVisible;
+
+    oVisibleNodes[iNodeIdx] = isVisible;
+    return isVisible;
+}
+
+// Runs of zero bytes are stored as a zero byte followed by their length, see KDTreeMap::DecompressPVS
+void PVSOperator::Compress(const std::vector<uint8_t> &iBits, std::vector<uint8_t> &oCompressed)
+{
+    unsigned int i = 0;
+    while (i < iBits.size())
+    {
+        oCompressed.push_back(iBits[i]);
+        if (iBits[i])
+        {
+            i++;
+            continue;
+        }
+
+        uint8_t runLength = 0u;
+        while (i < iBits.size() && !iBits[i] && runLength < 255u)
+        {
+            runLength++;
+            i++;
+        }
+        oCompressed.push_back(runLength);
+    }
+}
@@ -115,12 +115,10 @@ KDBData::Sector::Relationship SectorInclusionOperator::FindRelationship(const KD
                 // TODO: "hard" intersection criterion won't work in every case as soon as
                 // decimation takes textures into account
                 // Leave it as is or find a better criterion?
-                // TODO: since lines are either oX or oY aligned, calling generic SegmentSegment intersection
-                // is a bit overkill
-                // Note: SegmentSegment intersection won't return true if input segments are colinear, even if they
+                // Note: the intersection won't be found if input segments are colinear, even if they
                 // do intersect, so calling this function works here
                 KDBData::Vertex intersection;
-                if (SegmentSegmentIntersection<KDBData::Vertex, double>(thisWall.m_VertexFrom, thisWall.m_VertexTo, otherWall.m_VertexFrom, otherWall.m_VertexTo, intersection) &&
+                if (XYAlignedSegmentSegmentIntersection(thisWall.m_VertexFrom, thisWall.m_VertexTo, otherWall.m_VertexFrom, otherWall.m_VertexTo, intersection) &&
                     !(intersection == thisWall.m_VertexFrom) && !(intersection == thisWall.m_VertexTo) &&
                     !(intersection == otherWall.m_VertexFrom) && !(intersection == otherWall.m_VertexTo))
                 {
@@ -141,7 +139,7 @@ KDBData::Sector::Relationship SectorInclusionOperator::FindRelationship(const KD
                     halfLineTo.m_Y += (50 + deltaYIntersectionLine);
 
                     KDBData::Vertex intersection;
-                    if (HalfLineSegmentIntersection<KDBData::Vertex, double>(thisVertex, halfLineTo, otherWall.m_VertexFrom, otherWall.m_VertexTo, intersection))
+                    if (HalfLineXYAlignedSegmentIntersection<KDBData::Vertex, double>(thisVertex, halfLineTo, otherWall.m_VertexFrom, otherWall.m_VertexTo, intersection))
                     {
                         if (intersection == thisWall.m_VertexFrom || intersection == thisWall.m_VertexTo ||
                             intersection == otherWall.m_VertexFrom || intersection == otherWall.m_VertexTo)
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
 
 KDTreeNode::KDTreeNode():
     m_PositiveSide(nullptr),
@@ -21,136 +22,6 @@ KDTreeNode::~KDTreeNode()
     m_NegativeSide = nullptr;
 }
 
-unsigned int KDTreeNode::ComputeStreamSize() const
-{
-    unsigned int streamSize = 0;
-
-    streamSize += sizeof(unsigned int); // Size of m_Walls
-    streamSize += m_Walls.size() * sizeof(KDMapData::Wall);
-    streamSize += sizeof(char); // m_SplitPlane
-    streamSize += sizeof(int); // m_SplitOffset
-    streamSize += 2 * sizeof(KDMapData::Vertex); // m_AABBMin & m_AABBMax
-
-    streamSize += sizeof(char); // Field that indicates whether there is a positive child
-    if (m_PositiveSide)
-        streamSize += m_PositiveSide->ComputeStreamSize();
-
-    streamSize += sizeof(char); // Field that indicates whether there is a negative child
-    if (m_NegativeSide)
-        streamSize += m_NegativeSide->ComputeStreamSize();
-
-    return streamSize;
-}
-
-void KDTreeNode::Stream(char *&ioData, unsigned int &oNbBytesWritten) const
-{
-    if (!ioData)
-        return;
-
-    *(reinterpret_cast<unsigned int*>(ioData))
-        = static_cast<unsigned int>(m_Walls.size());
-    ioData += sizeof(unsigned int);
-
-    for (unsigned int i = 0; i < m_Walls.size(); i++)
-    {
-        *(reinterpret_cast<KDMapData::Wall *>(ioData)) = m_Walls[i];
-        ioData += sizeof(KDMapData::Wall);
-    }
-
-    *ioData = m_SplitPlane == SplitPlane::XConst ? 0x0 : (m_SplitPlane == SplitPlane::YConst ? 0x1 : 0x2);
-    ioData += sizeof(char);
-
-    *(reinterpret_cast<int *>(ioData)) = m_SplitOffset;
-    ioData += sizeof(int);
-
-    *(reinterpret_cast<KDMapData::Vertex *>(ioData)) = m_AABBMin;
-    ioData += sizeof(KDMapData::Vertex);
-
-    *(reinterpret_cast<KDMapData::Vertex *>(ioData)) = m_AABBMax;
-    ioData += sizeof(KDMapData::Vertex);
-
-    *ioData = m_PositiveSide ? 0x1 : 0x0;
-    ioData += sizeof(char);
-
-    if (m_PositiveSide)
-        m_PositiveSide->Stream(ioData, oNbBytesWritten);
-
-    *ioData = m_NegativeSide ? 0x1 : 0x0;
-    ioData += sizeof(char);
-
-    if (m_NegativeSide)
-        m_NegativeSide->Stream(ioData, oNbBytesWritten);
-}
-
-void KDTreeNode::UnStream(const char *ipData, unsigned int &oNbBytesRead)
-{
-    if(!ipData)
-        return;
-
-    const char *pDataInit = ipData;
-    oNbBytesRead = 0;
-
-    unsigned int nbWalls = *(reinterpret_cast<const unsigned int *>(ipData));
-    ipData += sizeof(unsigned int);
-
-    for (unsigned int i = 0; i < nbWalls; i++)
-    {
-        m_Walls.push_back(*(reinterpret_cast<const KDMapData::Wall *>(ipData)));
-        ipData += sizeof(KDMapData::Wall);
-    }
-
-    char splitPlaneInt = *ipData;
-    ipData += sizeof(char);
-    if (splitPlaneInt == 0)
-        m_SplitPlane = KDTreeNode::SplitPlane::XConst;
-    else if (splitPlaneInt == 1)
-        m_SplitPlane = KDTreeNode::SplitPlane::YConst;
-    else if (splitPlaneInt == 2)
-        m_SplitPlane = KDTreeNode::SplitPlane::None;
-
-    m_SplitOffset = *(reinterpret_cast<const int *>(ipData));
-    ipData += sizeof(unsigned int);
-
-    m_AABBMin = *(reinterpret_cast<const KDMapData::Vertex *>(ipData));
-    ipData += sizeof(KDMapData::Vertex);
-
-    m_AABBMax = *(reinterpret_cast<const KDMapData::Vertex *>(ipData));
-    ipData += sizeof(KDMapData::Vertex);
-
-    char positiveSide = *ipData;
-    ipData += sizeof(char);
-
-    oNbBytesRead += ipData - pDataInit;
-
-    if (positiveSide)
-    {
-        m_PositiveSide = new KDTreeNode;
-        if(m_PositiveSide)
-        {
-            unsigned int nbBytesRead = 0;
-            m_PositiveSide->UnStream(ipData, nbBytesRead);
-            oNbBytesRead += nbBytesRead;
-            ipData += nbBytesRead;
-        }
-    }
-
-    char negativeSide = *ipData;
-    ipData += sizeof(char);
-    oNbBytesRead += sizeof(char);
-
-    if (negativeSide)
-    {
-        m_NegativeSide = new KDTreeNode;
-        if (m_NegativeSide)
-        {
-            unsigned int nbBytesRead = 0;
-            m_NegativeSide->UnStream(ipData, nbBytesRead);
-            oNbBytesRead += nbBytesRead;
-            ipData += nbBytesRead;
-        }
-    }
-}
-
 int KDTreeNode::ComputeDepth() const
 {
     return RecursiveComputeDepth(this);
@@ -170,7 +41,10 @@ void KDTreeNode::GetAABB(KDMapData::Vertex &oAABBMin, KDMapData::Vertex &oAABBMa
     oAABBMax = m_AABBMax;
 }
 
-KDTreeMap::KDTreeMap() : m_RootNode(nullptr)
+KDTreeMap::KDTreeMap() : m_RootNode(nullptr),
+    m_SectorGridCellSizeLog2(0u),
+    m_SectorGridWidth(0),
+    m_SectorGridHeight(0)
 {
     
 }
@@ -252,8 +126,83 @@ void KDTreeMap::Stream(char *&oData, unsigned int &oSize) const
             }
         }
 
-        unsigned int dummy;
-        m_RootNode->Stream(pData, dummy);
+        *(reinterpret_cast<unsigned int *>(pData)) = m_Nodes.size();
+        pData += sizeof(unsigned int);
+
+        for (const KDTreeFlatNode &node : m_Nodes)
+        {
+            *pData = node.m_SplitPlane == KDTreeNode::SplitPlane::XConst ? 0x0 : (node.m_SplitPlane == KDTreeNode::SplitPlane::YConst ? 0x1 : 0x2);
+            pData += sizeof(char);
+
+            *(reinterpret_cast<int *>(pData)) = node.m_SplitOffset;
+            pData += sizeof(int);
+
+            *(reinterpret_cast<KDMapData::Vertex *>(pData)) = node.m_AABBMin;
+            pData += sizeof(KDMapData::Vertex);
+
+            *(reinterpret_cast<KDMapData::Vertex *>(pData)) = node.m_AABBMax;
+            pData += sizeof(KDMapData::Vertex);
+
+            *(reinterpret_cast<uint32_t *>(pData)) = node.m_PositiveSide;
+            pData += sizeof(uint32_t);
+
+            *(reinterpret_cast<uint32_t *>(pData)) = node.m_NegativeSide;
+            pData += sizeof(uint32_t);
+
+            *(reinterpret_cast<uint32_t *>(pData)) = node.m_FirstWall;
+            pData += sizeof(uint32_t);
+
+            *(reinterpret_cast<uint32_t *>(pData)) = node.m_NbWalls;
+            pData += sizeof(uint32_t);
+        }
+
+        // Walls in their own section, in node order
+        *(reinterpret_cast<unsigned int *>(pData)) = m_Walls.size();
+        pData += sizeof(unsigned int);
+
+        for (const KDMapData::Wall &wall : m_Walls)
+        {
+            *(reinterpret_cast<KDMapData::Wall *>(pData)) = wall;
+            pData += sizeof(KDMapData::Wall);
+        }
+
+        // Potentially visible sets
+        *(reinterpret_cast<unsigned int *>(pData)) = m_PVSOffsets.size();
+        pData += sizeof(unsigned int);
+
+        if (!m_PVSOffsets.empty())
+        {
+            memcpy(pData, m_PVSOffsets.data(), m_PVSOffsets.size() * sizeof(uint32_t));
+            pData += m_PVSOffsets.size() * sizeof(uint32_t);
+        }
+
+        *(reinterpret_cast<unsigned int *>(pData)) = m_PVSData.size();
+        pData += sizeof(unsigned int);
+
+        if (!m_PVSData.empty())
+        {
+            memcpy(pData, m_PVSData.data(), m_PVSData.size());
+            pData += m_PVSData.size();
+        }
+
+        // Sector/portal graph
+        *(reinterpret_cast<unsigned int *>(pData)) = m_SectorPortalOffsets.size();
+        pData += sizeof(unsigned int);
+
+        if (!m_SectorPortalOffsets.empty())
+        {
+            memcpy(pData, m_SectorPortalOffsets.data(), m_SectorPortalOffsets.size() * sizeof(uint32_t));
+            pData += m_SectorPortalOffsets.size() * sizeof(uint32_t);
+        }
+
+        *(reinterpret_cast<unsigned int *>(pData)) = m_SectorPortals.size();
+        pData += sizeof(unsigned int);
+
+        if (!m_SectorPortals.empty())
+        {
+            memcpy(pData, m_SectorPortals.data(), m_SectorPortals.size() * sizeof(uint32_t));
+            pData += m_SectorPortals.size() * sizeof(uint32_t);
+        }
     }
     else
         oSize = 0;
@@ -330,19 +279,100 @@ void KDTreeMap::UnStream(const char *iData, unsigned int &oNbBytesRead)
         m_Sectors.push_back(sector);
     }
 
-    if (m_RootNode)
-        delete m_RootNode;
-    m_RootNode = new KDTreeNode;
+    // Nodes and walls are stored in their final order, see KDTreeBuilder::LayoutKDTree
+    unsigned int nbNodes = *(reinterpret_cast<const unsigned int *>(iData));
+    iData += sizeof(unsigned int);
 
-    oNbBytesRead += (iData - pDataInit);
+    m_Nodes.clear();
+    m_Nodes.resize(nbNodes);
+    for (unsigned int i = 0; i < nbNodes; i++)
+    {
+        KDTreeFlatNode &node = m_Nodes[i];
+
+        char splitPlaneInt = *iData;
+        iData += sizeof(char);
+        if (splitPlaneInt == 0)
+            node.m_SplitPlane = KDTreeNode::SplitPlane::XConst;
+        else if (splitPlaneInt == 1)
+            node.m_SplitPlane = KDTreeNode::SplitPlane::YConst;
+        else
+            node.m_SplitPlane = KDTreeNode::SplitPlane::None;
+
+        node.m_SplitOffset = *(reinterpret_cast<const int *>(iData));
+        iData += sizeof(int);
 
-    if (m_RootNode)
+        node.m_AABBMin = *(reinterpret_cast<const KDMapData::Vertex *>(iData));
+        iData += sizeof(KDMapData::Vertex);
+
+        node.m_AABBMax = *(reinterpret_cast<const KDMapData::Vertex *>(iData));
+        iData += sizeof(KDMapData::Vertex);
+
+        node.m_PositiveSide = *(reinterpret_cast<const uint32_t *>(iData));
+        iData += sizeof(uint32_t);
+
+        node.m_NegativeSide = *(reinterpret_cast<const uint32_t *>(iData));
+        iData += sizeof(uint32_t);
+
+        node.m_FirstWall = *(reinterpret_cast<const uint32_t *>(iData));
+        iData += sizeof(uint32_t);
+
+        node.m_NbWalls = *(reinterpret_cast<const uint32_t *>(iData));
+        iData += sizeof(uint32_t);
+    }
+
+    unsigned int nbWalls = *(reinterpret_cast<const unsigned int *>(iData));
+    iData += sizeof(unsigned int);
+
+    m_Walls.clear();
+    m_Walls.reserve(nbWalls);
+    for (unsigned int i = 0; i < nbWalls; i++)
     {
-        unsigned int nbBytesRead = 0;
-        m_RootNode->UnStream(iData, nbBytesRead);
-        oNbBytesRead += nbBytesRead;
+        m_Walls.push_back(*(reinterpret_cast<const KDMapData::Wall *>(iData)));
+        iData += sizeof(KDMapData::Wall);
     }
 
+    unsigned int nbPVSOffsets = *(reinterpret_cast<const unsigned int *>(iData));
+    iData += sizeof(unsigned int);
+
+    m_PVSOffsets.resize(nbPVSOffsets);
+    if (nbPVSOffsets)
+    {
+        memcpy(m_PVSOffsets.data(), iData, nbPVSOffsets * sizeof(uint32_t));
+        iData += nbPVSOffsets * sizeof(uint32_t);
+    }
+
+    unsigned int pvsDataSize = *(reinterpret_cast<const unsigned int *>(iData));
+    iData += sizeof(unsigned int);
+
+    m_PVSData.assign(iData, iData + pvsDataSize);
+    iData += pvsDataSize;
+
+    unsigned int nbSectorPortalOffsets = *(reinterpret_cast<const unsigned int *>(iData));
+    iData += sizeof(unsigned int);
+
+    m_SectorPortalOffsets.resize(nbSectorPortalOffsets);
+    if (nbSectorPortalOffsets)
+    {
+        memcpy(m_SectorPortalOffsets.data(), iData, nbSectorPortalOffsets * sizeof(uint32_t));
+        iData += nbSectorPortalOffsets * sizeof(uint32_t);
+    }
+
+    unsigned int nbSectorPortals = *(reinterpret_cast<const unsigned int *>(iData));
+    iData += sizeof(unsigned int);
+
+    m_SectorPortals.resize(nbSectorPortals);
+    if (nbSectorPortals)
+    {
+        memcpy(m_SectorPortals.data(), iData, nbSectorPortals * sizeof(uint32_t));
+        iData += nbSectorPortals * sizeof(uint32_t);
+    }
+
+    for (KDTreeFlatNode &node : m_Nodes)
+        ComputeSideSectors(node);
+    BuildSectorGrid();
+
+    oNbBytesRead += (iData - pDataInit);
+
     ComputeDynamicColorPalettes();
 }
 
@@ -372,8 +402,21 @@ unsigned int KDTreeMap::ComputeStreamSize() const
             streamSize += m_Sectors[i].m_pLight->ComputeStreamSize();
     }
 
-    if (m_RootNode)
-        streamSize += m_RootNode->ComputeStreamSize();
+    streamSize += sizeof(unsigned int); // m_Nodes.size()
+    streamSize += m_Nodes.size() * (sizeof(char) + sizeof(int) + 2 * sizeof(KDMapData::Vertex) + 4 * sizeof(uint32_t));
+
+    streamSize += sizeof(unsigned int); // m_Walls.size()
+    streamSize += m_Walls.size() * sizeof(KDMapData::Wall);
+
+    streamSize += sizeof(unsigned int); // m_PVSOffsets.size()
+    streamSize += m_PVSOffsets.size() * sizeof(uint32_t);
+    streamSize += sizeof(unsigned int); // m_PVSData.size()
+    streamSize += m_PVSData.size();
+
+    streamSize += sizeof(unsigned int); // m_SectorPortalOffsets.size()
+    streamSize += m_SectorPortalOffsets.size() * sizeof(uint32_t);
+    streamSize += sizeof(unsigned int); // m_SectorPortals.size()
+    streamSize += m_SectorPortals.size() * sizeof(uint32_t);
     
     return streamSize;
 }
@@ -397,10 +440,61 @@ int KDTreeMap::ComputeDepth() const
 {
     if(m_RootNode)
         return m_RootNode->ComputeDepth();
+    else if (!m_Nodes.empty())
+        return RecursiveComputeFlatDepth(0u);
     else
         return 0;
 }
 
+void KDTreeMap::ClearPVS()
+{
+    m_PVSOffsets.assign(m_PVSOffsets.size(), NO_PVS);
+    m_PVSData.clear();
+}
+
+void KDTreeMap::FreezeLights()
+{
+    for (KDMapData::Sector &sector : m_Sectors)
+    {
+        if (sector.m_pLight)
+            sector.m_pLight = std::make_shared<ConstantLight>(sector.m_pLight->GetValue());
+    }
+}
+
+int KDTreeMap::RecursiveComputeFlatDepth(uint32_t iNodeIdx) const
+{
+    if (iNodeIdx == KDTreeFlatNode::NO_CHILD)
+        return 0;
+    else
+        return 1 + std::max(RecursiveComputeFlatDepth(m_Nodes[iNodeIdx].m_NegativeSide), RecursiveComputeFlatDepth(m_Nodes[iNodeIdx].m_PositiveSide));
+}
+
+bool KDTreeMap::DecompressPVS(uint32_t iCellIdx, std::vector<uint8_t> &oBits) const
+{
+    if (iCellIdx >= m_PVSOffsets.size() || m_PVSOffsets[iCellIdx] == NO_PVS)
+        return false;
+
+    unsigned int size = (m_Nodes.size() + m_Walls.size() + 7u) / 8u;
+    oBits.resize(size);
+
+    const uint8_t *pData = m_PVSData.data() + m_PVSOffsets[iCellIdx];
+    unsigned int i = 0;
+    while (i < size)
+    {
+        if (*pData)
+            oBits[i++] = *pData++;
+        else
+        {
+            unsigned int runLength = pData[1];
+            memset(oBits.data() + i, 0, std::min(runLength, size - i));
+            i += runLength;
+            pData += 2;
+        }
+    }
+
+    return true;
+}
+
 void KDTreeMap::ComputeDynamicColorPalettes()
 {
     for (unsigned int i = 0; i < 256; i++)
@@ -421,3 +515,106 @@ void KDTreeMap::ComputeDynamicColorPalettes()
         }
     }
 }
+
+
+void KDTreeMap::ComputeSideSectors(KDTreeFlatNode &ioNode) const
+{
+    ioNode.m_PositiveSideSector = -1;
+    ioNode.m_NegativeSideSector = -1;
+    if (!ioNode.m_NbWalls) // Should never happen
+        return;
+
+    // The side of the node's first wall a point is on tells which sector it is in
+    const KDMapData::Wall &wall = m_Walls[ioNode.m_FirstWall];
+    if (ioNode.m_SplitPlane == KDTreeNode::SplitPlane::None)
+    {
+        ioNode.m_PositiveSideSector = wall.m_InSector;
+        ioNode.m_NegativeSideSector = wall.m_InSector;
+        return;
+    }
+
+    // Walls are within the split plane, any point off the plane will do
+    KDMapData::Vertex from = wall.GetFrom();
+    KDMapData::Vertex to = wall.GetTo();
+    KDMapData::Vertex positivePoint = from;
+    KDMapData::Vertex negativePoint = from;
+    if (ioNode.m_SplitPlane == KDTreeNode::SplitPlane::XConst)
+    {
+        positivePoint.m_X++;
+        negativePoint.m_X--;
+    }
+    else
+    {
+        positivePoint.m_Y++;
+        negativePoint.m_Y--;
+    }
+
+    ioNode.m_PositiveSideSector = WhichSideOfXYAlignedSegment(from, to, positivePoint) < 0 ? wall.m_OutSector : wall.m_InSector;
+    ioNode.m_NegativeSideSector = WhichSideOfXYAlignedSegment(from, to, negativePoint) < 0 ? wall.m_OutSector : wall.m_InSector;
+}
+
+void KDTreeMap::BuildSectorGrid()
+{
+    // At most MAX_GRID_SIZE cells along each axis, cell sizes being powers of 2 so that LocateSector can shift
+    const int MAX_GRID_SIZE = 128;
+
+    m_SectorGrid.clear();
+    m_SectorGridCellSizeLog2 = 0u;
+    m_SectorGridWidth = 0;
+    m_SectorGridHeight = 0;
+    if (m_Nodes.empty())
+        return;
+
+    const KDTreeFlatNode &root = m_Nodes[0];
+    m_SectorGridMin = root.m_AABBMin;
+    int sizeX = root.m_AABBMax.m_X - root.m_AABBMin.m_X + 1;
+    int sizeY = root.m_AABBMax.m_Y - root.m_AABBMin.m_Y + 1;
+    while (((sizeX - 1) >> m_SectorGridCellSizeLog2) + 1 > MAX_GRID_SIZE ||
+           ((sizeY - 1) >> m_SectorGridCellSizeLog2) + 1 > MAX_GRID_SIZE)
+        m_SectorGridCellSizeLog2++;
+
+    m_SectorGridWidth = ((sizeX - 1) >> m_SectorGridCellSizeLog2) + 1;
+    m_SectorGridHeight = ((sizeY - 1) >> m_SectorGridCellSizeLog2) + 1;
+    m_SectorGrid.resize(m_SectorGridWidth * m_SectorGridHeight);
+
+    for (int cellY = 0; cellY < m_SectorGridHeight; cellY++)
+    {
+        for (int cellX = 0; cellX < m_SectorGridWidth; cellX++)
+        {
+            // Cell is [min, max[ in map units
+            int minX = m_SectorGridMin.m_X + (cellX << m_SectorGridCellSizeLog2);
+            int maxX = minX + (1 << m_SectorGridCellSizeLog2);
+            int minY = m_SectorGridMin.m_Y + (cellY << m_SectorGridCellSizeLog2);
+            int maxY = minY + (1 << m_SectorGridCellSizeLog2);
+
+            // Same rule as LocateSector: positive side is > split offset
+            uint32_t nodeIdx = 0u;
+            while (true)
+            {
+                const KDTreeFlatNode &node = m_Nodes[nodeIdx];
+
+                uint32_t childIdx = KDTreeFlatNode::NO_CHILD;
+                if (node.m_SplitPlane == KDTreeNode::SplitPlane::XConst)
+                {
+                    if (minX > node.m_SplitOffset)
+                        childIdx = node.m_PositiveSide;
+                    else if (maxX <= node.m_SplitOffset)
+                        childIdx = node.m_NegativeSide;
+                }
+                else if (node.m_SplitPlane == KDTreeNode::SplitPlane::YConst)
+                {
+                    if (minY > node.m_SplitOffset)
+                        childIdx = node.m_PositiveSide;
+                    else if (maxY <= node.m_SplitOffset)
+                        childIdx = node.m_NegativeSide;
+                }
+
+                if (childIdx == KDTreeFlatNode::NO_CHILD)
+                    break;
+                nodeIdx = childIdx;
+            }
+
+            m_SectorGrid[cellY * m_SectorGridWidth + cellX] = nodeIdx;
+        }
+    }
+}
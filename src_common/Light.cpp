@@ -57,11 +57,6 @@ Light* UnstreamLight(const char* ipData, unsigned int& oNbBytesRead)
 	return pRet;
 }
 
-CType LightTools::GetMaxInterpolationDist(unsigned int iLightValue)
-{
-	return std::max<CType>(CType(static_cast<int>(iLightValue)) * CType(3) / POSITION_SCALE, CType(100) / POSITION_SCALE);
-}
-
 unsigned int LightTools::GetMinLight(unsigned int iLightValue)
 {
 	return Clamp<unsigned int>((iLightValue * iLightValue * iLightValue) / (255u * 255u), std::min<unsigned int>(50u, iLightValue), 230u);
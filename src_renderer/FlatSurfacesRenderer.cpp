@@ -3,7 +3,38 @@
 #include "GeomUtils.h"
 #include "Light.h"
 
-FlatSurfacesRenderer::FlatSurfacesRenderer(const std::map<CType, std::vector<KDRData::FlatSurface>> &iFlatSurfaces, const KDRData::State &iState, const KDRData::Settings &iSettings, const KDTreeMap &iMap):
+namespace
+{
+    // 1/(y/H - 1/2) for each screen row. Only depends on constants, so it is computed once
+    template <typename Number>
+    struct RowDenominatorRecips
+    {
+        RowDenominatorRecips()
+        {
+            for (int y = 0; y < WINDOW_HEIGHT; y++)
+            {
+                Number den = (Number(y) / WINDOW_HEIGHT - Number(1) / Number(2));
+                m_IsNull[y] = !den;
+                if (!m_IsNull[y])
+                    m_Recips[y] = MakeRecip(den);
+            }
+        }
+
+        RecipType<Number> m_Recips[WINDOW_HEIGHT];
+        bool m_IsNull[WINDOW_HEIGHT];
+    };
+
+    template <typename Number>
+    const RowDenominatorRecips<Number> &GetRowDenominatorRecips()
+    {
+        static const RowDenominatorRecips<Number> recips;
+        return recips;
+    }
+} // namespace
+
+template <typename Number>
+FlatSurfacesRenderer<Number>::FlatSurfacesRenderer(const KDRData::FlatSurfaceArena<Number> &iArena, const std::vector<uint32_t> &iFlatSurfaces, const KDRData::State<Number> &iState, const KDRData::Settings<Number> &iSettings, const KDTreeMap &iMap):
+    m_Arena(iArena),
     m_FlatSurfaces(iFlatSurfaces),
     m_State(iState),
     m_Settings(iSettings),
@@ -11,42 +42,49 @@ FlatSurfacesRenderer::FlatSurfacesRenderer(const std::map<CType, std::vector<KDR
 {
 }
 
-FlatSurfacesRenderer::~FlatSurfacesRenderer()
+template <typename Number>
+FlatSurfacesRenderer<Number>::~FlatSurfacesRenderer()
 {
 }
 
-void FlatSurfacesRenderer::SetBuffers(unsigned char *ipFrameBuffer, unsigned char *ipHorizOcclusionBuffer, int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer)
+template <typename Number>
+void FlatSurfacesRenderer<Number>::SetBuffers(unsigned char *ipFrameBuffer, int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer)
 {
     m_pFrameBuffer = ipFrameBuffer;
-    m_pHorizOcclusionBuffer = ipHorizOcclusionBuffer;
     m_pTopOcclusionBuffer = ipTopOcclusionBuffer;
     m_pBottomOcclusionBuffer = ipBottomOcclusionBuffer;
 }
 
 // #include <iostream>
-void FlatSurfacesRenderer::Render()
+template <typename Number>
+void FlatSurfacesRenderer<Number>::Render()
 {
     // {
     //     unsigned int totalSize = 0;
-    //     for (const auto &k : m_FlatSurfaces)
-    //         totalSize += k.second.size();
+    //     totalSize = m_FlatSurfaces.size();
     //     std::cout << "Number of flat surfaces = " << totalSize << std::endl;
     // }
 
     for (unsigned int i = 0; i < WINDOW_HEIGHT; i++)
         m_LinesXStart[i] = -1;
 
+    m_WindowWidthRecip = MakeRecipFromInt<Number>(WINDOW_WIDTH);
+
     unsigned count = 0;
-    for (const auto &keyVal : m_FlatSurfaces)
+    for (unsigned int groupStart = 0; groupStart < m_FlatSurfaces.size();)
     {
-        const CType currentHeight = keyVal.first;
-        const std::vector<KDRData::FlatSurface> &currentSurfaces = keyVal.second;
+        // Surfaces are sorted by height, a group of same height ones shares the palette cache
+        const Number currentHeight = m_Arena.Get(m_FlatSurfaces[groupStart]).m_Height;
+        unsigned int groupEnd = groupStart + 1;
+        for (; groupEnd < m_FlatSurfaces.size() && m_Arena.Get(m_FlatSurfaces[groupEnd]).m_Height == currentHeight; groupEnd++);
 
         for (unsigned int i = 0; i < WINDOW_HEIGHT; i++)
             m_PaletteCache[i] = -1;
 
-        for (unsigned int i = 0; i < currentSurfaces.size(); i++)
+        for (unsigned int i = groupStart; i < groupEnd; i++)
         {
+            const KDRData::FlatSurface<Number> &currentSurface = m_Arena.Get(m_FlatSurfaces[i]);
+
             // Debug
             m_RDbg = count % 3 == 0 ? 160 : 0;
             m_GDbg = count % 3 == 1 ? 160 : 0;
@@ -58,22 +96,25 @@ void FlatSurfacesRenderer::Render()
             m_CurrSectorG = 255;
             m_CurrSectorB = 255;
 
-            m_SectorLightValue = m_Map.m_Sectors[currentSurfaces[i].m_SectorIdx].m_pLight->GetValue();
+            m_SectorLightValue = m_Map.m_Sectors[currentSurface.m_SectorIdx].m_pLight->GetValue();
             m_MaxLight = m_SectorLightValue * 90 / 100;
             m_MinLight = LightTools::GetMinLight(m_MaxLight) * 90 / 100;
-            m_MaxColorInterpolationDist = LightTools::GetMaxInterpolationDist(m_MaxLight);
+            m_MaxColorInterpolationDist = LightTools::GetMaxInterpolationDist<Number>(m_MaxLight);
+            m_MaxColorInterpolationDistRecip = MakeRecip(m_MaxColorInterpolationDist);
 
-            if(currentSurfaces[i].m_TexId != -1)
+            if(currentSurface.m_TexId != -1)
             {
-                unsigned int hIdx = m_Map.m_Textures[currentSurfaces[i].m_TexId].m_Height;
-                unsigned int wIdx = m_Map.m_Textures[currentSurfaces[i].m_TexId].m_Width;
+                unsigned int hIdx = m_Map.m_Textures[currentSurface.m_TexId].m_Height;
+                unsigned int wIdx = m_Map.m_Textures[currentSurface.m_TexId].m_Width;
+
+                m_CurrSectorR = m_Map.m_Textures[currentSurface.m_TexId].m_pData[(1u << (hIdx + wIdx + 1u)) + 0];
+                m_CurrSectorG = m_Map.m_Textures[currentSurface.m_TexId].m_pData[(1u << (hIdx + wIdx + 1u)) + 1];
+                m_CurrSectorB = m_Map.m_Textures[currentSurface.m_TexId].m_pData[(1u << (hIdx + wIdx + 1u)) + 2];
 
-                m_CurrSectorR = m_Map.m_Textures[currentSurfaces[i].m_TexId].m_pData[(1u << (hIdx + wIdx + 1u)) + 0];
-                m_CurrSectorG = m_Map.m_Textures[currentSurfaces[i].m_TexId].m_pData[(1u << (hIdx + wIdx + 1u)) + 1];
-                m_CurrSectorB = m_Map.m_Textures[currentSurfaces[i].m_TexId].m_pData[(1u << (hIdx + wIdx + 1u)) + 2];
+                m_TexelXScale = Number(int(1u << wIdx)) * Number(POSITION_SCALE) / Number(TEXEL_SCALE);
+                m_TexelYScale = Number(int(1u << hIdx)) * Number(POSITION_SCALE) / Number(TEXEL_SCALE);
             }
 
-            const KDRData::FlatSurface &currentSurface = currentSurfaces[i];
 
             // Jump to start of the drawable part of the surface
             int minXDrawable = currentSurface.m_MinX;
@@ -145,61 +186,59 @@ void FlatSurfacesRenderer::Render()
                 DrawLine(y, m_LinesXStart[y], maxXDrawable, currentSurface);
             }
         }
+
+        groupStart = groupEnd;
     }
 }
 
-void FlatSurfacesRenderer::DrawLine(int iY, int iMinX, int iMaxX, const KDRData::FlatSurface &iSurface)
+template <typename Number>
+void FlatSurfacesRenderer<Number>::DrawLine(int iY, int iMinX, int iMaxX, const KDRData::FlatSurface<Number> &iSurface)
 {
     if(iY == WINDOW_HEIGHT / 2)
         return;
 
     char palette;
-    CType deltaTexelX, deltaTexelY;
-    KDRData::Vertex leftmostTexel;
+    Number deltaTexelX, deltaTexelY;
+    KDRData::Vertex<Number> centerTexel, lateralTexel;
     int light;
     unsigned int lightClamped;
 
     if (m_PaletteCache[iY] >= 0)
     {
         palette = m_PaletteCache[iY];
-        leftmostTexel = m_LeftmostTexelCache[iY];
+        centerTexel = m_CenterTexelCache[iY];
+        lateralTexel = m_LateralTexelCache[iY];
         deltaTexelX = m_DeltaTexelXCache[iY];
         deltaTexelY = m_DeltaTexelYCache[iY];
     }
     else
     {
-        CType den = (CType(iY) / WINDOW_HEIGHT - CType(1) / CType(2));
-        if(!den)
+        const RowDenominatorRecips<Number> &rowDenRecips = GetRowDenominatorRecips<Number>();
+        if(rowDenRecips.m_IsNull[iY])
             return;
-        
-        CType dist = m_Settings.m_VerticalDistortionCst * ((m_State.m_PlayerZ - iSurface.m_Height) / den);
+
+        Number dist = m_Settings.m_VerticalDistortionCst * ((m_State.m_PlayerZ - iSurface.m_Height) * rowDenRecips.m_Recips[iY]);
         dist = dist < 0 ? -dist : dist;
 
-        int light = ((m_MaxColorInterpolationDist - dist) * m_MaxLight) / m_MaxColorInterpolationDist;
+        int light = ((m_MaxColorInterpolationDist - dist) * m_MaxLight) * m_MaxColorInterpolationDistRecip;
         light = Clamp(light, m_MinLight, m_MaxLight);
         palette = light >> 4u;
         m_PaletteCache[iY] = palette;
 
-        const KDMapData::Texture &texture = m_Map.m_Textures[iSurface.m_TexId];
-        CType length = dist / cosInt(m_Settings.m_PlayerHorizontalFOV / 2);
-
-        leftmostTexel.m_X = (m_State.m_FrustumToLeft.m_X - m_State.m_PlayerPosition.m_X) * length + m_State.m_PlayerPosition.m_X;
-        leftmostTexel.m_Y = (m_State.m_FrustumToLeft.m_Y - m_State.m_PlayerPosition.m_Y) * length + m_State.m_PlayerPosition.m_Y;
+        // Texel seen through the column of slope s (see KDRData::ColumnRays): center + s * lateral
+        // dist is the depth in camera space
+        centerTexel.m_X = ((m_State.m_Look.m_X - m_State.m_PlayerPosition.m_X) * dist + m_State.m_PlayerPosition.m_X) * m_TexelXScale;
+        centerTexel.m_Y = ((m_State.m_Look.m_Y - m_State.m_PlayerPosition.m_Y) * dist + m_State.m_PlayerPosition.m_Y) * m_TexelYScale;
+        lateralTexel.m_X = ((m_State.m_Right.m_X - m_State.m_PlayerPosition.m_X) * dist) * m_TexelXScale;
+        lateralTexel.m_Y = ((m_State.m_Right.m_Y - m_State.m_PlayerPosition.m_Y) * dist) * m_TexelYScale;
 
-        leftmostTexel.m_X = leftmostTexel.m_X * CType(int(1u << texture.m_Width)) * CType(POSITION_SCALE) / CType(TEXEL_SCALE);
-        leftmostTexel.m_Y = leftmostTexel.m_Y * CType(int(1u << texture.m_Height)) * CType(POSITION_SCALE) / CType(TEXEL_SCALE);
+        m_CenterTexelCache[iY] = centerTexel;
+        m_LateralTexelCache[iY] = lateralTexel;
 
-        m_LeftmostTexelCache[iY] = leftmostTexel;
-
-        KDRData::Vertex rightmostTexel;
-        rightmostTexel.m_X = (m_State.m_FrustumToRight.m_X - m_State.m_PlayerPosition.m_X) * length + m_State.m_PlayerPosition.m_X;
-        rightmostTexel.m_Y = (m_State.m_FrustumToRight.m_Y - m_State.m_PlayerPosition.m_Y) * length + m_State.m_PlayerPosition.m_Y;
-
-        rightmostTexel.m_X = rightmostTexel.m_X * CType(int(1u << texture.m_Width)) * CType(POSITION_SCALE) / CType(TEXEL_SCALE);
-        rightmostTexel.m_Y = rightmostTexel.m_Y * CType(int(1u << texture.m_Width)) * CType(POSITION_SCALE) / CType(TEXEL_SCALE);
-
-        deltaTexelX = (rightmostTexel.m_X - leftmostTexel.m_X) / CType(WINDOW_WIDTH);
-        deltaTexelY = (rightmostTexel.m_Y - leftmostTexel.m_Y) / CType(WINDOW_WIDTH);
+        // From one column to the next, the slope increases by 2 * m_EdgeSlope / WINDOW_WIDTH
+        Number edgeSlopeTimes2 = 2 * m_Settings.m_ColumnRays.m_EdgeSlope;
+        deltaTexelX = (lateralTexel.m_X * edgeSlopeTimes2) * m_WindowWidthRecip;
+        deltaTexelY = (lateralTexel.m_Y * edgeSlopeTimes2) * m_WindowWidthRecip;
 
         m_DeltaTexelXCache[iY] = deltaTexelX;
         m_DeltaTexelYCache[iY] = deltaTexelY;
@@ -216,13 +255,10 @@ void FlatSurfacesRenderer::DrawLine(int iY, int iMinX, int iMaxX, const KDRData:
             const uint32_t *pPalette = m_Map.m_DynamicColorPalettes[palette];
             const KDMapData::Texture &texture = m_Map.m_Textures[iSurface.m_TexId];
 
-            CType currTexelX = leftmostTexel.m_X + CType(iMinX) * deltaTexelX;
-            CType currTexelY = leftmostTexel.m_Y + CType(iMinX) * deltaTexelY;
-            int currTexelXInt = currTexelX.GetRawValue();
-            int currTexelYInt = currTexelY.GetRawValue();
+            Number startSlope = m_Settings.m_ColumnRays.m_Slopes[iMinX];
+            Number currTexelX = centerTexel.m_X + startSlope * lateralTexel.m_X;
+            Number currTexelY = centerTexel.m_Y + startSlope * lateralTexel.m_Y;
 
-            unsigned int yModShift = texture.m_Height + FP_SHIFT;
-            unsigned int xModShift = texture.m_Width + FP_SHIFT;
             int currTexelXClamped, currTexelYClamped;
             unsigned texIdx;
             unsigned int r, g, b;
@@ -230,8 +266,8 @@ void FlatSurfacesRenderer::DrawLine(int iY, int iMinX, int iMaxX, const KDRData:
             uint32_t *dest = reinterpret_cast<uint32_t*>(m_pFrameBuffer) + xOffsetFrameBuffer;
             for (unsigned int x = iMaxX - iMinX + 1; x; --x)
             {
-                currTexelXClamped = currTexelX - ((currTexelX >> (xModShift)) << (xModShift));
-                currTexelYClamped = currTexelY - ((currTexelY >> (yModShift)) << (yModShift));
+                currTexelXClamped = WrapToInt(currTexelX, texture.m_Width);
+                currTexelYClamped = WrapToInt(currTexelY, texture.m_Height);
 
                 texIdx = (currTexelXClamped << texture.m_Height) + currTexelYClamped;
                 src = &pPalette[texture.m_pData[texIdx]];
@@ -242,4 +278,10 @@ void FlatSurfacesRenderer::DrawLine(int iY, int iMinX, int iMaxX, const KDRData:
             }
         }
     }
-}
\ No newline at end of file
+}
+
+// The renderer is instantiated for each KDRData::NumberType
+template class FlatSurfacesRenderer<FP32<14>>;
+template class FlatSurfacesRenderer<FP32<16>>;
+template class FlatSurfacesRenderer<float>;
+template class FlatSurfacesRenderer<double>;
@@ -9,31 +9,250 @@
 
 #include <cstring>
 
-KDTreeRenderer::KDTreeRenderer(const KDTreeMap &iMap) :
+std::unique_ptr<KDTreeRendererBase> CreateKDTreeRenderer(const KDTreeMap &iMap, KDRData::NumberType iNumberType)
+{
+    switch (iNumberType)
+    {
+    case KDRData::NumberType::FP32_14:
+        return std::make_unique<KDTreeRenderer<FP32<14>>>(iMap);
+    case KDRData::NumberType::FP32_16:
+        return std::make_unique<KDTreeRenderer<FP32<16>>>(iMap);
+    case KDRData::NumberType::FLOAT:
+        return std::make_unique<KDTreeRenderer<float>>(iMap);
+    case KDRData::NumberType::DOUBLE:
+        return std::make_unique<KDTreeRenderer<double>>(iMap);
+    default: // Should never be reached
+        return nullptr;
+    }
+}
+
+namespace
+{
+    template <typename Number>
+    struct NumberTypeOf;
+
+    template <>
+    struct NumberTypeOf<FP32<14>> { static constexpr KDRData::NumberType Value = KDRData::NumberType::FP32_14; };
+    template <>
+    struct NumberTypeOf<FP32<16>> { static constexpr KDRData::NumberType Value = KDRData::NumberType::FP32_16; };
+    template <>
+    struct NumberTypeOf<float> { static constexpr KDRData::NumberType Value = KDRData::NumberType::FLOAT; };
+    template <>
+    struct NumberTypeOf<double> { static constexpr KDRData::NumberType Value = KDRData::NumberType::DOUBLE; };
+} // namespace
+
+template <typename Number>
+KDTreeRenderer<Number>::KDTreeRenderer(const KDTreeMap &iMap) :
     m_Map(iMap),
+    m_HasPVS(false),
+    m_PVSCellIdx(KDTreeMap::NO_PVS),
+    m_RenderMode(KDRData::RenderMode::KDTree),
+    m_UsePortals(false),
+    m_PortalFrame(0u),
+    m_IsFrameValid(false),
+    m_FrameDirection(0),
+    m_FrameRenderMode(KDRData::RenderMode::KDTree),
     m_pFrameBuffer(new unsigned char[WINDOW_HEIGHT * WINDOW_WIDTH * 4u])
 {
     m_Settings.m_PlayerHorizontalFOV = 90 << ANGLE_SHIFT;
     m_Settings.m_PlayerVerticalFOV = (m_Settings.m_PlayerHorizontalFOV * WINDOW_HEIGHT) / WINDOW_WIDTH;
-    m_Settings.m_PlayerHeight = CType(30) / POSITION_SCALE;
-    m_Settings.m_HorizontalDistortionCst = 1 / (2 * tanInt(m_Settings.m_PlayerHorizontalFOV / 2));
-    m_Settings.m_VerticalDistortionCst = 1 / (2 * tanInt(m_Settings.m_PlayerVerticalFOV / 2));
+    m_Settings.m_PlayerHeight = Number(30) / POSITION_SCALE;
+    m_Settings.m_NearPlane = Number(1) / POSITION_SCALE;
+    KDRData::UpdateDerivedSettings(m_Settings);
+
+    BakeWalls();
+    BakeNodes();
+    BakePortalGraph();
+    m_IsSectorLit.assign(m_Map.m_Sectors.size(), false);
+
+    // Per frame containers get their worst case capacity up front, frames don't allocate
+    // Flats are the exception: a wall generates at most two, but a surface is two screen wide column arrays, and
+    // frames keep far fewer than two per wall of the map. The arena starts with room for a few blocks and grows up
+    // to what the frames need
+    m_DrawnWalls.reserve(m_Walls.size());
+    m_LitSectors.reserve(m_Map.m_Sectors.size());
+    m_LitSectorValues.reserve(m_Map.m_Sectors.size());
+    uint32_t nbFlats = std::min(2u * static_cast<uint32_t>(m_Walls.size()) + 2u, FLAT_SURFACES_RESERVE);
+    m_FlatSurfaceArena.Reserve(nbFlats);
+    m_FlatSurfaces.reserve(nbFlats);
+    m_GeneratedFlats.reserve(2u);
+    m_PVS.resize((m_Map.GetNbOfNodes() + m_Walls.size() + 7u) / 8u);
+    m_FrameStats = {};
 
     memset(m_pFrameBuffer, 255u, sizeof(unsigned char) * 4u * WINDOW_HEIGHT * WINDOW_WIDTH);
     ClearBuffers();
 }
 
-const unsigned char* KDTreeRenderer::GetFrameBuffer() const
+template <typename Number>
+KDTreeRenderer<Number>::~KDTreeRenderer()
+{
+    delete[] m_pFrameBuffer;
+}
+
+// Everything about a wall that does not depend on the player, computed once
+template <typename Number>
+void KDTreeRenderer<Number>::BakeWalls()
+{
+    m_Walls.resize(m_Map.m_Walls.size());
+    for (uint32_t i = 0; i < m_Walls.size(); i++)
+    {
+        const KDMapData::Wall &kdWall = m_Map.m_Walls[i];
+        KDRData::Wall<Number> &wall = m_Walls[i];
+
+        wall = m_Map.BuildXYScaledWall<KDRData::Wall<Number>>(i);
+        wall.m_pKDWall = &kdWall;
+        wall.m_IsXConst = kdWall.IsXConst();
+
+        wall.m_InSectorIdx = kdWall.m_InSector;
+        wall.m_OutSectorIdx = kdWall.m_OutSector;
+        wall.m_InSector = {0, 0, nullptr};
+        wall.m_OutSector = {0, 0, nullptr};
+        if (wall.m_InSectorIdx >= 0)
+            wall.m_InSector = KDRData::GetSectorFromKDSector<Number>(m_Map.m_Sectors[wall.m_InSectorIdx]);
+        if (wall.m_OutSectorIdx >= 0)
+            wall.m_OutSector = KDRData::GetSectorFromKDSector<Number>(m_Map.m_Sectors[wall.m_OutSectorIdx]);
+
+        wall.m_pTexture = nullptr;
+        wall.m_TexUOffset = 0;
+        wall.m_TexVOffset = 0;
+        wall.m_TexelXScale = 0;
+        wall.m_TexelYScale = 0;
+        if (kdWall.m_TexId != -1)
+        {
+            wall.m_pTexture = &m_Map.m_Textures[kdWall.m_TexId];
+            wall.m_TexUOffset = kdWall.m_TexUOffset;
+            wall.m_TexVOffset = kdWall.m_TexVOffset;
+            wall.m_TexelXScale = Number(int(1u << wall.m_pTexture->m_Width)) * Number(POSITION_SCALE) / Number(TEXEL_SCALE);
+            wall.m_TexelYScale = Number(int(1u << wall.m_pTexture->m_Height)) * Number(POSITION_SCALE) / Number(TEXEL_SCALE);
+        }
+
+        m_WallEndpoints.m_XFrom.push_back(wall.m_VertexFrom.m_X);
+        m_WallEndpoints.m_YFrom.push_back(wall.m_VertexFrom.m_Y);
+        m_WallEndpoints.m_XTo.push_back(wall.m_VertexTo.m_X);
+        m_WallEndpoints.m_YTo.push_back(wall.m_VertexTo.m_Y);
+    }
+
+    unsigned int maxNbWalls = 0u;
+    for (unsigned int i = 0; i < m_Map.GetNbOfNodes(); i++)
+        maxNbWalls = std::max(maxNbWalls, m_Map.GetNode(i).m_NbWalls);
+
+    m_VisibleWalls.m_Indices.resize(maxNbWalls);
+    m_VisibleWalls.m_CameraFrom.resize(maxNbWalls);
+    m_VisibleWalls.m_CameraTo.resize(maxNbWalls);
+    m_VisibleWalls.m_Count = 0u;
+}
+
+template <typename Number>
+void KDTreeRenderer<Number>::BakeNodes()
+{
+    m_Nodes.resize(m_Map.GetNbOfNodes());
+    for (uint32_t i = 0; i < m_Nodes.size(); i++)
+    {
+        const KDTreeFlatNode &kdNode = m_Map.GetNode(i);
+        KDRData::Node<Number> &node = m_Nodes[i];
+
+        node.m_SplitPlane = kdNode.m_SplitPlane;
+        node.m_SplitOffset = Number(kdNode.m_SplitOffset) / POSITION_SCALE;
+
+        node.m_AABBMin.m_X = Number(kdNode.m_AABBMin.m_X) / POSITION_SCALE;
+        node.m_AABBMin.m_Y = Number(kdNode.m_AABBMin.m_Y) / POSITION_SCALE;
+        node.m_AABBMax.m_X = Number(kdNode.m_AABBMax.m_X) / POSITION_SCALE;
+        node.m_AABBMax.m_Y = Number(kdNode.m_AABBMax.m_Y) / POSITION_SCALE;
+
+        node.m_PositiveSide = kdNode.m_PositiveSide;
+        node.m_NegativeSide = kdNode.m_NegativeSide;
+        node.m_FirstWall = kdNode.m_FirstWall;
+        node.m_NbWalls = kdNode.m_NbWalls;
+    }
+    if (!m_Nodes.empty())
+        ComputeSubtreeSizes(0u);
+
+    // Each visited node replaces itself with at most 3 entries, see RenderNodes
+    m_TraversalStack.resize(2 * m_Map.ComputeDepth() + 1);
+}
+
+template <typename Number>
+void KDTreeRenderer<Number>::ComputeSubtreeSizes(uint32_t iNodeIdx)
+{
+    KDRData::Node<Number> &node = m_Nodes[iNodeIdx];
+    node.m_NbSubtreeNodes = 1u;
+    node.m_NbSubtreeWalls = node.m_NbWalls;
+
+    for (uint32_t childIdx : {node.m_PositiveSide, node.m_NegativeSide})
+    {
+        if (childIdx == KDTreeFlatNode::NO_CHILD)
+            continue;
+
+        ComputeSubtreeSizes(childIdx);
+        node.m_NbSubtreeNodes += m_Nodes[childIdx].m_NbSubtreeNodes;
+        node.m_NbSubtreeWalls += m_Nodes[childIdx].m_NbSubtreeWalls;
+    }
+}
+
+// What portal mode needs to go from the reached sectors to the nodes holding their walls
+template <typename Number>
+void KDTreeRenderer<Number>::BakePortalGraph()
+{
+    m_NodeParents.assign(m_Nodes.size(), KDTreeFlatNode::NO_CHILD);
+    for (uint32_t i = 0; i < m_Nodes.size(); i++)
+    {
+        for (uint32_t childIdx : {m_Nodes[i].m_PositiveSide, m_Nodes[i].m_NegativeSide})
+        {
+            if (childIdx != KDTreeFlatNode::NO_CHILD)
+                m_NodeParents[childIdx] = i;
+        }
+    }
+
+    // Soft walls belong to both of their sectors
+    std::vector<std::vector<uint32_t>> sectorNodes(m_Map.m_Sectors.size());
+    for (uint32_t i = 0; i < m_Nodes.size(); i++)
+    {
+        for (uint32_t wallIdx = m_Nodes[i].m_FirstWall; wallIdx < m_Nodes[i].m_FirstWall + m_Nodes[i].m_NbWalls; wallIdx++)
+        {
+            for (int sectorIdx : {m_Walls[wallIdx].m_InSectorIdx, m_Walls[wallIdx].m_OutSectorIdx})
+            {
+                if (sectorIdx >= 0 && (sectorNodes[sectorIdx].empty() || sectorNodes[sectorIdx].back() != i))
+                    sectorNodes[sectorIdx].push_back(i);
+            }
+        }
+    }
+
+    m_SectorNodeOffsets.clear();
+    m_SectorNodes.clear();
+    for (const std::vector<uint32_t> &nodes : sectorNodes)
+    {
+        m_SectorNodeOffsets.push_back(static_cast<uint32_t>(m_SectorNodes.size()));
+        m_SectorNodes.insert(m_SectorNodes.end(), nodes.begin(), nodes.end());
+    }
+    m_SectorNodeOffsets.push_back(static_cast<uint32_t>(m_SectorNodes.size()));
+
+    m_NodeFrames.assign(m_Nodes.size(), 0u);
+    m_SectorFrames.assign(m_Map.m_Sectors.size(), 0u);
+    m_SectorWindows.resize(m_Map.m_Sectors.size());
+    m_PortalStack.reserve(m_Map.m_Sectors.size());
+    m_IsSectorPending.assign(m_Map.m_Sectors.size(), false);
+}
+
+template <typename Number>
+KDRData::NumberType KDTreeRenderer<Number>::GetNumberType() const
+{
+    return NumberTypeOf<Number>::Value;
+}
+
+template <typename Number>
+const unsigned char* KDTreeRenderer<Number>::GetFrameBuffer() const
 {
     return m_pFrameBuffer;
 }
 
-unsigned char *KDTreeRenderer::GetFrameBuffer()
+template <typename Number>
+unsigned char *KDTreeRenderer<Number>::GetFrameBuffer()
 {
     return m_pFrameBuffer;
 }
 
-void KDTreeRenderer::FillFrameBufferWithColor(unsigned char r, unsigned char g, unsigned char b)
+template <typename Number>
+void KDTreeRenderer<Number>::FillFrameBufferWithColor(unsigned char r, unsigned char g, unsigned char b)
 {
     // Loop because memset can't take anything bigger than a char as an input
     for (unsigned int i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT * 4u; i+= 4u)
@@ -44,257 +263,667 @@ void KDTreeRenderer::FillFrameBufferWithColor(unsigned char r, unsigned char g,
     }
 }
 
-void KDTreeRenderer::ClearBuffers()
+template <typename Number>
+void KDTreeRenderer<Number>::ClearBuffers()
 {
-    memset(m_pHorizOcclusionBuffer, 0u, sizeof(unsigned char) * WINDOW_WIDTH);
     m_HorizDrawnSegs.Clear();
     memset(m_pTopOcclusionBuffer, 0, sizeof(int) * WINDOW_WIDTH);
     memset(m_pBottomOcclusionBuffer, 0, sizeof(int) * WINDOW_WIDTH);
-    m_FlatSurfaces.clear();
 }
 
-void KDTreeRenderer::RefreshFrameBuffer()
+template <typename Number>
+void KDTreeRenderer<Number>::InvalidateFrame()
+{
+    m_IsFrameValid = false;
+}
+
+template <typename Number>
+void KDTreeRenderer<Number>::RefreshFrameBuffer()
 {
     // Useful when debugging, useless and costly otherwise
     // FillFrameBufferWithColor(255u, 0u, 255u);
     Render();
 }
 
-void KDTreeRenderer::Render()
+template <typename Number>
+void KDTreeRenderer<Number>::Render()
 {
     m_State.m_PlayerZ = ComputeZ();
 
+    // Frame to frame coherence: nothing to draw if the view and the lights didn't change, and no culling to do if
+    // only some lights did. The frame buffer isn't cleared between frames, so drawing the same walls and flats again
+    // gives the same frame as a rendering from scratch
+    KDRData::FrameReuse reuse = ComputeFrameReuse();
+    if (reuse != KDRData::FrameReuse::None)
+    {
+        if (reuse == KDRData::FrameReuse::Shading)
+        {
+            RedrawWalls();
+            RenderFlatSurfaces();
+            RecordLightValues();
+        }
+        m_FrameStats.m_Reuse = reuse;
+        return;
+    }
+
+    m_FrameStats = {};
+    m_DrawnWalls.clear();
+    m_FlatSurfaces.clear();
+    m_FlatSurfaceArena.Reset();
+
+    UpdatePVS();
+
     // Compute states
-    GetVector(m_State.m_PlayerPosition, m_State.m_PlayerDirection - m_Settings.m_PlayerHorizontalFOV / 2, m_State.m_FrustumToLeft);
-    GetVector(m_State.m_PlayerPosition, m_State.m_PlayerDirection + m_Settings.m_PlayerHorizontalFOV / 2, m_State.m_FrustumToRight);
-    GetVector(m_State.m_PlayerPosition, m_State.m_PlayerDirection, m_State.m_Look);
+    // Camera space axes (the only sin/cos pair of the frame), the frustum edges are the rays of the screen borders
+    const KDRData::Vertex<Number> &position = m_State.m_PlayerPosition;
+    m_State.m_CameraSin = sinInt<Number>(m_State.m_PlayerDirection);
+    m_State.m_CameraCos = cosInt<Number>(m_State.m_PlayerDirection);
+    Number lookX = m_State.m_CameraSin;
+    Number lookY = m_State.m_CameraCos;
+    m_State.m_Look.m_X = position.m_X + lookX;
+    m_State.m_Look.m_Y = position.m_Y + lookY;
+    m_State.m_Right.m_X = position.m_X + lookY;
+    m_State.m_Right.m_Y = position.m_Y - lookX;
+
+    // Frustum planes in world space, the camera space ones being lateral + depth * edgeSlope >= 0 (left),
+    // depth * edgeSlope - lateral >= 0 (right) and depth >= near plane
+    Number edgeSlope = m_Settings.m_ColumnRays.m_EdgeSlope;
+    m_State.m_FrustumLeftNormal.m_X = lookY + lookX * edgeSlope;
+    m_State.m_FrustumLeftNormal.m_Y = lookY * edgeSlope - lookX;
+    m_State.m_FrustumRightNormal.m_X = lookX * edgeSlope - lookY;
+    m_State.m_FrustumRightNormal.m_Y = lookY * edgeSlope + lookX;
+    m_State.m_FrustumNearNormal.m_X = lookX;
+    m_State.m_FrustumNearNormal.m_Y = lookY;
+
+    // Frustum edges directions, i.e. look -/+ right * edgeSlope
+    Number leftEdgeX = lookX - lookY * edgeSlope;
+    Number leftEdgeY = lookY + lookX * edgeSlope;
+    Number rightEdgeX = lookX + lookY * edgeSlope;
+    Number rightEdgeY = lookY - lookX * edgeSlope;
+    m_State.m_FrustumXSign = (leftEdgeX > 0 && rightEdgeX > 0) ? 1 : ((leftEdgeX < 0 && rightEdgeX < 0) ? -1 : 0);
+    m_State.m_FrustumYSign = (leftEdgeY > 0 && rightEdgeY > 0) ? 1 : ((leftEdgeY < 0 && rightEdgeY < 0) ? -1 : 0);
     // m_State.m_NearPlaneV1.m_X = m_State.m_PlayerPosition.m_X + (m_State.m_Look.m_X - m_State.m_PlayerPosition.m_X) * m_Settings.m_NearPlane;
     // m_State.m_NearPlaneV1.m_Y = m_State.m_PlayerPosition.m_Y + (m_State.m_Look.m_Y - m_State.m_PlayerPosition.m_Y) * m_Settings.m_NearPlane;
     // GetVector(m_State.m_NearPlaneV1, m_State.m_PlayerDirection + (90 << ANGLE_SHIFT), m_State.m_NearPlaneV2);
 
-    RenderNode(m_Map.m_RootNode);
+    FloodPortals();
+    RenderNodes();
     RenderFlatSurfaces();
+
+    m_IsFrameValid = true;
+    m_FramePosition = m_State.m_PlayerPosition;
+    m_FrameDirection = m_State.m_PlayerDirection;
+    m_FrameZ = m_State.m_PlayerZ;
+    m_FrameRenderMode = m_RenderMode;
+    CollectLitSectors();
+    RecordLightValues();
 }
 
-void KDTreeRenderer::RenderNode(KDTreeNode *pNode)
+template <typename Number>
+KDRData::FrameReuse KDTreeRenderer<Number>::ComputeFrameReuse() const
 {
-    // Occlusion culling
-    if(m_HorizDrawnSegs.IsScreenEntirelyDrawn())
-        return;
+    if (!m_IsFrameValid || m_RenderMode != m_FrameRenderMode || m_State.m_PlayerDirection != m_FrameDirection ||
+        m_State.m_PlayerPosition.m_X != m_FramePosition.m_X || m_State.m_PlayerPosition.m_Y != m_FramePosition.m_Y ||
+        m_State.m_PlayerZ != m_FrameZ)
+        return KDRData::FrameReuse::None;
 
-    // Frustum culling
-    if(DoFrustumCulling(pNode))
-        return;
+    for (unsigned int i = 0; i < m_LitSectors.size(); i++)
+    {
+        if (m_Map.m_Sectors[m_LitSectors[i]].m_pLight->GetValue() != m_LitSectorValues[i])
+            return KDRData::FrameReuse::Shading;
+    }
+
+    return KDRData::FrameReuse::FrameBuffer;
+}
+
+// Sectors of the drawn walls (both sides, whichever one the WallRenderer picks) and flats
+template <typename Number>
+void KDTreeRenderer<Number>::CollectLitSectors()
+{
+    auto addSector = [&](int iSectorIdx) {
+        if (iSectorIdx >= 0 && !m_IsSectorLit[iSectorIdx])
+        {
+            m_IsSectorLit[iSectorIdx] = true;
+            m_LitSectors.push_back(iSectorIdx);
+        }
+    };
 
-    bool positiveSide = false;
-    if (pNode->m_SplitPlane == KDTreeNode::SplitPlane::XConst)
-        positiveSide = m_State.m_PlayerPosition.m_X > (CType(pNode->m_SplitOffset) / POSITION_SCALE);
-    else if (pNode->m_SplitPlane == KDTreeNode::SplitPlane::YConst)
-        positiveSide = m_State.m_PlayerPosition.m_Y > (CType(pNode->m_SplitOffset) / POSITION_SCALE);
+    m_LitSectors.clear();
+    for (const KDRData::DrawnWall<Number> &drawnWall : m_DrawnWalls)
+    {
+        addSector(m_Walls[drawnWall.m_WallIdx].m_InSectorIdx);
+        addSector(m_Walls[drawnWall.m_WallIdx].m_OutSectorIdx);
+    }
+    for (uint32_t flatHandle : m_FlatSurfaces)
+        addSector(m_FlatSurfaceArena.Get(flatHandle).m_SectorIdx);
 
-    if (positiveSide && pNode->m_PositiveSide)
-        RenderNode(pNode->m_PositiveSide);
-    else if (!positiveSide && pNode->m_NegativeSide)
-        RenderNode(pNode->m_NegativeSide);
+    for (int sectorIdx : m_LitSectors)
+        m_IsSectorLit[sectorIdx] = false;
+}
 
-    for (unsigned int i = 0; i < pNode->m_Walls.size(); i++)
+template <typename Number>
+void KDTreeRenderer<Number>::RecordLightValues()
+{
+    m_LitSectorValues.resize(m_LitSectors.size());
+    for (unsigned int i = 0; i < m_LitSectors.size(); i++)
+        m_LitSectorValues[i] = m_Map.m_Sectors[m_LitSectors[i]].m_pLight->GetValue();
+}
+
+// Same walls in the same order, so the occlusion buffers end up the same and the flats don't need to be generated again
+// The flats the walls generate anyway are released right away, the arena still holds the last frame's ones
+template <typename Number>
+void KDTreeRenderer<Number>::RedrawWalls()
+{
+    for (const KDRData::DrawnWall<Number> &drawnWall : m_DrawnWalls)
     {
-        KDRData::Wall wall(KDRData::GetWallFromNode(pNode, i));
+        WallRenderer<Number> wallRenderer(m_Walls[drawnWall.m_WallIdx], drawnWall.m_CameraFrom, drawnWall.m_CameraTo, m_State, m_Settings, m_Map);
+        wallRenderer.SetBuffers(m_pFrameBuffer, &m_HorizDrawnSegs, m_pTopOcclusionBuffer, m_pBottomOcclusionBuffer, &m_FlatSurfaceArena);
+        m_GeneratedFlats.clear();
+        wallRenderer.Render(m_GeneratedFlats);
+        for (auto it = m_GeneratedFlats.rbegin(); it != m_GeneratedFlats.rend(); ++it)
+            m_FlatSurfaceArena.Release(*it);
+    }
+}
 
-        bool vertexFromIsBehindPlayer = DotProduct(m_State.m_PlayerPosition, m_State.m_Look, m_State.m_PlayerPosition, wall.m_VertexFrom) <= 0;
-        bool vertexToIsBehindPlayer = DotProduct(m_State.m_PlayerPosition, m_State.m_Look, m_State.m_PlayerPosition, wall.m_VertexTo) <= 0;
+// Front to back traversal, with an explicit stack
+// Entries are node indices, flagged with WALLS_ENTRY when it is the node's walls turn to be rendered
+template <typename Number>
+void KDTreeRenderer<Number>::RenderNodes()
+{
+    constexpr uint32_t WALLS_ENTRY = 0x80000000u;
 
-        if ((WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToLeft, wall.m_VertexFrom) <= 0 &&
-             WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToLeft, wall.m_VertexTo) <= 0) ||
-            (WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToRight, wall.m_VertexFrom) >= 0 &&
-             WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToRight, wall.m_VertexTo) >= 0) ||
-            (vertexFromIsBehindPlayer && vertexToIsBehindPlayer))
+    if (m_Nodes.empty())
+        return;
+
+    unsigned int stackSize = 0u;
+    m_TraversalStack[stackSize++] = 0u;
+    while (stackSize)
+    {
+        uint32_t entry = m_TraversalStack[--stackSize];
+        if (entry & WALLS_ENTRY)
         {
-            // Culling (wall is entirely outside frustum)
+            RenderNodeWalls(m_Nodes[entry & ~WALLS_ENTRY]);
             continue;
         }
-        else
+
+        const KDRData::Node<Number> &node = m_Nodes[entry];
+
+        // Occlusion culling, the cheap way
+        if(m_HorizDrawnSegs.IsScreenEntirelyDrawn())
         {
-            std::vector<KDRData::FlatSurface> generatedFlats;
-            WallRenderer wallRenderer(wall, m_State, m_Settings, m_Map);
-            wallRenderer.SetBuffers(m_pFrameBuffer, m_pHorizOcclusionBuffer, &m_HorizDrawnSegs, m_pTopOcclusionBuffer, m_pBottomOcclusionBuffer);
-            wallRenderer.Render(generatedFlats);
+            m_FrameStats.m_NbOcclusionCulledNodes += node.m_NbSubtreeNodes;
+            m_FrameStats.m_NbOcclusionCulledWalls += node.m_NbSubtreeWalls;
+            continue;
+        }
 
-            for(KDRData::FlatSurface &flat : generatedFlats)
-                AddFlatSurface(flat);
+        // Nothing in the subtree can be seen from the camera's cell
+        if(!IsInPVS(entry))
+        {
+            m_FrameStats.m_NbPVSCulledNodes += node.m_NbSubtreeNodes;
+            m_FrameStats.m_NbPVSCulledWalls += node.m_NbSubtreeWalls;
+            continue;
         }
-    }
 
-    if (positiveSide && pNode->m_NegativeSide)
-        RenderNode(pNode->m_NegativeSide);
-    else if (!positiveSide && pNode->m_PositiveSide)
-        RenderNode(pNode->m_PositiveSide);
+        // No wall of a sector seen through the portals in the subtree
+        if(m_UsePortals && m_NodeFrames[entry] != m_PortalFrame)
+        {
+            m_FrameStats.m_NbPortalCulledNodes += node.m_NbSubtreeNodes;
+            m_FrameStats.m_NbPortalCulledWalls += node.m_NbSubtreeWalls;
+            continue;
+        }
+
+        // Frustum culling
+        if(DoFrustumCulling(node))
+            continue;
+
+        // Occlusion culling
+        if(DoOcclusionCulling(node))
+        {
+            m_FrameStats.m_NbOcclusionCulledNodes += node.m_NbSubtreeNodes;
+            m_FrameStats.m_NbOcclusionCulledWalls += node.m_NbSubtreeWalls;
+            continue;
+        }
+
+        m_FrameStats.m_NbVisitedNodes++;
+
+        bool positiveSide = false;
+        if (node.m_SplitPlane == KDTreeNode::SplitPlane::XConst)
+            positiveSide = m_State.m_PlayerPosition.m_X > node.m_SplitOffset;
+        else if (node.m_SplitPlane == KDTreeNode::SplitPlane::YConst)
+            positiveSide = m_State.m_PlayerPosition.m_Y > node.m_SplitOffset;
+
+        uint32_t nearSide = positiveSide ? node.m_PositiveSide : node.m_NegativeSide;
+        uint32_t farSide = positiveSide ? node.m_NegativeSide : node.m_PositiveSide;
+
+        // Near side first, then the node's walls, then the far side
+        if (farSide != KDTreeFlatNode::NO_CHILD)
+            m_TraversalStack[stackSize++] = farSide;
+        m_TraversalStack[stackSize++] = entry | WALLS_ENTRY;
+        if (nearSide != KDTreeFlatNode::NO_CHILD)
+            m_TraversalStack[stackSize++] = nearSide;
+    }
 }
 
-bool KDTreeRenderer::AddFlatSurface(KDRData::FlatSurface &iFlatSurface)
+template <typename Number>
+void KDTreeRenderer<Number>::RenderNodeWalls(const KDRData::Node<Number> &iNode)
 {
-    iFlatSurface.Tighten();
-
-    bool hasBeenAbsorbed = false;
-    // for(auto &k : m_FlatSurfaces)
-    // {
-    //     for (KDRData::FlatSurface &flatSurface : k.second)
-    //     {
-    //         if (flatSurface.Absorb(iFlatSurface))
-    //             hasBeenAbsorbed = true;
-    //     }
-    // }
-    auto found = m_FlatSurfaces.find(iFlatSurface.m_Height);
-    if(found != m_FlatSurfaces.end())
+    // Walls outside of the frustum are culled all at once, before any WallRenderer gets built
+    KDRData::CullWalls(m_WallEndpoints, iNode.m_FirstWall, iNode.m_NbWalls, m_State, m_Settings, m_VisibleWalls);
+    for (unsigned int i = 0; i < m_VisibleWalls.m_Count; i++)
     {
-        for (KDRData::FlatSurface &flatSurface : found->second)
+        // Walls are frustum culled in batches, the PVS is checked afterwards
+        uint32_t wallIdx = m_VisibleWalls.m_Indices[i];
+        if (!IsInPVS(m_Map.GetNbOfNodes() + wallIdx))
         {
-            if (flatSurface.Absorb(iFlatSurface))
-            {
-                hasBeenAbsorbed = true;
-                break;
-            }
+            m_FrameStats.m_NbPVSCulledWalls++;
+            continue;
         }
+
+        const KDRData::Wall<Number> &wall = m_Walls[wallIdx];
+        if (DoWallCulling(wall, m_VisibleWalls.m_CameraFrom[i], m_VisibleWalls.m_CameraTo[i]))
+            continue;
+        m_FrameStats.m_NbRenderedWalls++;
+        m_DrawnWalls.push_back({wallIdx, m_VisibleWalls.m_CameraFrom[i], m_VisibleWalls.m_CameraTo[i]});
+
+        WallRenderer<Number> wallRenderer(wall, m_VisibleWalls.m_CameraFrom[i], m_VisibleWalls.m_CameraTo[i], m_State, m_Settings, m_Map);
+        wallRenderer.SetBuffers(m_pFrameBuffer, &m_HorizDrawnSegs, m_pTopOcclusionBuffer, m_pBottomOcclusionBuffer, &m_FlatSurfaceArena);
+        m_GeneratedFlats.clear();
+        wallRenderer.Render(m_GeneratedFlats);
+
+        for (uint32_t flatHandle : m_GeneratedFlats)
+            AddFlatSurface(flatHandle);
     }
+}
 
-    if (!hasBeenAbsorbed)
-        m_FlatSurfaces[iFlatSurface.m_Height].push_back(iFlatSurface);
+// Surfaces are kept sorted by height, a new one goes after the ones of the same height unless one of them absorbs it
+template <typename Number>
+bool KDTreeRenderer<Number>::AddFlatSurface(uint32_t iFlatHandle)
+{
+    KDRData::FlatSurface<Number> &flatSurface = m_FlatSurfaceArena.Get(iFlatHandle);
+    flatSurface.Tighten();
+
+    const Number height = flatSurface.m_Height;
+    auto sameHeightBegin = std::lower_bound(m_FlatSurfaces.begin(), m_FlatSurfaces.end(), height, [&](uint32_t iHandle, Number iHeight) {
+        return m_FlatSurfaceArena.Get(iHandle).m_Height < iHeight;
+    });
+    auto sameHeightEnd = std::upper_bound(sameHeightBegin, m_FlatSurfaces.end(), height, [&](Number iHeight, uint32_t iHandle) {
+        return iHeight < m_FlatSurfaceArena.Get(iHandle).m_Height;
+    });
+
+    for (auto it = sameHeightBegin; it != sameHeightEnd; ++it)
+    {
+        if (m_FlatSurfaceArena.Get(*it).Absorb(flatSurface))
+        {
+            m_FlatSurfaceArena.Release(iFlatHandle);
+            return true;
+        }
+    }
 
+    m_FlatSurfaces.insert(sameHeightEnd, iFlatHandle);
     return true;
 }
 
-void KDTreeRenderer::RenderFlatSurfaces()
+template <typename Number>
+void KDTreeRenderer<Number>::RenderFlatSurfaces()
 {
-    FlatSurfacesRenderer flatRenderer(m_FlatSurfaces, m_State, m_Settings, m_Map);
-    flatRenderer.SetBuffers(m_pFrameBuffer, m_pHorizOcclusionBuffer, m_pTopOcclusionBuffer, m_pBottomOcclusionBuffer);
+    FlatSurfacesRenderer<Number> flatRenderer(m_FlatSurfaceArena, m_FlatSurfaces, m_State, m_Settings, m_Map);
+    flatRenderer.SetBuffers(m_pFrameBuffer, m_pTopOcclusionBuffer, m_pBottomOcclusionBuffer);
     flatRenderer.Render();
 }
 
-bool KDTreeRenderer::DoFrustumCulling(KDTreeNode *ipNode) const
+// Separating axis test between the AABB and the frustum, both being convex
+// Candidate axes are the frustum planes normals and the world axes
+template <typename Number>
+bool KDTreeRenderer<Number>::DoFrustumCulling(const KDRData::Node<Number> &iNode) const
+{
+    const KDRData::Vertex<Number> &position = m_State.m_PlayerPosition;
+
+    // The AABB is outside of a plane if its corner the furthest along the normal is
+    auto isOutside = [&](const KDRData::Vertex<Number> &iNormal, Number iMinDist) {
+        Number dX = (iNormal.m_X >= 0 ? iNode.m_AABBMax.m_X : iNode.m_AABBMin.m_X) - position.m_X;
+        Number dY = (iNormal.m_Y >= 0 ? iNode.m_AABBMax.m_Y : iNode.m_AABBMin.m_Y) - position.m_Y;
+        return dX * iNormal.m_X + dY * iNormal.m_Y < iMinDist;
+    };
+
+    if (isOutside(m_State.m_FrustumLeftNormal, 0) ||
+        isOutside(m_State.m_FrustumRightNormal, 0) ||
+        isOutside(m_State.m_FrustumNearNormal, m_Settings.m_NearPlane))
+        return true;
+
+    // Along the world axes, the frustum is within the cone of its edges starting from the player (slightly conservative
+    // since the near plane is ignored)
+    if ((m_State.m_FrustumXSign > 0 && iNode.m_AABBMax.m_X < position.m_X) ||
+        (m_State.m_FrustumXSign < 0 && iNode.m_AABBMin.m_X > position.m_X) ||
+        (m_State.m_FrustumYSign > 0 && iNode.m_AABBMax.m_Y < position.m_Y) ||
+        (m_State.m_FrustumYSign < 0 && iNode.m_AABBMin.m_Y > position.m_Y))
+        return true;
+
+    return false;
+}
+
+// The traversal being front to back, whatever is below the node is behind what has already been drawn:
+// if the columns the node's AABB covers are all closed, the whole subtree is hidden
+template <typename Number>
+bool KDTreeRenderer<Number>::DoOcclusionCulling(const KDRData::Node<Number> &iNode) const
+{
+    const Number nearPlane = m_Settings.m_NearPlane;
+    const Number edgeSlope = m_Settings.m_ColumnRays.m_EdgeSlope;
+
+    KDRData::Vertex<Number> corners[4] = {
+        KDRData::ToCameraSpace(m_State, {iNode.m_AABBMin.m_X, iNode.m_AABBMin.m_Y}),
+        KDRData::ToCameraSpace(m_State, {iNode.m_AABBMax.m_X, iNode.m_AABBMin.m_Y}),
+        KDRData::ToCameraSpace(m_State, {iNode.m_AABBMax.m_X, iNode.m_AABBMax.m_Y}),
+        KDRData::ToCameraSpace(m_State, {iNode.m_AABBMin.m_X, iNode.m_AABBMax.m_Y})};
+
+    // Slopes range of the AABB clipped by the near plane, clamped to the frustum like the walls' (see WallRenderer::Render)
+    bool hasSlope = false;
+    Number minSlope = 0, maxSlope = 0;
+    auto addVertex = [&](Number iX, Number iY) {
+        Number slope = Clamp(iX * MakeRecip(iY), -edgeSlope, edgeSlope);
+        minSlope = (!hasSlope || slope < minSlope) ? slope : minSlope;
+        maxSlope = (!hasSlope || slope > maxSlope) ? slope : maxSlope;
+        hasSlope = true;
+    };
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        const KDRData::Vertex<Number> &from = corners[i];
+        const KDRData::Vertex<Number> &to = corners[(i + 1) & 3];
+
+        if (from.m_Y >= nearPlane)
+            addVertex(from.m_X, from.m_Y);
+        if ((from.m_Y < nearPlane) != (to.m_Y < nearPlane))
+            addVertex(from.m_X + (to.m_X - from.m_X) * ((nearPlane - from.m_Y) * MakeRecip(to.m_Y - from.m_Y)), nearPlane);
+    }
+
+    if (!hasSlope)
+        return false;
+
+    // Same projection as the walls', one more column on each side to be on the safe side rounding-wise
+    int minX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, minSlope * m_Settings.m_HorizontalDistortionCst) - 1;
+    int maxX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, maxSlope * m_Settings.m_HorizontalDistortionCst) + 1;
+    minX = Clamp(minX, 0, WINDOW_WIDTH - 1);
+    maxX = Clamp(maxX, 0, WINDOW_WIDTH - 1);
+
+    return m_HorizDrawnSegs.IsSegmentEntirelyDrawn(minX, maxX);
+}
+
+// Cheap checks for the walls WallRenderer would bail out on anyway, before it gets built
+// Only the span of the walls the near plane and the frustum edges do not clip is exactly the one WallRenderer
+// computes, others get one more column on each side and are never considered empty
+template <typename Number>
+bool KDTreeRenderer<Number>::DoWallCulling(const KDRData::Wall<Number> &iWall, const KDRData::Vertex<Number> &iCameraFrom, const KDRData::Vertex<Number> &iCameraTo)
 {
-    // Should never happen
-    if(!ipNode)
+    // Hard walls are only drawn from their inner side (see WallRenderer::RenderWall)
+    if (iWall.m_OutSectorIdx == -1 && WhichSideOfXYAlignedSegment(iWall.m_VertexFrom, iWall.m_VertexTo, m_State.m_PlayerPosition) <= 0)
+    {
+        m_FrameStats.m_NbBackFacingWalls++;
         return true;
+    }
 
-    KDRData::Vertex aabbMin, aabbMax;
-    GetAABBFromNode(ipNode, aabbMin, aabbMax);
+    // Portal mode: the wall is seen from its sector on the camera's side, which must have been reached
+    int windowMinX = 0;
+    int windowMaxX = WINDOW_WIDTH - 1;
+    if (m_UsePortals)
+    {
+        int side = WhichSideOfXYAlignedSegment(iWall.m_VertexFrom, iWall.m_VertexTo, m_State.m_PlayerPosition);
+        int sectorIdx = side > 0 ? iWall.m_InSectorIdx : (side < 0 ? iWall.m_OutSectorIdx : -1);
+        if (sectorIdx >= 0)
+        {
+            if (m_SectorFrames[sectorIdx] != m_PortalFrame)
+            {
+                m_FrameStats.m_NbPortalCulledWalls++;
+                return true;
+            }
+            windowMinX = m_SectorWindows[sectorIdx].m_MinX;
+            windowMaxX = m_SectorWindows[sectorIdx].m_MaxX;
+        }
+    }
 
-    // Build vertices
-    KDRData::Vertex nodeGeom[4];
+    const Number nearPlane = m_Settings.m_NearPlane;
+    const Number edgeSlope = m_Settings.m_ColumnRays.m_EdgeSlope;
 
-    nodeGeom[0].m_X = aabbMin.m_X;
-    nodeGeom[0].m_Y = aabbMin.m_Y;
+    // Left to WallRenderer
+    if (iCameraFrom.m_Y < nearPlane || iCameraTo.m_Y < nearPlane)
+        return false;
 
-    nodeGeom[1].m_X = aabbMin.m_X;
-    nodeGeom[1].m_Y = aabbMax.m_Y;
+    auto isInsideEdges = [&](const KDRData::Vertex<Number> &iVertex) {
+        return iVertex.m_X + iVertex.m_Y * edgeSlope >= 0 && iVertex.m_Y * edgeSlope - iVertex.m_X >= 0;
+    };
+    bool isExact = isInsideEdges(iCameraFrom) && isInsideEdges(iCameraTo);
 
-    nodeGeom[2].m_X = aabbMax.m_X;
-    nodeGeom[2].m_Y = aabbMax.m_Y;
+    Number slopeFrom = Clamp(iCameraFrom.m_X * MakeRecip(iCameraFrom.m_Y), -edgeSlope, edgeSlope);
+    Number slopeTo = Clamp(iCameraTo.m_X * MakeRecip(iCameraTo.m_Y), -edgeSlope, edgeSlope);
+    int minX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, std::min(slopeFrom, slopeTo) * m_Settings.m_HorizontalDistortionCst);
+    int maxX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, std::max(slopeFrom, slopeTo) * m_Settings.m_HorizontalDistortionCst);
 
-    nodeGeom[3].m_X = aabbMax.m_X;
-    nodeGeom[3].m_Y = aabbMin.m_Y;
+    if (isExact && minX >= maxX)
+    {
+        m_FrameStats.m_NbEmptyWalls++;
+        return true;
+    }
 
-    // Test vertices against frustum: if at least one is inside, return false
-    for (unsigned int i = 0; i < 4; i++)
+    if (!isExact)
     {
-        if ((WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToLeft, nodeGeom[i]) >= 0) &&
-            (WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToRight, nodeGeom[i]) <= 0))
-            return false;
+        minX--;
+        maxX++;
     }
+    minX = Clamp(minX, 0, WINDOW_WIDTH - 1);
+    maxX = Clamp(maxX, 0, WINDOW_WIDTH - 1);
 
-    // Test segments againt frustum: if at least one segment intersects the frustum, return false
-    KDRData::Vertex unused;
-    for (unsigned int i = 0; i < 4; i++)
+    if (maxX < windowMinX || minX > windowMaxX)
     {
-        if (LineSegmentIntersection(m_State.m_PlayerPosition, m_State.m_FrustumToLeft, nodeGeom[i], nodeGeom[(i + 1) % 4], unused))
-            return false;
+        m_FrameStats.m_NbPortalCulledWalls++;
+        return true;
     }
 
-    return true;
+    if (m_HorizDrawnSegs.IsSegmentEntirelyDrawn(minX, maxX))
+    {
+        m_FrameStats.m_NbOccludedWalls++;
+        return true;
+    }
+
+    return false;
 }
 
-CType KDTreeRenderer::ComputeZ()
+// The camera seldom changes cell, the set is only decompressed when it does
+template <typename Number>
+void KDTreeRenderer<Number>::UpdatePVS()
 {
-    return RecursiveComputeZ(m_Map.m_RootNode);
+    // Cells do not go beyond the root's AABB
+    const KDRData::Vertex<Number> &position = m_State.m_PlayerPosition;
+    if (m_Nodes.empty() ||
+        position.m_X < m_Nodes[0].m_AABBMin.m_X || position.m_X > m_Nodes[0].m_AABBMax.m_X ||
+        position.m_Y < m_Nodes[0].m_AABBMin.m_Y || position.m_Y > m_Nodes[0].m_AABBMax.m_Y)
+    {
+        m_HasPVS = false;
+        m_PVSCellIdx = KDTreeMap::NO_PVS;
+        return;
+    }
+
+    uint32_t cellIdx = m_Map.LocateCell(position.m_X, position.m_Y);
+    if (cellIdx != m_PVSCellIdx)
+    {
+        m_HasPVS = m_Map.DecompressPVS(cellIdx, m_PVS);
+        m_PVSCellIdx = cellIdx;
+    }
 }
 
-CType KDTreeRenderer::RecursiveComputeZ(KDTreeNode *pNode)
+// Portal mode: sectors seen from the camera's one through soft walls, each with the hull of the columns it may be seen
+// through. Going through a portal narrows the window to the portal's columns. Windows only grow, so this ends
+// Relies on the camera being inside of a sector: hard walls are seen through from outside of the map, which KD mode
+// also shows when the camera is closer to one than the near plane
+template <typename Number>
+void KDTreeRenderer<Number>::FloodPortals()
 {
-    static unsigned pouet = 0;
+    m_UsePortals = false;
+    if (m_RenderMode != KDRData::RenderMode::Portals || m_Map.m_SectorPortalOffsets.size() != m_Map.m_Sectors.size() + 1)
+        return;
 
-    if(!pNode)
-        return 0; // Should not happen
+    int cameraSectorIdx = m_Map.LocateSector(m_State.m_PlayerPosition.m_X, m_State.m_PlayerPosition.m_Y);
+    if (cameraSectorIdx < 0)
+        return;
+    m_UsePortals = true;
 
-    CType oZ = 0;
+    // Stamps from previous frames never match the current one
+    if (++m_PortalFrame == 0u)
+    {
+        std::fill(m_NodeFrames.begin(), m_NodeFrames.end(), 0u);
+        std::fill(m_SectorFrames.begin(), m_SectorFrames.end(), 0u);
+        m_PortalFrame = 1u;
+    }
 
-    bool positiveSide;
-    if (pNode->m_SplitPlane == KDTreeNode::SplitPlane::XConst)
-        positiveSide = m_State.m_PlayerPosition.m_X > (CType(pNode->m_SplitOffset) / POSITION_SCALE);
-    else if (pNode->m_SplitPlane == KDTreeNode::SplitPlane::YConst)
-        positiveSide = m_State.m_PlayerPosition.m_Y > (CType(pNode->m_SplitOffset) / POSITION_SCALE);
+    m_PortalStack.clear();
+    ReachSector(cameraSectorIdx, 0, WINDOW_WIDTH - 1);
+    while (!m_PortalStack.empty())
+    {
+        KDRData::PortalWindow window = m_SectorWindows[m_PortalStack.back()];
+        m_IsSectorPending[window.m_SectorIdx] = false;
+        m_PortalStack.pop_back();
 
-    // We are on a terminal node
-    // The node contains walls oriented similarly and refering
-    // to the same sectors, which we are going to use to find out which sector the player is in
-    if ((positiveSide && !pNode->m_PositiveSide) ||
-        (!positiveSide && !pNode->m_NegativeSide))
+        for (uint32_t i = m_Map.m_SectorPortalOffsets[window.m_SectorIdx]; i < m_Map.m_SectorPortalOffsets[window.m_SectorIdx + 1]; i++)
+        {
+            const KDRData::Wall<Number> &portal = m_Walls[m_Map.m_SectorPortals[i]];
+            bool toInSector = portal.m_OutSectorIdx == window.m_SectorIdx;
+
+            // Lines of sight cross the portal from the camera's side
+            int side = WhichSideOfXYAlignedSegment(portal.m_VertexFrom, portal.m_VertexTo, m_State.m_PlayerPosition);
+            if ((toInSector && side > 0) || (!toInSector && side < 0))
+                continue;
+
+            int minX = window.m_MinX;
+            int maxX = window.m_MaxX;
+            if (ClipPortalWindow(portal, minX, maxX))
+                ReachSector(toInSector ? portal.m_InSectorIdx : portal.m_OutSectorIdx, minX, maxX);
+        }
+    }
+}
+
+// Stamps the sector (and the nodes holding its walls, along with their ancestors) the first time it is reached
+// It is pushed again whenever its window grows, unless it is still waiting to be flooded from
+template <typename Number>
+void KDTreeRenderer<Number>::ReachSector(int iSectorIdx, int iMinX, int iMaxX)
+{
+    KDRData::PortalWindow &window = m_SectorWindows[iSectorIdx];
+    if (m_SectorFrames[iSectorIdx] != m_PortalFrame)
     {
-        if(pNode->GetNbOfWalls()) // Should always be true
+        m_SectorFrames[iSectorIdx] = m_PortalFrame;
+        window = {iSectorIdx, iMinX, iMaxX};
+        m_FrameStats.m_NbReachedSectors++;
+
+        for (uint32_t i = m_SectorNodeOffsets[iSectorIdx]; i < m_SectorNodeOffsets[iSectorIdx + 1]; i++)
         {
-            oZ = m_Settings.m_PlayerHeight;
-            KDRData::Wall wall(KDRData::GetWallFromNode(pNode, 0));
-            int whichSide = WhichSide(wall.m_VertexFrom, wall.m_VertexTo, m_State.m_PlayerPosition);
-            if(whichSide < 0)
-            {
-                int outSectorIdx = wall.m_pKDWall->m_OutSector;
-                if (outSectorIdx >= 0)
-                {
-                    KDRData::Sector outSector = KDRData::GetSectorFromKDSector(m_Map.m_Sectors[outSectorIdx]);
-                    oZ += outSector.m_Floor;
-                    oZ = Clamp(oZ, outSector.m_Floor, outSector.m_Ceiling);
-                }
-            }
-            else
-            {
-                int inSectorIdx = wall.m_pKDWall->m_InSector;
-                if (inSectorIdx >= 0)
-                {
-                    KDRData::Sector inSector = KDRData::GetSectorFromKDSector(m_Map.m_Sectors[inSectorIdx]);
-                    oZ += inSector.m_Floor;
-                    oZ = Clamp(oZ, inSector.m_Floor, inSector.m_Ceiling);
-                }
-            }
+            for (uint32_t nodeIdx = m_SectorNodes[i]; nodeIdx != KDTreeFlatNode::NO_CHILD && m_NodeFrames[nodeIdx] != m_PortalFrame; nodeIdx = m_NodeParents[nodeIdx])
+                m_NodeFrames[nodeIdx] = m_PortalFrame;
         }
     }
-    // Recursive run
+    else if (iMinX >= window.m_MinX && iMaxX <= window.m_MaxX)
+        return;
     else
     {
-        if(positiveSide)
-            return RecursiveComputeZ(pNode->m_PositiveSide);
-        else
-            return RecursiveComputeZ(pNode->m_NegativeSide);
+        // It is flooded from with the whole hull, whenever it was pushed
+        window.m_MinX = std::min(window.m_MinX, iMinX);
+        window.m_MaxX = std::max(window.m_MaxX, iMaxX);
+    }
+
+    if (!m_IsSectorPending[iSectorIdx])
+    {
+        m_IsSectorPending[iSectorIdx] = true;
+        m_PortalStack.push_back(iSectorIdx);
+    }
+}
+
+// Narrows [ioMinX, ioMaxX] to the columns of the portal, with the same margins as DoWallCulling's
+// False if nothing is left
+template <typename Number>
+bool KDTreeRenderer<Number>::ClipPortalWindow(const KDRData::Wall<Number> &iPortal, int &ioMinX, int &ioMaxX) const
+{
+    KDRData::Vertex<Number> from = KDRData::ToCameraSpace(m_State, iPortal.m_VertexFrom);
+    KDRData::Vertex<Number> to = KDRData::ToCameraSpace(m_State, iPortal.m_VertexTo);
+
+    const Number nearPlane = m_Settings.m_NearPlane;
+    const Number edgeSlope = m_Settings.m_ColumnRays.m_EdgeSlope;
+    if ((from.m_Y < nearPlane && to.m_Y < nearPlane) ||
+        (from.m_X + from.m_Y * edgeSlope <= 0 && to.m_X + to.m_Y * edgeSlope <= 0) ||
+        (from.m_X - from.m_Y * edgeSlope >= 0 && to.m_X - to.m_Y * edgeSlope >= 0))
+        return false;
+
+    // Crossing the near plane, the portal may be looked through anywhere
+    if (from.m_Y < nearPlane || to.m_Y < nearPlane)
+        return true;
+
+    Number slopeFrom = Clamp(from.m_X * MakeRecip(from.m_Y), -edgeSlope, edgeSlope);
+    Number slopeTo = Clamp(to.m_X * MakeRecip(to.m_Y), -edgeSlope, edgeSlope);
+    int minX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, std::min(slopeFrom, slopeTo) * m_Settings.m_HorizontalDistortionCst) - 1;
+    int maxX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, std::max(slopeFrom, slopeTo) * m_Settings.m_HorizontalDistortionCst) + 1;
+    ioMinX = std::max(ioMinX, minX);
+    ioMaxX = std::min(ioMaxX, maxX);
+
+    return ioMinX <= ioMaxX;
+}
+
+template <typename Number>
+Number KDTreeRenderer<Number>::ComputeZ()
+{
+    Number oZ = m_Settings.m_PlayerHeight;
+
+    int sectorIdx = m_Map.LocateSector(m_State.m_PlayerPosition.m_X, m_State.m_PlayerPosition.m_Y);
+    if (sectorIdx >= 0)
+    {
+        KDRData::Sector<Number> sector = KDRData::GetSectorFromKDSector<Number>(m_Map.m_Sectors[sectorIdx]);
+        oZ += sector.m_Floor;
+        oZ = Clamp(oZ, sector.m_Floor, sector.m_Ceiling);
     }
 
     return oZ;
 }
 
-void KDTreeRenderer::SetPlayerCoordinates(const KDRData::Vertex &iPosition, int iDirection)
+template <typename Number>
+void KDTreeRenderer<Number>::SetPlayerCoordinates(const KDRData::Vertex<CType> &iPosition, int iDirection)
 {
-    m_State.m_PlayerPosition = iPosition;
+    m_State.m_PlayerPosition.m_X = static_cast<Number>(iPosition.m_X);
+    m_State.m_PlayerPosition.m_Y = static_cast<Number>(iPosition.m_Y);
     m_State.m_PlayerDirection = iDirection;
 }
 
-KDRData::Vertex KDTreeRenderer::GetPlayerPosition() const
+template <typename Number>
+KDRData::Vertex<CType> KDTreeRenderer<Number>::GetPlayerPosition() const
 {
-    return m_State.m_PlayerPosition;
+    return {static_cast<CType>(m_State.m_PlayerPosition.m_X), static_cast<CType>(m_State.m_PlayerPosition.m_Y)};
 }
 
-int KDTreeRenderer::GetPlayerDirection() const
+template <typename Number>
+int KDTreeRenderer<Number>::GetPlayerDirection() const
 {
     return m_State.m_PlayerDirection;
 }
 
-KDRData::Vertex KDTreeRenderer::GetLook() const
+template <typename Number>
+KDRData::Vertex<CType> KDTreeRenderer<Number>::GetLook() const
 {
-    return m_State.m_Look;
-}
\ No newline at end of file
+    return {static_cast<CType>(m_State.m_Look.m_X), static_cast<CType>(m_State.m_Look.m_Y)};
+}
+
+template <typename Number>
+void KDTreeRenderer<Number>::SetRenderMode(KDRData::RenderMode iRenderMode)
+{
+    m_RenderMode = iRenderMode;
+}
+
+template <typename Number>
+KDRData::RenderMode KDTreeRenderer<Number>::GetRenderMode() const
+{
+    return m_RenderMode;
+}
+
+template <typename Number>
+const KDRData::FrameStats &KDTreeRenderer<Number>::GetFrameStats() const
+{
+    return m_FrameStats;
+}
+
+// The renderer is instantiated for each KDRData::NumberType
+template class KDTreeRenderer<FP32<14>>;
+template class KDTreeRenderer<FP32<16>>;
+template class KDTreeRenderer<float>;
+template class KDTreeRenderer<double>;
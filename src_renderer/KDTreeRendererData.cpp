@@ -1,8 +1,10 @@
 #include "KDTreeRendererData.h"
 
 #include <cstring>
+#include <algorithm>
 
-KDRData::FlatSurface::FlatSurface()
+template <typename Number>
+KDRData::FlatSurface<Number>::FlatSurface()
 {
     // std::fill(m_MinY.begin(), m_MinY.end(), WINDOW_HEIGHT);
     // std::fill(m_MaxY.begin(), m_MaxY.end(), 0);
@@ -13,7 +15,8 @@ KDRData::FlatSurface::FlatSurface()
     }
 }
 
-KDRData::FlatSurface::FlatSurface(const FlatSurface &iOther) : 
+template <typename Number>
+KDRData::FlatSurface<Number>::FlatSurface(const FlatSurface &iOther) : 
     m_MinX(iOther.m_MinX),
     m_MaxX(iOther.m_MaxX),
     m_Height(iOther.m_Height),
@@ -24,13 +27,14 @@ KDRData::FlatSurface::FlatSurface(const FlatSurface &iOther) :
     memcpy(m_MaxY, iOther.m_MaxY, sizeof(int) * WINDOW_WIDTH);
 }
 
-bool KDRData::FlatSurface::Absorb(const FlatSurface &iOther)
+template <typename Number>
+bool KDRData::FlatSurface<Number>::Absorb(const FlatSurface &iOther)
 {
     if (iOther.m_Height != m_Height || iOther.m_SectorIdx != m_SectorIdx)
         return false;
 
     bool doAbsorb = true;
-    for (unsigned int x = iOther.m_MinX; x <= iOther.m_MaxX; x++)
+    for (int x = std::max(iOther.m_MinX, m_MinX); x <= std::min(iOther.m_MaxX, m_MaxX); x++)
     {
         // There is actual data here, cannot absorb
         if (m_MinY[x] <= m_MaxY[x])
@@ -42,6 +46,18 @@ bool KDRData::FlatSurface::Absorb(const FlatSurface &iOther)
 
     if(doAbsorb)
     {
+        // Columns between both surfaces end up in the merged one's range
+        for (int x = m_MaxX + 1; x < iOther.m_MinX; x++)
+        {
+            m_MinY[x] = WINDOW_HEIGHT;
+            m_MaxY[x] = 0;
+        }
+        for (int x = iOther.m_MaxX + 1; x < m_MinX; x++)
+        {
+            m_MinY[x] = WINDOW_HEIGHT;
+            m_MaxY[x] = 0;
+        }
+
         memcpy(m_MinY + iOther.m_MinX, iOther.m_MinY + iOther.m_MinX, (iOther.m_MaxX - iOther.m_MinX + 1) * sizeof(int));
         memcpy(m_MaxY + iOther.m_MinX, iOther.m_MaxY + iOther.m_MinX, (iOther.m_MaxX - iOther.m_MinX + 1) * sizeof(int));
 
@@ -52,7 +68,8 @@ bool KDRData::FlatSurface::Absorb(const FlatSurface &iOther)
     return doAbsorb;
 }
 
-void KDRData::FlatSurface::Tighten()
+template <typename Number>
+void KDRData::FlatSurface<Number>::Tighten()
 {
     for (unsigned int x = m_MinX; x <= m_MaxX; x++)
     {
@@ -73,46 +90,89 @@ void KDRData::FlatSurface::Tighten()
     }
 }
 
-KDRData::Wall KDRData::GetWallFromNode(KDTreeNode *ipNode, unsigned int iWallIdx)
+template <typename Number>
+KDRData::FlatSurfaceArena<Number>::FlatSurfaceArena() :
+    m_NbAllocated(0u)
 {
-    KDRData::Wall wall;
+}
 
-    if (ipNode)
-    {
-        wall = ipNode->BuildXYScaledWall<KDRData::Wall>(iWallIdx);
-        wall.m_pKDWall = ipNode->GetWall(iWallIdx);
-    }
+template <typename Number>
+KDRData::FlatSurfaceArena<Number>::~FlatSurfaceArena()
+{
+}
 
-    return wall;
+template <typename Number>
+void KDRData::FlatSurfaceArena<Number>::Reserve(uint32_t iNbSurfaces)
+{
+    while (m_Blocks.size() * BLOCK_SIZE < iNbSurfaces)
+        AddBlock();
 }
 
-void KDRData::GetAABBFromNode(KDTreeNode *ipNode, KDRData::Vertex &oAABBMin,  KDRData::Vertex &oAABBMax)
+// There can't be more released handles than surfaces
+template <typename Number>
+void KDRData::FlatSurfaceArena<Number>::AddBlock()
 {
-    if(!ipNode)
-        return;
+    m_Blocks.push_back(std::make_unique<FlatSurface<Number>[]>(BLOCK_SIZE));
+    m_ReleasedHandles.reserve(m_Blocks.size() * BLOCK_SIZE);
+}
 
-    KDMapData::Vertex kdAABBMin, kdAABBMax;
-    ipNode->GetAABB(kdAABBMin, kdAABBMax);
+template <typename Number>
+uint32_t KDRData::FlatSurfaceArena<Number>::Allocate(int iMinX, int iMaxX)
+{
+    uint32_t handle;
+    if (!m_ReleasedHandles.empty())
+    {
+        handle = m_ReleasedHandles.back();
+        m_ReleasedHandles.pop_back();
+    }
+    else
+    {
+        if (m_NbAllocated == m_Blocks.size() * BLOCK_SIZE)
+            AddBlock();
+        handle = m_NbAllocated++;
+    }
+
+    FlatSurface<Number> &surface = Get(handle);
+    surface.m_MinX = iMinX;
+    surface.m_MaxX = iMaxX;
+    for (int x = iMinX; x <= iMaxX; x++)
+    {
+        surface.m_MinY[x] = WINDOW_HEIGHT;
+        surface.m_MaxY[x] = 0;
+    }
 
-    oAABBMin.m_X = CType(kdAABBMin.m_X) / POSITION_SCALE;
-    oAABBMin.m_Y = CType(kdAABBMin.m_Y) / POSITION_SCALE;
+    return handle;
+}
 
-    oAABBMax.m_X = CType(kdAABBMax.m_X) / POSITION_SCALE;
-    oAABBMax.m_Y = CType(kdAABBMax.m_Y) / POSITION_SCALE;
+template <typename Number>
+void KDRData::FlatSurfaceArena<Number>::Release(uint32_t iHandle)
+{
+    if (iHandle + 1u == m_NbAllocated)
+        m_NbAllocated--;
+    else
+        m_ReleasedHandles.push_back(iHandle);
 }
 
-KDRData::Sector KDRData::GetSectorFromKDSector(const KDMapData::Sector &iSector)
+template <typename Number>
+void KDRData::FlatSurfaceArena<Number>::Reset()
 {
-    KDRData::Sector sector;
+    m_NbAllocated = 0u;
+    m_ReleasedHandles.clear();
+}
 
-    sector.m_pKDSector = &iSector;
-    sector.m_Ceiling = CType(iSector.ceiling) / POSITION_SCALE;
-    sector.m_Floor = CType(iSector.floor) / POSITION_SCALE;
+// The renderer is instantiated for each KDRData::NumberType
+template class KDRData::FlatSurface<FP32<14>>;
+template class KDRData::FlatSurface<FP32<16>>;
+template class KDRData::FlatSurface<float>;
+template class KDRData::FlatSurface<double>;
 
-    return sector;
-}
+template class KDRData::FlatSurfaceArena<FP32<14>>;
+template class KDRData::FlatSurfaceArena<FP32<16>>;
+template class KDRData::FlatSurfaceArena<float>;
+template class KDRData::FlatSurfaceArena<double>;
 
-KDRData::HorizontalScreenSegments::HorizontalScreenSegments()
+KDRData::HorizontalScreenSegments::HorizontalScreenSegments() :
+    m_NbRuns(0u)
 {
 }
 
@@ -120,66 +180,70 @@ KDRData::HorizontalScreenSegments::~HorizontalScreenSegments()
 {
 }
 
+unsigned int KDRData::HorizontalScreenSegments::FindRun(unsigned int iX) const
+{
+    return static_cast<unsigned int>(std::lower_bound(m_Ends, m_Ends + m_NbRuns, iX) - m_Ends);
+}
+
 void KDRData::HorizontalScreenSegments::AddScreenSegment(unsigned int iMinX, unsigned int iMaxX)
 {
-    InsertIntervalEnd({iMinX, 1});
-    InsertIntervalEnd({iMaxX, -1});
+    // Runs [first, last[ overlap or touch the new one, they are merged into it
+    unsigned int first = FindRun(iMinX > 0u ? iMinX - 1u : 0u);
+    unsigned int last = first;
+    while (last < m_NbRuns && m_Starts[last] <= iMaxX + 1u)
+        last++;
 
-    // Merge overlapping intervals
-    int stack = 0;
-    int previousDirection = 1;
-    auto it = m_Segments.begin();
-    while(it != m_Segments.end() && stack >= 0) // stack >= should always be true
+    if (first < last)
     {
-        if (it->m_Direction == 1 && previousDirection == 1)
-            stack++;
-        else if(it->m_Direction == -1 && previousDirection == -1)
-            stack--;
-        previousDirection = it->m_Direction;
-
-        if (stack >= 2)
-            it = m_Segments.erase(it);
-        else
-            it++;
+        iMinX = std::min<unsigned int>(iMinX, m_Starts[first]);
+        iMaxX = std::max<unsigned int>(iMaxX, m_Ends[last - 1u]);
     }
 
-    // Merge consecutive intervals
-    it = m_Segments.begin();
-    previousDirection = 1;
-    int previousValue = 0;
-    while (it != m_Segments.end())
+    // Make room for exactly one run in place of [first, last[
+    if (last != first + 1u)
     {
-        bool doMerge = false;
-        if(previousDirection == -1 && previousValue == it->m_X - 1)
-            doMerge = true;
+        unsigned int nbMoved = m_NbRuns - last;
+        memmove(m_Starts + first + 1u, m_Starts + last, nbMoved * sizeof(uint16_t));
+        memmove(m_Ends + first + 1u, m_Ends + last, nbMoved * sizeof(uint16_t));
+        m_NbRuns = m_NbRuns + 1u + first - last;
+    }
 
-        previousValue = it->m_X;
-        previousDirection = it->m_Direction;
+    m_Starts[first] = static_cast<uint16_t>(iMinX);
+    m_Ends[first] = static_cast<uint16_t>(iMaxX);
+}
 
-        if (doMerge)
-            it = m_Segments.erase(it);
-        else
-            it++;
-    }
+bool KDRData::HorizontalScreenSegments::IsScreenEntirelyDrawn() const
+{
+    return m_NbRuns == 1u && m_Starts[0] == 0u && m_Ends[0] == WINDOW_WIDTH - 1;
 }
 
-void KDRData::HorizontalScreenSegments::InsertIntervalEnd(const IntervalEnd &iEnd)
+bool KDRData::HorizontalScreenSegments::IsSegmentEntirelyDrawn(unsigned int iMinX, unsigned int iMaxX) const
 {
-    // Insert in sorted list
-    auto it = m_Segments.begin();
-    while (it != m_Segments.end() && *it < iEnd)
-        it++;
-    m_Segments.insert(it, iEnd);
+    // Runs are sorted and merged, only the first one ending after iMaxX can contain the segment
+    unsigned int run = FindRun(iMaxX);
+    return run < m_NbRuns && m_Starts[run] <= iMinX;
 }
 
-bool KDRData::HorizontalScreenSegments::IsScreenEntirelyDrawn() const
+unsigned int KDRData::HorizontalScreenSegments::NextOpenColumn(unsigned int iMinX, unsigned int iMaxX, unsigned int &oOpenRunEnd) const
 {
-    return m_Segments.size() == 2 && m_Segments.front().m_X == 0 && m_Segments.back().m_X == WINDOW_WIDTH - 1;
+    unsigned int x = iMinX;
+    unsigned int run = FindRun(iMinX);
+    if (run < m_NbRuns && m_Starts[run] <= iMinX)
+        x = m_Ends[run++] + 1u; // Runs are not adjacent, the next column is open
+
+    if (x > iMaxX)
+    {
+        oOpenRunEnd = iMaxX;
+        return iMaxX + 1u;
+    }
+
+    oOpenRunEnd = run < m_NbRuns ? std::min<unsigned int>(m_Starts[run] - 1u, iMaxX) : iMaxX;
+    return x;
 }
 
 void KDRData::HorizontalScreenSegments::Clear()
 {
-    m_Segments.clear();
+    m_NbRuns = 0u;
 }
 
 KDRData::SpriteClippingSegment::SpriteClippingSegment():
@@ -189,4 +253,4 @@ KDRData::SpriteClippingSegment::SpriteClippingSegment():
 
 KDRData::SpriteClippingSegment::~SpriteClippingSegment()
 {
-}
+}
\ No newline at end of file
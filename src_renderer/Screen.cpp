@@ -5,7 +5,7 @@
 
 #include <iostream>
 
-Screen::Screen(const KDTreeRenderer &iRenderer) : 
+Screen::Screen(const KDTreeRendererBase &iRenderer) : 
     m_Renderer(iRenderer)
 {
     const unsigned char *framebuffer = m_Renderer.GetFrameBuffer();
@@ -2,14 +2,15 @@
 #include <algorithm>
 #include <cstring>
 
-WallRenderer::WallRenderer(KDRData::Wall &iWall, const KDRData::State &iState, const KDRData::Settings &iSettings, const KDTreeMap &iMap):
+template <typename Number>
+WallRenderer<Number>::WallRenderer(const KDRData::Wall<Number> &iWall, const KDRData::Vertex<Number> &iCameraFrom, const KDRData::Vertex<Number> &iCameraTo,
+                                   const KDRData::State<Number> &iState, const KDRData::Settings<Number> &iSettings, const KDTreeMap &iMap):
     m_Wall(iWall),
+    m_CameraFrom(iCameraFrom),
+    m_CameraTo(iCameraTo),
     m_State(iState),
     m_Settings(iSettings),
-    m_Map(iMap),
-    m_pTexture(nullptr),
-    m_TexUOffset(0),
-    m_TexVOffset(0)
+    m_Map(iMap)
 {
     // For debug purposes
     if(m_Wall.m_pKDWall->m_TexId == 0)
@@ -30,98 +31,109 @@ WallRenderer::WallRenderer(KDRData::Wall &iWall, const KDRData::State &iState, c
         g = 1; // iWall.m_pKDWall->m_InSector % 3 == 1 ? 1 : 0;
         b = 1; // iWall.m_pKDWall->m_InSector % 3 == 2 ? 1 : 0;
     }
-
-    if(m_Wall.m_pKDWall->m_TexId != -1)
-    {
-        m_pTexture = &m_Map.m_Textures[m_Wall.m_pKDWall->m_TexId];
-        m_TexUOffset = m_Wall.m_pKDWall->m_TexUOffset;
-        m_TexVOffset = m_Wall.m_pKDWall->m_TexVOffset;
-    }
 }
 
-WallRenderer::~WallRenderer()
+template <typename Number>
+WallRenderer<Number>::~WallRenderer()
 {
 
 }
 
-void WallRenderer::SetBuffers(unsigned char *ipFrameBuffer, unsigned char *ipHorizOcclusionBuffer,
-                              KDRData::HorizontalScreenSegments *ipHorizDrawnSegs, int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer)
+template <typename Number>
+void WallRenderer<Number>::SetBuffers(unsigned char *ipFrameBuffer, KDRData::HorizontalScreenSegments *ipHorizDrawnSegs,
+                                      int *ipTopOcclusionBuffer, int *ipBottomOcclusionBuffer,
+                                      KDRData::FlatSurfaceArena<Number> *ipFlatSurfaces)
 {
     m_pFrameBuffer = ipFrameBuffer;
-    m_pHorizOcclusionBuffer = ipHorizOcclusionBuffer;
     m_pHorizDrawnSegs = ipHorizDrawnSegs;
     m_pTopOcclusionBuffer = ipTopOcclusionBuffer;
     m_pBottomOcclusionBuffer = ipBottomOcclusionBuffer;
+    m_pFlatSurfaces = ipFlatSurfaces;
 }
 
-void WallRenderer::Render(std::vector<KDRData::FlatSurface> &oGeneratedFlats)
+template <typename Number>
+void WallRenderer<Number>::Render(std::vector<uint32_t> &oGeneratedFlats)
 {
-    // Clip against frustum
-    m_MinAngle = m_Settings.m_PlayerHorizontalFOV / 2;
-    m_MaxAngle = -m_Settings.m_PlayerHorizontalFOV / 2;
-
-    bool vertexFromInsideFrustum = isInsideFrustum(m_Wall.m_VertexFrom);
-    bool vertexToInsideFrustum = isInsideFrustum(m_Wall.m_VertexTo);
-
-    if (!vertexFromInsideFrustum || !vertexToInsideFrustum)
-    {
-        KDRData::Vertex intersectionVertex;
-        if (HalfLineSegmentIntersection<KDRData::Vertex>(m_State.m_PlayerPosition, m_State.m_FrustumToLeft, m_Wall.m_VertexFrom, m_Wall.m_VertexTo, intersectionVertex))
+    // Clipping, in camera space (m_X is the lateral offset, m_Y the depth, see KDRData::ColumnRays)
+    // The wall is clipped by the near plane and both frustum edges, each of them being a linear function of the
+    // camera space coordinates which must be positive. The clipped part is tracked as a [sFrom, sTo] parameter
+    // range along the wall, so that world space vertices can be rebuilt for texturing
+    const Number edgeSlope = m_Settings.m_ColumnRays.m_EdgeSlope;
+    KDRData::Vertex<Number> from = m_CameraFrom;
+    KDRData::Vertex<Number> to = m_CameraTo;
+    Number sFrom = 0, sTo = 1;
+    bool fromOnEdge = false, toOnEdge = false;
+
+    auto clip = [&](Number iFrom, Number iTo, bool iIsEdge) {
+        if (iFrom < 0 && iTo < 0)
+            return false;
+
+        if (iFrom < 0 || iTo < 0)
         {
-            // Avoid losing precision
-            m_MinVertex = m_Wall.m_VertexFrom;
-            if (m_Wall.m_VertexFrom.m_X == m_Wall.m_VertexTo.m_X)
-                m_MinVertex.m_Y = intersectionVertex.m_Y;
+            Number s = iFrom * MakeRecip(iFrom - iTo);
+            KDRData::Vertex<Number> clipped;
+            clipped.m_X = from.m_X + (to.m_X - from.m_X) * s;
+            clipped.m_Y = from.m_Y + (to.m_Y - from.m_Y) * s;
+            Number sClipped = sFrom + (sTo - sFrom) * s;
+            if (iFrom < 0)
+            {
+                from = clipped;
+                sFrom = sClipped;
+                fromOnEdge = iIsEdge;
+            }
             else
-                m_MinVertex.m_X = intersectionVertex.m_X;
-
-            m_MinAngle = -m_Settings.m_PlayerHorizontalFOV / 2;
+            {
+                to = clipped;
+                sTo = sClipped;
+                toOnEdge = iIsEdge;
+            }
         }
+        return true;
+    };
 
-        if (HalfLineSegmentIntersection<KDRData::Vertex>(m_State.m_PlayerPosition, m_State.m_FrustumToRight, m_Wall.m_VertexFrom, m_Wall.m_VertexTo, intersectionVertex))
-        {
-            m_MaxVertex = m_Wall.m_VertexFrom;
-            // Avoid losing precision
-            if (m_Wall.m_VertexFrom.m_X == m_Wall.m_VertexTo.m_X)
-                m_MaxVertex.m_Y = intersectionVertex.m_Y;
-            else
-                m_MaxVertex.m_X = intersectionVertex.m_X;
+    if (!clip(from.m_Y - m_Settings.m_NearPlane, to.m_Y - m_Settings.m_NearPlane, false) ||
+        !clip(from.m_X + from.m_Y * edgeSlope, to.m_X + to.m_Y * edgeSlope, true) ||
+        !clip(from.m_Y * edgeSlope - from.m_X, to.m_Y * edgeSlope - to.m_X, true))
+        return;
 
-            m_MaxAngle = m_Settings.m_PlayerHorizontalFOV / 2;
-        }
-    }
+    // Vertices clipped by a frustum edge are exactly on it, others need their slope to be computed
+    auto getSlope = [&](const KDRData::Vertex<Number> &iVertex, bool iOnEdge) {
+        if (iOnEdge)
+            return iVertex.m_X < 0 ? -edgeSlope : edgeSlope;
+        return Clamp(iVertex.m_X * MakeRecip(iVertex.m_Y), -edgeSlope, edgeSlope);
+    };
+    Number slopeFrom = getSlope(from, fromOnEdge);
+    Number slopeTo = getSlope(to, toOnEdge);
 
-    auto updateMinMaxAnglesAndVertices = [&](int iAngle, const KDRData::Vertex &iVertex) {
-        if (iAngle < m_MinAngle)
-        {
-            m_MinAngle = iAngle;
-            m_MinVertex = iVertex;
-        }
-        if (iAngle > m_MaxAngle)
-        {
-            m_MaxAngle = iAngle;
-            m_MaxVertex = iVertex;
-        }
+    // World space vertices. Walls are axis aligned, the constant coordinate is kept as is to avoid losing precision
+    auto getWorldVertex = [&](Number iS) {
+        return PointOnXYAlignedSegment(m_Wall.m_VertexFrom, m_Wall.m_VertexTo, iS);
     };
 
-    if (vertexFromInsideFrustum)
+    if (slopeFrom <= slopeTo)
     {
-        int angle = Angle(m_State.m_PlayerPosition, m_State.m_Look, m_Wall.m_VertexFrom);
-        updateMinMaxAnglesAndVertices(angle, m_Wall.m_VertexFrom);
+        m_MinSlope = slopeFrom;
+        m_MaxSlope = slopeTo;
+        m_MinDist = from.m_Y;
+        m_MaxDist = to.m_Y;
+        m_MinVertex = sFrom == 0 ? m_Wall.m_VertexFrom : getWorldVertex(sFrom);
+        m_MaxVertex = sTo == 1 ? m_Wall.m_VertexTo : getWorldVertex(sTo);
     }
-
-    if (vertexToInsideFrustum)
+    else
     {
-        int angle = Angle(m_State.m_PlayerPosition, m_State.m_Look, m_Wall.m_VertexTo);
-        updateMinMaxAnglesAndVertices(angle, m_Wall.m_VertexTo);
+        m_MinSlope = slopeTo;
+        m_MaxSlope = slopeFrom;
+        m_MinDist = to.m_Y;
+        m_MaxDist = from.m_Y;
+        m_MinVertex = sTo == 1 ? m_Wall.m_VertexTo : getWorldVertex(sTo);
+        m_MaxVertex = sFrom == 0 ? m_Wall.m_VertexFrom : getWorldVertex(sFrom);
     }
 
-    // Should always be true
-    if (m_MinAngle <= m_MaxAngle)
-        RenderWall(oGeneratedFlats);
+    RenderWall(oGeneratedFlats);
 }
 
-void WallRenderer::RenderWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats)
+template <typename Number>
+void WallRenderer<Number>::RenderWall(std::vector<uint32_t> &oGeneratedFlats)
 {
     // TODO: there has to be (multiple) way(s) to refactor this harder
 
@@ -138,10 +150,10 @@ void WallRenderer::RenderWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats
     // Horizontal distortion correction
     // int minX = WINDOW_WIDTH / 2 + tanInt(minAngle) / tanInt(m_PlayerHorizontalFOV / 2) * (WINDOW_WIDTH / 2);
     // int maxX = WINDOW_WIDTH / 2 + tanInt(maxAngle) / tanInt(m_PlayerHorizontalFOV / 2) * (WINDOW_WIDTH / 2);
-    
-    // Same as above but with little refacto
-    m_MinX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, tanInt(m_MinAngle) * m_Settings.m_HorizontalDistortionCst);
-    m_maxX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, tanInt(m_MaxAngle) * m_Settings.m_HorizontalDistortionCst);
+
+    // Same as above, the slopes being tanInt(angle)
+    m_MinX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, m_MinSlope * m_Settings.m_HorizontalDistortionCst);
+    m_maxX = WINDOW_WIDTH / 2 + MultiplyIntFpToInt(WINDOW_WIDTH, m_MaxSlope * m_Settings.m_HorizontalDistortionCst);
 
     if (m_MinX >= m_maxX)
         return;
@@ -150,20 +162,22 @@ void WallRenderer::RenderWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats
     m_maxX = Clamp(m_maxX, 0, WINDOW_WIDTH - 1);
 
     // We need further precision for this ratio
-    m_InvMinMaxXRange = m_maxX == m_MinX ? static_cast<CType>(0) : (1 << 7u) / CType(m_maxX - m_MinX);
+    m_InvMinMaxXRange = m_maxX == m_MinX ? static_cast<Number>(0) : (1 << 7u) / Number(m_maxX - m_MinX);
+    // Rounded up, so that the stepped pixels reach the max vertex ones
+    m_InvMinMaxXRangeInt = m_maxX == m_MinX ? 0 : ((int64_t(1) << 32) + m_maxX - m_MinX - 1) / (m_maxX - m_MinX);
 
     // Texture U coordinate range calculation
-    if(m_pTexture)
+    if(m_Wall.m_pTexture)
     {
-        if (m_MinVertex.m_Y == m_MaxVertex.m_Y)
+        if (!m_Wall.m_IsXConst)
         {
-            m_MinTexelX = ((m_MinVertex.m_X + m_TexUOffset) * CType(int(1u << m_pTexture->m_Width)) * CType(POSITION_SCALE)) / CType(TEXEL_SCALE);
-            m_MaxTexelX = ((m_MaxVertex.m_X + m_TexUOffset) * CType(int(1u << m_pTexture->m_Width)) * CType(POSITION_SCALE)) / CType(TEXEL_SCALE);
+            m_MinTexelX = (m_MinVertex.m_X + m_Wall.m_TexUOffset) * m_Wall.m_TexelXScale;
+            m_MaxTexelX = (m_MaxVertex.m_X + m_Wall.m_TexUOffset) * m_Wall.m_TexelXScale;
         }
         else
         {
-            m_MinTexelX = ((m_MinVertex.m_Y + m_TexUOffset) * CType(int(1u << m_pTexture->m_Width)) * CType(POSITION_SCALE)) / CType(TEXEL_SCALE);
-            m_MaxTexelX = ((m_MaxVertex.m_Y + m_TexUOffset) * CType(int(1u << m_pTexture->m_Width)) * CType(POSITION_SCALE)) / CType(TEXEL_SCALE);
+            m_MinTexelX = (m_MinVertex.m_Y + m_Wall.m_TexUOffset) * m_Wall.m_TexelXScale;
+            m_MaxTexelX = (m_MaxVertex.m_Y + m_Wall.m_TexUOffset) * m_Wall.m_TexelXScale;
         }
     }
     else
@@ -173,55 +187,48 @@ void WallRenderer::RenderWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats
         m_MaxTexelX = 1;
     }
 
-    m_MinDist = DistInt(m_State.m_PlayerPosition, m_MinVertex) * cosInt(m_MinAngle); // Correction for vertical distortion
-    m_MaxDist = DistInt(m_State.m_PlayerPosition, m_MaxVertex) * cosInt(m_MaxAngle); // Correction for vertical distortion
-
-    // TODO: perform actual clipping
-    // Dirty hack
-    if (m_MaxDist <= 0 || m_MinDist <= 0)
-        return;
-
-    m_WhichSide = WhichSide(m_Wall.m_VertexFrom, m_Wall.m_VertexTo, m_State.m_PlayerPosition);
-
-    m_InSectorIdx = m_Wall.m_pKDWall->m_InSector;
-    m_InSector = KDRData::GetSectorFromKDSector(m_Map.m_Sectors[m_InSectorIdx]);
+    // m_MinDist and m_MaxDist are depths in camera space, i.e. distance * cos(angle) (correction for vertical distortion)
+    // Both are at least m_Settings.m_NearPlane, clipping took care of it
+    m_MinDistRecip = MakeRecip(m_MinDist);
+    m_MaxDistRecip = MakeRecip(m_MaxDist);
+    m_MinDistInv = Number(1) * m_MinDistRecip;
+    m_MaxDistInv = Number(1) * m_MaxDistRecip;
+    m_MinTexelXOverDist = m_MinTexelX * m_MinDistRecip;
+    m_MaxTexelXOverDist = m_MaxTexelX * m_MaxDistRecip;
 
-    m_OutSectorIdx = m_Wall.m_pKDWall->m_OutSector;
-    m_OutSector = KDRData::GetSectorFromKDSector(m_Map.m_Sectors[m_OutSectorIdx]);
+    m_WhichSide = WhichSideOfXYAlignedSegment(m_Wall.m_VertexFrom, m_Wall.m_VertexTo, m_State.m_PlayerPosition);
 
     unsigned int sectorLightValue = 0u;
-    if(m_OutSectorIdx >= 0 && m_WhichSide < 0)
-        sectorLightValue = m_Map.m_Sectors[m_OutSectorIdx].m_pLight->GetValue();
-    else if(m_InSectorIdx >= 0 && m_WhichSide > 0)
-        sectorLightValue = m_Map.m_Sectors[m_InSectorIdx].m_pLight->GetValue();
+    if(m_Wall.m_OutSectorIdx >= 0 && m_WhichSide < 0)
+        sectorLightValue = m_Wall.m_OutSector.m_pKDSector->m_pLight->GetValue();
+    else if(m_Wall.m_InSectorIdx >= 0 && m_WhichSide > 0)
+        sectorLightValue = m_Wall.m_InSector.m_pKDSector->m_pLight->GetValue();
 
     int maxLightVal = sectorLightValue;
     int minLightVal = LightTools::GetMinLight(maxLightVal);
-    CType maxColorInterpolationDist = LightTools::GetMaxInterpolationDist(maxLightVal);
+    Number maxColorInterpolationDist = LightTools::GetMaxInterpolationDist<Number>(maxLightVal);
+    RecipType<Number> maxColorInterpolationDistRecip = MakeRecip(maxColorInterpolationDist);
 
-    if (m_Wall.m_VertexFrom.m_X == m_Wall.m_VertexTo.m_X)
+    if (m_Wall.m_IsXConst)
     {
         maxLightVal = maxLightVal * 85 / 100;
         minLightVal = minLightVal * 85 / 100;
     }
 
-    m_MinVertexColor = ((maxColorInterpolationDist - m_MinDist) * maxLightVal) / maxColorInterpolationDist;
-    m_MaxVertexColor = ((maxColorInterpolationDist - m_MaxDist) * maxLightVal) / maxColorInterpolationDist;
+    m_MinVertexColor = ((maxColorInterpolationDist - m_MinDist) * maxLightVal) * maxColorInterpolationDistRecip;
+    m_MaxVertexColor = ((maxColorInterpolationDist - m_MaxDist) * maxLightVal) * maxColorInterpolationDistRecip;
     m_MinVertexColor = Clamp(m_MinVertexColor, minLightVal, maxLightVal);
     m_MaxVertexColor = Clamp(m_MaxVertexColor, minLightVal, maxLightVal);
 
-    if(m_pTexture)
-        m_YModShift = m_pTexture->m_Height + FP_SHIFT;
-
-    if (m_OutSectorIdx == -1 && m_WhichSide > 0)
+    if (m_Wall.m_OutSectorIdx == -1 && m_WhichSide > 0)
     {
         RenderHardWall(oGeneratedFlats);
     }
-    else if (m_OutSectorIdx != -1)
+    else if (m_Wall.m_OutSectorIdx != -1)
     {
         // Avoid occlusion failure
-        if ((m_WhichSide > 0 && m_OutSector.m_Ceiling > m_InSector.m_Ceiling) ||
-            (m_WhichSide < 0 && m_OutSector.m_Ceiling < m_InSector.m_Ceiling))
+        if ((m_WhichSide > 0 && m_Wall.m_OutSector.m_Ceiling > m_Wall.m_InSector.m_Ceiling) ||
+            (m_WhichSide < 0 && m_Wall.m_OutSector.m_Ceiling < m_Wall.m_InSector.m_Ceiling))
         {
             RenderSoftWallTop(oGeneratedFlats);
             RenderSoftWallBottom(oGeneratedFlats);
@@ -231,15 +238,70 @@ void WallRenderer::RenderWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats
             RenderSoftWallBottom(oGeneratedFlats);
             RenderSoftWallTop(oGeneratedFlats);
         }
+        CloseFilledColumns();
     }
 }
 
-void WallRenderer::RenderHardWall(std::vector<KDRData::FlatSurface> &oGeneratedFlats)
+// Column loop shared by all wall parts. The part, texturing and visibility are template parameters, so that each
+// instantiation is a tight loop without any per column test on them
+// Surfaces the part doesn't generate are left untouched
+template <typename Number>
+template <WallPart iPart, bool iIsTextured, bool iIsVisible>
+void WallRenderer<Number>::RenderColumns(ColumnStepper<Number> &ioColumns, Number iBottomTexelY, Number iTopTexelY,
+                                         KDRData::FlatSurface<Number> &ioFloorSurface, KDRData::FlatSurface<Number> &ioCeilingSurface,
+                                         bool &ioAddFloorSurface, bool &ioAddCeilingSurface)
 {
-    m_pHorizDrawnSegs->AddScreenSegment(m_MinX, m_maxX);
+    Number t, minTexelY, maxTexelY;
+    int minY, maxY, minYUnclamped, maxYUnclamped;
+    int texelXClamped;
+    // Occluded columns are skipped, the column stepper jumps over them in O(1)
+    int openRunEnd;
+    for (int x = NextVisibleColumn(m_MinX, openRunEnd); x <= m_maxX; x = x < openRunEnd ? x + 1 : NextVisibleColumn(x + 1, openRunEnd))
+    {
+        ComputeRenderParameters<iIsTextured>(x, ioColumns, t, minY, maxY, minYUnclamped, maxYUnclamped);
 
-    CType eyeToTop = m_InSector.m_Ceiling - m_State.m_PlayerZ;
-    CType eyeToBottom = m_State.m_PlayerZ - m_InSector.m_Floor;
+        // Flats end at the wall if it is visible, behind it otherwise
+        if constexpr (iPart != WallPart::SoftTop)
+        {
+            ioFloorSurface.m_MaxY[x] = std::min(iIsVisible ? minYUnclamped : maxYUnclamped, WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x]);
+            ioFloorSurface.m_MinY[x] = m_pBottomOcclusionBuffer[x];
+            ioAddFloorSurface |= ioFloorSurface.m_MinY[x] < ioFloorSurface.m_MaxY[x];
+        }
+        if constexpr (iPart != WallPart::SoftBottom)
+        {
+            ioCeilingSurface.m_MinY[x] = std::max(iIsVisible ? maxYUnclamped : minYUnclamped, m_pBottomOcclusionBuffer[x]);
+            ioCeilingSurface.m_MaxY[x] = WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x];
+            ioAddCeilingSurface |= ioCeilingSurface.m_MinY[x] < ioCeilingSurface.m_MaxY[x];
+        }
+
+        // We need to fill the occlusion buffer even if we don't draw there, since it will be
+        // used for floor and ceiling surfaces
+        if constexpr (iPart == WallPart::SoftTop)
+            m_pTopOcclusionBuffer[x] = std::max(WINDOW_HEIGHT - 1 - minYUnclamped, m_pTopOcclusionBuffer[x]);
+        else if constexpr (iPart == WallPart::SoftBottom)
+            m_pBottomOcclusionBuffer[x] = std::max(m_pBottomOcclusionBuffer[x], maxY);
+
+        if constexpr (iIsVisible)
+        {
+            if (minY <= maxY)
+            {
+                if constexpr (iIsTextured)
+                {
+                    ComputeTextureParameters(ioColumns, minY, maxY, iBottomTexelY, iTopTexelY, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
+                    RenderColumnWithTexture(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, texelXClamped, minTexelY, maxTexelY);
+                }
+                else
+                    RenderColumn(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, r, g, b);
+            }
+        }
+    }
+}
+
+template <typename Number>
+void WallRenderer<Number>::RenderHardWall(std::vector<uint32_t> &oGeneratedFlats)
+{
+    Number eyeToTop = m_Wall.m_InSector.m_Ceiling - m_State.m_PlayerZ;
+    Number eyeToBottom = m_State.m_PlayerZ - m_Wall.m_InSector.m_Floor;
 
     // Same here, need to correct for distortion
     // I'm leaving the old formulas as comments since they are much more intuitive
@@ -250,72 +312,61 @@ void WallRenderer::RenderHardWall(std::vector<KDRData::FlatSurface> &oGeneratedF
     // int maxVertexBottomPixel = ((-atanInt(eyeToBottom / maxDist) + m_PlayerVerticalFOV / 2) * WINDOW_HEIGHT) / m_PlayerVerticalFOV;
     // int maxVertexTopPixel = ((atanInt(eyeToTop / maxDist) + m_PlayerVerticalFOV / 2) * WINDOW_HEIGHT) / m_PlayerVerticalFOV;
 
-    int minVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottom / m_MinDist) * m_Settings.m_VerticalDistortionCst));
-    int minVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTop / m_MinDist) * m_Settings.m_VerticalDistortionCst));
-    int maxVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottom / m_MaxDist) * m_Settings.m_VerticalDistortionCst));
-    int maxVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTop / m_MaxDist) * m_Settings.m_VerticalDistortionCst));
+    int minVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottom * m_MinDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int minVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTop * m_MinDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int maxVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottom * m_MaxDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int maxVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTop * m_MaxDistRecip) * m_Settings.m_VerticalDistortionCst));
 
-    KDRData::FlatSurface floorSurface;
-    floorSurface.m_MinX = m_MinX;
-    floorSurface.m_MaxX = m_maxX;
-    floorSurface.m_SectorIdx = m_InSectorIdx;
-    floorSurface.m_TexId = m_InSector.m_pKDSector->floorTexId;
-    floorSurface.m_Height = m_InSector.m_Floor;
+    uint32_t floorHandle = m_pFlatSurfaces->Allocate(m_MinX, m_maxX);
+    KDRData::FlatSurface<Number> &floorSurface = m_pFlatSurfaces->Get(floorHandle);
+    floorSurface.m_SectorIdx = m_Wall.m_InSectorIdx;
+    floorSurface.m_TexId = m_Wall.m_InSector.m_pKDSector->floorTexId;
+    floorSurface.m_Height = m_Wall.m_InSector.m_Floor;
 
-    KDRData::FlatSurface ceilingSurface(floorSurface);
-    ceilingSurface.m_TexId = m_InSector.m_pKDSector->ceilingTexId;
-    ceilingSurface.m_Height = m_InSector.m_Ceiling;
+    uint32_t ceilingHandle = m_pFlatSurfaces->Allocate(m_MinX, m_maxX);
+    KDRData::FlatSurface<Number> &ceilingSurface = m_pFlatSurfaces->Get(ceilingHandle);
+    ceilingSurface.m_SectorIdx = m_Wall.m_InSectorIdx;
+    ceilingSurface.m_TexId = m_Wall.m_InSector.m_pKDSector->ceilingTexId;
+    ceilingSurface.m_Height = m_Wall.m_InSector.m_Ceiling;
 
     bool addFloorSurface = false;
     bool addCeilingSurface = false;
 
-    CType t, minTexelY, maxTexelY;
-    int minY, maxY, minYUnclamped, maxYUnclamped;
-    int texelXClamped;
-    for (int x = m_MinX; x <= m_maxX; x++)
+    Number bottomTexelY = 0, topTexelY = 0;
+    if (m_Wall.m_pTexture)
     {
-        if (!m_pHorizOcclusionBuffer[x])
-        {
-            // ComputeRenderParameters(x, m_MinX, m_maxX, m_InvMinMaxXRange, minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel, m_InSector.m_Floor, m_InSector.m_Ceiling, t, minY, maxY, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
-            ComputeRenderParameters(x, m_MinX, m_maxX, m_InvMinMaxXRange, minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel, t, minY, maxY, minYUnclamped, maxYUnclamped);
-
-            floorSurface.m_MaxY[x] = std::min(minYUnclamped, WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x]);
-            floorSurface.m_MinY[x] = m_pBottomOcclusionBuffer[x];
-            if (!addFloorSurface && floorSurface.m_MinY[x] < floorSurface.m_MaxY[x])
-                addFloorSurface = true;
+        bottomTexelY = (m_Wall.m_InSector.m_Floor + m_Wall.m_TexVOffset) * m_Wall.m_TexelYScale;
+        topTexelY = (m_Wall.m_InSector.m_Ceiling + m_Wall.m_TexVOffset) * m_Wall.m_TexelYScale;
+    }
 
-            ceilingSurface.m_MinY[x] = std::max(maxYUnclamped, m_pBottomOcclusionBuffer[x]);
-            ceilingSurface.m_MaxY[x] = WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x];
-            if (!addCeilingSurface && ceilingSurface.m_MinY[x] < ceilingSurface.m_MaxY[x])
-                addCeilingSurface = true;
+    ColumnStepper<Number> columns = MakeColumnStepper(minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel);
+    if (m_Wall.m_pTexture)
+        RenderColumns<WallPart::Hard, true, true>(columns, bottomTexelY, topTexelY, floorSurface, ceilingSurface, addFloorSurface, addCeilingSurface);
+    else
+        RenderColumns<WallPart::Hard, false, true>(columns, bottomTexelY, topTexelY, floorSurface, ceilingSurface, addFloorSurface, addCeilingSurface);
 
-            if (minY <= maxY)
-            {
-                if(m_pTexture)
-                {
-                    ComputeTextureParameters(t, minY, maxY, m_InSector.m_Floor, m_InSector.m_Ceiling, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
-                    RenderColumnWithTexture(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, texelXClamped, minTexelY, maxTexelY);
-                }
-                else
-                    RenderColumn(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, r, g, b);
-            }
-        }
-    }
     // Nothing will be drawn behind this wall
-    memset(m_pHorizOcclusionBuffer + m_MinX, 1u, m_maxX - m_MinX + 1);
+    m_pHorizDrawnSegs->AddScreenSegment(m_MinX, m_maxX);
 
     if (addFloorSurface)
-        oGeneratedFlats.push_back(floorSurface);
+        oGeneratedFlats.push_back(floorHandle);
     if (addCeilingSurface)
-        oGeneratedFlats.push_back(ceilingSurface);
+        oGeneratedFlats.push_back(ceilingHandle);
+
+    // Last allocated first, so that the arena just shrinks back when both are empty
+    if (!addCeilingSurface)
+        m_pFlatSurfaces->Release(ceilingHandle);
+    if (!addFloorSurface)
+        m_pFlatSurfaces->Release(floorHandle);
 }
 
-void WallRenderer::RenderSoftWallTop(std::vector<KDRData::FlatSurface> &oGeneratedFlats)
+template <typename Number>
+void WallRenderer<Number>::RenderSoftWallTop(std::vector<uint32_t> &oGeneratedFlats)
 {
-    CType topCeiling = std::max(m_InSector.m_Ceiling, m_OutSector.m_Ceiling);
-    CType bottomCeiling = std::min(m_InSector.m_Ceiling, m_OutSector.m_Ceiling);
-    CType eyeToTopCeiling = topCeiling - m_State.m_PlayerZ;
-    CType eyeToBottomCeiling = bottomCeiling - m_State.m_PlayerZ;
+    Number topCeiling = std::max(m_Wall.m_InSector.m_Ceiling, m_Wall.m_OutSector.m_Ceiling);
+    Number bottomCeiling = std::min(m_Wall.m_InSector.m_Ceiling, m_Wall.m_OutSector.m_Ceiling);
+    Number eyeToTopCeiling = topCeiling - m_State.m_PlayerZ;
+    Number eyeToBottomCeiling = bottomCeiling - m_State.m_PlayerZ;
 
     // Same here, need to correct for distortion
     // I'm leaving the old formulas as comments since they are much more intuitive
@@ -325,68 +376,51 @@ void WallRenderer::RenderSoftWallTop(std::vector<KDRData::FlatSurface> &oGenerat
     // int maxVertexBottomPixel = ((atanInt(eyeToBottomCeiling / maxDist) + m_PlayerVerticalFOV / 2) * WINDOW_HEIGHT) / m_PlayerVerticalFOV;
     // int maxVertexTopPixel = ((atanInt(eyeToTopCeiling / maxDist) + m_PlayerVerticalFOV / 2) * WINDOW_HEIGHT) / m_PlayerVerticalFOV;
 
-    int minVertexBottomPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomCeiling / m_MinDist) * m_Settings.m_VerticalDistortionCst));
-    int minVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopCeiling / m_MinDist) * m_Settings.m_VerticalDistortionCst));
-    int maxVertexBottomPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomCeiling / m_MaxDist) * m_Settings.m_VerticalDistortionCst));
-    int maxVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopCeiling / m_MaxDist) * m_Settings.m_VerticalDistortionCst));
+    int minVertexBottomPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomCeiling * m_MinDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int minVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopCeiling * m_MinDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int maxVertexBottomPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomCeiling * m_MaxDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int maxVertexTopPixel = WINDOW_HEIGHT / 2 + MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopCeiling * m_MaxDistRecip) * m_Settings.m_VerticalDistortionCst));
 
-    KDRData::FlatSurface ceilingSurface;
-    ceilingSurface.m_MinX = m_MinX;
-    ceilingSurface.m_MaxX = m_maxX;
-    ceilingSurface.m_SectorIdx = m_WhichSide > 0 ? m_InSectorIdx : m_OutSectorIdx;
-    ceilingSurface.m_TexId = m_WhichSide > 0 ? m_InSector.m_pKDSector->ceilingTexId : m_OutSector.m_pKDSector->ceilingTexId;
-    ceilingSurface.m_Height = m_WhichSide > 0 ? m_InSector.m_Ceiling : m_OutSector.m_Ceiling;
+    uint32_t ceilingHandle = m_pFlatSurfaces->Allocate(m_MinX, m_maxX);
+    KDRData::FlatSurface<Number> &ceilingSurface = m_pFlatSurfaces->Get(ceilingHandle);
+    ceilingSurface.m_SectorIdx = m_WhichSide > 0 ? m_Wall.m_InSectorIdx : m_Wall.m_OutSectorIdx;
+    ceilingSurface.m_TexId = m_WhichSide > 0 ? m_Wall.m_InSector.m_pKDSector->ceilingTexId : m_Wall.m_OutSector.m_pKDSector->ceilingTexId;
+    ceilingSurface.m_Height = m_WhichSide > 0 ? m_Wall.m_InSector.m_Ceiling : m_Wall.m_OutSector.m_Ceiling;
 
-    bool wallIsVisible = (m_WhichSide > 0 && m_InSector.m_Ceiling > m_OutSector.m_Ceiling) ||
-                         (m_WhichSide < 0 && m_OutSector.m_Ceiling > m_InSector.m_Ceiling);
+    bool wallIsVisible = (m_WhichSide > 0 && m_Wall.m_InSector.m_Ceiling > m_Wall.m_OutSector.m_Ceiling) ||
+                         (m_WhichSide < 0 && m_Wall.m_OutSector.m_Ceiling > m_Wall.m_InSector.m_Ceiling);
 
     bool addCeilingSurface = false;
 
-    CType t, minTexelY, maxTexelY;
-    int minY, maxY, minYUnclamped, maxYUnclamped;
-    int texelXClamped;
-    for (unsigned int x = m_MinX; x <= m_maxX; x++)
+    Number bottomTexelY = 0, topTexelY = 0;
+    if (m_Wall.m_pTexture)
     {
-        if (!m_pHorizOcclusionBuffer[x])
-        {
-            // ComputeRenderParameters(x, m_MinX, m_maxX, m_InvMinMaxXRange, minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel, bottomCeiling, topCeiling, t, minY, maxY, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
-            ComputeRenderParameters(x, m_MinX, m_maxX, m_InvMinMaxXRange, minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel, t, minY, maxY, minYUnclamped, maxYUnclamped);
-
-            if (wallIsVisible)
-                ceilingSurface.m_MinY[x] = std::max(maxYUnclamped, m_pBottomOcclusionBuffer[x]);
-            else
-                ceilingSurface.m_MinY[x] = std::max(minYUnclamped, m_pBottomOcclusionBuffer[x]);
-            ceilingSurface.m_MaxY[x] = WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x];
-
-            if (!addCeilingSurface && ceilingSurface.m_MinY[x] < ceilingSurface.m_MaxY[x])
-                addCeilingSurface = true;
-
-            // We need to fill the occlusion buffer even if we don't draw there, since it will be
-            // used for floor and ceiling surfaces
-            m_pTopOcclusionBuffer[x] = std::max(WINDOW_HEIGHT - 1 - minYUnclamped, m_pTopOcclusionBuffer[x]);
-            if (minY <= maxY && wallIsVisible)
-            {
-                if (m_pTexture)
-                {
-                    ComputeTextureParameters(t, minY, maxY, bottomCeiling, topCeiling, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
-                    RenderColumnWithTexture(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, texelXClamped, minTexelY, maxTexelY);
-                }
-                else
-                    RenderColumn(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, r, g, b);
-            }
-        }
+        bottomTexelY = (bottomCeiling + m_Wall.m_TexVOffset) * m_Wall.m_TexelYScale;
+        topTexelY = (topCeiling + m_Wall.m_TexVOffset) * m_Wall.m_TexelYScale;
     }
 
+    // Soft walls don't get a floor surface
+    ColumnStepper<Number> columns = MakeColumnStepper(minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel);
+    if (!wallIsVisible)
+        RenderColumns<WallPart::SoftTop, false, false>(columns, bottomTexelY, topTexelY, ceilingSurface, ceilingSurface, addCeilingSurface, addCeilingSurface);
+    else if (m_Wall.m_pTexture)
+        RenderColumns<WallPart::SoftTop, true, true>(columns, bottomTexelY, topTexelY, ceilingSurface, ceilingSurface, addCeilingSurface, addCeilingSurface);
+    else
+        RenderColumns<WallPart::SoftTop, false, true>(columns, bottomTexelY, topTexelY, ceilingSurface, ceilingSurface, addCeilingSurface, addCeilingSurface);
+
     if (addCeilingSurface)
-        oGeneratedFlats.push_back(ceilingSurface);
+        oGeneratedFlats.push_back(ceilingHandle);
+    else
+        m_pFlatSurfaces->Release(ceilingHandle);
 }
 
-void WallRenderer::RenderSoftWallBottom(std::vector<KDRData::FlatSurface> &oGeneratedFlats)
+template <typename Number>
+void WallRenderer<Number>::RenderSoftWallBottom(std::vector<uint32_t> &oGeneratedFlats)
 {
-    CType topFloor = std::max(m_InSector.m_Floor, m_OutSector.m_Floor);
-    CType bottomFloor = std::min(m_InSector.m_Floor, m_OutSector.m_Floor);
-    CType eyeToTopFloor = m_State.m_PlayerZ - topFloor;
-    CType eyeToBottomFloor = m_State.m_PlayerZ - bottomFloor;
+    Number topFloor = std::max(m_Wall.m_InSector.m_Floor, m_Wall.m_OutSector.m_Floor);
+    Number bottomFloor = std::min(m_Wall.m_InSector.m_Floor, m_Wall.m_OutSector.m_Floor);
+    Number eyeToTopFloor = m_State.m_PlayerZ - topFloor;
+    Number eyeToBottomFloor = m_State.m_PlayerZ - bottomFloor;
 
     // Same here, need to correct for distortion
     // I'm leaving the old formulas as comments since they are much more intuitive
@@ -397,63 +431,67 @@ void WallRenderer::RenderSoftWallBottom(std::vector<KDRData::FlatSurface> &oGene
     // int maxVertexBottomPixel = ((-atanInt(eyeToBottomFloor / maxDist) + m_PlayerVerticalFOV / 2) * WINDOW_HEIGHT) / m_PlayerVerticalFOV;
     // int maxVertexTopPixel = ((-atanInt(eyeToTopFloor / maxDist) + m_PlayerVerticalFOV / 2) * WINDOW_HEIGHT) / m_PlayerVerticalFOV;
 
-    int minVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomFloor / m_MinDist) * m_Settings.m_VerticalDistortionCst));
-    int minVertexTopPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopFloor / m_MinDist) * m_Settings.m_VerticalDistortionCst));
-    int maxVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomFloor / m_MaxDist) * m_Settings.m_VerticalDistortionCst));
-    int maxVertexTopPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopFloor / m_MaxDist) * m_Settings.m_VerticalDistortionCst));
+    int minVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomFloor * m_MinDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int minVertexTopPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopFloor * m_MinDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int maxVertexBottomPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToBottomFloor * m_MaxDistRecip) * m_Settings.m_VerticalDistortionCst));
+    int maxVertexTopPixel = WINDOW_HEIGHT / 2 - MultiplyIntFpToInt(WINDOW_HEIGHT, ((eyeToTopFloor * m_MaxDistRecip) * m_Settings.m_VerticalDistortionCst));
 
-    KDRData::FlatSurface floorSurface;
-    floorSurface.m_MinX = m_MinX;
-    floorSurface.m_MaxX = m_maxX;
-    floorSurface.m_SectorIdx = m_WhichSide > 0 ? m_InSectorIdx : m_OutSectorIdx;
-    floorSurface.m_TexId = m_WhichSide > 0 ? m_InSector.m_pKDSector->floorTexId : m_OutSector.m_pKDSector->floorTexId;
-    floorSurface.m_Height = m_WhichSide > 0 ? m_InSector.m_Floor : m_OutSector.m_Floor;
+    uint32_t floorHandle = m_pFlatSurfaces->Allocate(m_MinX, m_maxX);
+    KDRData::FlatSurface<Number> &floorSurface = m_pFlatSurfaces->Get(floorHandle);
+    floorSurface.m_SectorIdx = m_WhichSide > 0 ? m_Wall.m_InSectorIdx : m_Wall.m_OutSectorIdx;
+    floorSurface.m_TexId = m_WhichSide > 0 ? m_Wall.m_InSector.m_pKDSector->floorTexId : m_Wall.m_OutSector.m_pKDSector->floorTexId;
+    floorSurface.m_Height = m_WhichSide > 0 ? m_Wall.m_InSector.m_Floor : m_Wall.m_OutSector.m_Floor;
 
-    bool wallIsVisible = (m_WhichSide > 0 && m_InSector.m_Floor < m_OutSector.m_Floor) ||
-                         (m_WhichSide < 0 && m_OutSector.m_Floor < m_InSector.m_Floor);
+    bool wallIsVisible = (m_WhichSide > 0 && m_Wall.m_InSector.m_Floor < m_Wall.m_OutSector.m_Floor) ||
+                         (m_WhichSide < 0 && m_Wall.m_OutSector.m_Floor < m_Wall.m_InSector.m_Floor);
     bool addFloorSurface = false;
 
-    CType t, minTexelY, maxTexelY;
-    int minY, maxY, minYUnclamped, maxYUnclamped;
-    int texelXClamped;
-    for (unsigned int x = m_MinX; x <= m_maxX; x++)
+    Number bottomTexelY = 0, topTexelY = 0;
+    if (m_Wall.m_pTexture)
     {
-        if (!m_pHorizOcclusionBuffer[x])
-        {
-            // ComputeRenderParameters(x, m_MinX, m_maxX, m_InvMinMaxXRange, minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel, bottomFloor, topFloor, t, minY, maxY, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
-            ComputeRenderParameters(x, m_MinX, m_maxX, m_InvMinMaxXRange, minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel, t, minY, maxY, minYUnclamped, maxYUnclamped);
+        bottomTexelY = (bottomFloor + m_Wall.m_TexVOffset) * m_Wall.m_TexelYScale;
+        topTexelY = (topFloor + m_Wall.m_TexVOffset) * m_Wall.m_TexelYScale;
+    }
 
-            if (wallIsVisible)
-                floorSurface.m_MaxY[x] = std::min(minYUnclamped, WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x]);
-            else
-                floorSurface.m_MaxY[x] = std::min(maxYUnclamped, WINDOW_HEIGHT - 1 - m_pTopOcclusionBuffer[x]);
-            floorSurface.m_MinY[x] = m_pBottomOcclusionBuffer[x];
+    ColumnStepper<Number> columns = MakeColumnStepper(minVertexBottomPixel, maxVertexBottomPixel, minVertexTopPixel, maxVertexTopPixel);
+    if (!wallIsVisible)
+        RenderColumns<WallPart::SoftBottom, false, false>(columns, bottomTexelY, topTexelY, floorSurface, floorSurface, addFloorSurface, addFloorSurface);
+    else if (m_Wall.m_pTexture)
+        RenderColumns<WallPart::SoftBottom, true, true>(columns, bottomTexelY, topTexelY, floorSurface, floorSurface, addFloorSurface, addFloorSurface);
+    else
+        RenderColumns<WallPart::SoftBottom, false, true>(columns, bottomTexelY, topTexelY, floorSurface, floorSurface, addFloorSurface, addFloorSurface);
 
-            if (!addFloorSurface && floorSurface.m_MinY[x] < floorSurface.m_MaxY[x])
-                addFloorSurface = true;
+    if (addFloorSurface)
+        oGeneratedFlats.push_back(floorHandle);
+    else
+        m_pFlatSurfaces->Release(floorHandle);
+}
 
-            // We need to fill the occlusion buffer even if we don't draw there, since it will be
-            // used for floor and ceiling surfaces
-            m_pBottomOcclusionBuffer[x] = std::max(m_pBottomOcclusionBuffer[x], maxY);
-            if (minY <= maxY && wallIsVisible)
-            {
-                if (m_pTexture)
-                {
-                    ComputeTextureParameters(t, minY, maxY, bottomFloor, topFloor, minYUnclamped, maxYUnclamped, texelXClamped, minTexelY, maxTexelY);
-                    RenderColumnWithTexture(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, texelXClamped, minTexelY, maxTexelY);
-                }
-                else
-                    RenderColumn(t, m_MinVertexColor, m_MaxVertexColor, minY, maxY, x, r, g, b);
-            }
+// Columns where the occlusion buffers now cover the whole height are closed, as if behind a hard wall: nothing will be
+// drawn there anymore, and nodes and walls behind them get occlusion culled
+// Runs of filled columns are closed as they end, they may span columns closed earlier
+template <typename Number>
+void WallRenderer<Number>::CloseFilledColumns()
+{
+    int runMinX = -1;
+    int openRunEnd;
+    for (int x = NextVisibleColumn(m_MinX, openRunEnd); x <= m_maxX; x = x < openRunEnd ? x + 1 : NextVisibleColumn(x + 1, openRunEnd))
+    {
+        bool isFilled = m_pBottomOcclusionBuffer[x] + m_pTopOcclusionBuffer[x] >= WINDOW_HEIGHT;
+        if (isFilled && runMinX < 0)
+            runMinX = x;
+        else if (!isFilled && runMinX >= 0)
+        {
+            m_pHorizDrawnSegs->AddScreenSegment(runMinX, x - 1);
+            runMinX = -1;
         }
     }
-
-    if (addFloorSurface)
-        oGeneratedFlats.push_back(floorSurface);
+    if (runMinX >= 0)
+        m_pHorizDrawnSegs->AddScreenSegment(runMinX, m_maxX);
 }
 
-bool WallRenderer::isInsideFrustum(const KDRData::Vertex &iVertex) const
-{
-    return (WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToLeft, iVertex) >= 0) &&
-           (WhichSide(m_State.m_PlayerPosition, m_State.m_FrustumToRight, iVertex) <= 0);
-}
\ No newline at end of file
+// The renderer is instantiated for each KDRData::NumberType
+template class WallRenderer<FP32<14>>;
+template class WallRenderer<FP32<16>>;
+template class WallRenderer<float>;
+template class WallRenderer<double>;
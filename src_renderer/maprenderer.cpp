@@ -25,11 +25,73 @@
 #include <fstream>
 #include <thread>
 
+// Counts hardware cache misses while rendering, through Linux perf events (for profiling purposes)
+// #define MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+
+#ifdef MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
 namespace {
 	const std::string APPLICATION_NAME = "KDTree Map Renderer";
 #ifdef __EXPERIMENGINE__
 	const uint32_t APPLICATION_VERSION = EXPENGINE_MAKE_VERSION(0, 0, 1);
 #endif
+
+#ifdef MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+	class CacheMissCounter
+	{
+	public:
+		CacheMissCounter()
+		{
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			m_Fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			if (m_Fd < 0)
+				std::cout << "Warning: cache misses can't be counted (no hardware counters available?)" << std::endl;
+		}
+
+		~CacheMissCounter()
+		{
+			if (m_Fd >= 0)
+				close(m_Fd);
+		}
+
+		void Start()
+		{
+			if (m_Fd >= 0)
+				ioctl(m_Fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+
+		void Stop()
+		{
+			if (m_Fd >= 0)
+				ioctl(m_Fd, PERF_EVENT_IOC_DISABLE, 0);
+		}
+
+		// Total over all the Start/Stop periods
+		uint64_t GetCount() const
+		{
+			uint64_t count = 0;
+			if (m_Fd < 0 || read(m_Fd, &count, sizeof(count)) != sizeof(count))
+				return 0;
+			return count;
+		}
+
+	private:
+		int m_Fd;
+	};
+#endif
 }
 
 class MapRenderer {
@@ -44,11 +106,14 @@ public:
 
 private:
 	KDTreeMap m_Map;
-	std::unique_ptr<KDTreeRenderer> m_Renderer = nullptr;
+	std::unique_ptr<KDTreeRendererBase> m_Renderer = nullptr;
 	std::unique_ptr<Screen> m_Screen = nullptr;
-	KDRData::Vertex m_PlayerPos;
+	KDRData::Vertex<CType> m_PlayerPos;
 	int m_playerDir = 0;
 	int64_t m_FrameCount = 0;
+#ifdef MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+	CacheMissCounter m_CacheMissCounter;
+#endif
 
 #ifdef __EXPERIMENGINE__
 	std::unique_ptr<experim::Engine> m_Engine;
@@ -67,9 +132,27 @@ int main(int argc, char** argv)
 
 int MapRenderer::run(int argc, char** argv)
 {
-	if (argc != 3)
+	KDRData::NumberType numberType = KDRData::NumberType::FP32_14;
+	if (argc == 5)
 	{
-		std::cout << "Usage : maprenderer -i path/to/map.kdm" << std::endl;
+		std::string numberTypeStr(argv[4]);
+		if (std::string(argv[3]) != "-n")
+			argc = 0; // Print usage
+		else if (numberTypeStr == "fp14")
+			numberType = KDRData::NumberType::FP32_14;
+		else if (numberTypeStr == "fp16")
+			numberType = KDRData::NumberType::FP32_16;
+		else if (numberTypeStr == "float")
+			numberType = KDRData::NumberType::FLOAT;
+		else if (numberTypeStr == "double")
+			numberType = KDRData::NumberType::DOUBLE;
+		else
+			argc = 0; // Print usage
+	}
+
+	if (argc != 3 && argc != 5)
+	{
+		std::cout << "Usage : maprenderer -i path/to/map.kdm [-n fp14|fp16|float|double]" << std::endl;
 		return EXIT_FAILURE;
 	}
 	else
@@ -97,7 +180,7 @@ int MapRenderer::run(int argc, char** argv)
 		}
 	}
 
-	m_Renderer = std::make_unique<KDTreeRenderer>(m_Map);
+	m_Renderer = CreateKDTreeRenderer(m_Map, numberType);
 	m_Screen = std::make_unique<Screen>(*m_Renderer);
 
 	m_PlayerPos.m_X = m_Map.GetPlayerStartX();
@@ -158,6 +241,11 @@ int MapRenderer::run(int argc, char** argv)
 	double averageFps = static_cast<double>(m_FrameCount) / totalElapsedMs * 1000.0;
 	std::cout << "Average FPS = " << averageFps << std::endl;
 
+#ifdef MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+	if (m_FrameCount)
+		std::cout << "Average cache misses per frame = " << m_CacheMissCounter.GetCount() / m_FrameCount << std::endl;
+#endif
+
 	return EXIT_SUCCESS;
 }
 
@@ -172,6 +260,12 @@ void MapRenderer::onEvent(SDL_Event event)
 			m_playerDir,
 			static_cast<float>(m_playerDir) / (1 << ANGLE_SHIFT));
 	}
+	if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_p)
+	{
+		bool usePortals = m_Renderer->GetRenderMode() == KDRData::RenderMode::KDTree;
+		m_Renderer->SetRenderMode(usePortals ? KDRData::RenderMode::Portals : KDRData::RenderMode::KDTree);
+		SPDLOG_INFO("Render mode : {}", usePortals ? "portals" : "KD tree");
+	}
 }
 #endif
 
@@ -288,6 +382,12 @@ void MapRenderer::onTick(float deltaT)
 					std::cout << "y = " << m_PlayerPos.m_Y * POSITION_SCALE << std::endl;
 					std::cout << "dir = " << m_playerDir << " (= " << static_cast<float>(m_playerDir) / (1 << ANGLE_SHIFT) << " degres)" << std::endl;
 				}
+				if (sf::Keyboard::isKeyPressed(sf::Keyboard::P))
+				{
+					bool usePortals = m_Renderer->GetRenderMode() == KDRData::RenderMode::KDTree;
+					m_Renderer->SetRenderMode(usePortals ? KDRData::RenderMode::Portals : KDRData::RenderMode::KDTree);
+					std::cout << "Render mode: " << (usePortals ? "portals" : "KD tree") << std::endl;
+				}
 				break;
 			default:
 				break;
@@ -303,7 +403,7 @@ void MapRenderer::onTick(float deltaT)
 	dPos = dPos / (slowDown + 1);
 	dDir = dDir / (slowDown + 1);
 
-	KDRData::Vertex look(m_Renderer->GetLook());
+	KDRData::Vertex<CType> look(m_Renderer->GetLook());
 
 	CType dx = dPos * (look.m_X - m_PlayerPos.m_X);
 	CType dy = dPos * (look.m_Y - m_PlayerPos.m_Y);
@@ -319,8 +419,16 @@ void MapRenderer::onTick(float deltaT)
 
 	m_Renderer->SetPlayerCoordinates(m_PlayerPos, m_playerDir);
 
+#ifdef MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+	m_CacheMissCounter.Start();
+#endif
+
 	m_Renderer->ClearBuffers();
 	m_Renderer->RefreshFrameBuffer();
 
+#ifdef MAPRENDERER_CACHE_MISS_COUNTER_ENABLED
+	m_CacheMissCounter.Stop();
+#endif
+
 	m_FrameCount++;
 }
@@ -0,0 +1,147 @@
+// Steady-state frames don't allocate: once a renderer went through a set of views, going through them again must
+// not allocate anything, for all the number types and render modes, on the maps given as arguments (.kdm)
+// Global operator new is replaced by a counting one
+
+#include "KDTreeMap.h"
+#include "KDTreeRenderer.h"
+#include "GeomUtils.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+
+namespace
+{
+    const unsigned int NB_VIEWS = 200u;
+
+    bool g_CountAllocations = false;
+    unsigned long g_NbAllocations = 0u;
+
+    void *CountedAlloc(std::size_t iSize, std::size_t iAlignment)
+    {
+        if (g_CountAllocations)
+            g_NbAllocations++;
+
+        // aligned_alloc wants a multiple of the alignment
+        std::size_t size = iSize ? iSize : 1u;
+        void *p = iAlignment ? std::aligned_alloc(iAlignment, (size + iAlignment - 1u) / iAlignment * iAlignment) : std::malloc(size);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+}
+
+void *operator new(std::size_t iSize) { return CountedAlloc(iSize, 0u); }
+void *operator new[](std::size_t iSize) { return CountedAlloc(iSize, 0u); }
+void *operator new(std::size_t iSize, std::align_val_t iAlignment) { return CountedAlloc(iSize, static_cast<std::size_t>(iAlignment)); }
+void *operator new[](std::size_t iSize, std::align_val_t iAlignment) { return CountedAlloc(iSize, static_cast<std::size_t>(iAlignment)); }
+void operator delete(void *ipData) noexcept { std::free(ipData); }
+void operator delete[](void *ipData) noexcept { std::free(ipData); }
+void operator delete(void *ipData, std::size_t) noexcept { std::free(ipData); }
+void operator delete[](void *ipData, std::size_t) noexcept { std::free(ipData); }
+void operator delete(void *ipData, std::align_val_t) noexcept { std::free(ipData); }
+void operator delete[](void *ipData, std::align_val_t) noexcept { std::free(ipData); }
+void operator delete(void *ipData, std::size_t, std::align_val_t) noexcept { std::free(ipData); }
+void operator delete[](void *ipData, std::size_t, std::align_val_t) noexcept { std::free(ipData); }
+
+namespace
+{
+    bool LoadMap(const char *iPath, KDTreeMap &oMap)
+    {
+        std::ifstream mapStream(iPath, std::ios::binary | std::ios::in);
+        if (!mapStream.is_open())
+            return false;
+
+        mapStream.seekg(0, mapStream.end);
+        std::vector<char> data(static_cast<size_t>(mapStream.tellg()));
+        mapStream.seekg(0, mapStream.beg);
+        mapStream.read(data.data(), data.size());
+
+        unsigned int nbBytesRead;
+        oMap.UnStream(data.data(), nbBytesRead);
+        return true;
+    }
+
+    // Anywhere around the map, inside of a sector or not
+    std::vector<std::pair<KDRData::Vertex<CType>, int>> PickViews(const KDTreeMap &iMap)
+    {
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views;
+        if (!iMap.GetNbOfNodes())
+            return views;
+
+        const KDTreeFlatNode &root = iMap.GetNode(0u);
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> xDist(root.m_AABBMin.m_X - 100, root.m_AABBMax.m_X + 100);
+        std::uniform_real_distribution<float> yDist(root.m_AABBMin.m_Y - 100, root.m_AABBMax.m_Y + 100);
+        std::uniform_int_distribution<int> directionDist(0, ANGLE_FULL - 1);
+        for (unsigned int i = 0; i < NB_VIEWS; i++)
+        {
+            KDRData::Vertex<CType> position;
+            position.m_X = CType(xDist(rng) / POSITION_SCALE);
+            position.m_Y = CType(yDist(rng) / POSITION_SCALE);
+            views.push_back({position, directionDist(rng)});
+        }
+        return views;
+    }
+
+    bool CheckMap(const char *iPath)
+    {
+        KDTreeMap map;
+        if (!LoadMap(iPath, map))
+        {
+            std::cout << "Error: could not open " << iPath << std::endl;
+            return false;
+        }
+
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views = PickViews(map);
+
+        bool success = true;
+        for (KDRData::NumberType numberType : {KDRData::NumberType::FP32_14, KDRData::NumberType::FP32_16, KDRData::NumberType::FLOAT, KDRData::NumberType::DOUBLE})
+        {
+            for (KDRData::RenderMode renderMode : {KDRData::RenderMode::KDTree, KDRData::RenderMode::Portals})
+            {
+                std::unique_ptr<KDTreeRendererBase> renderer = CreateKDTreeRenderer(map, numberType);
+                renderer->SetRenderMode(renderMode);
+
+                // Each view is rendered from scratch, then reused, then rendered from scratch again
+                // The first pass lets the flat surfaces grow to what these views need, only the second one is counted
+                g_NbAllocations = 0u;
+                for (unsigned int pass = 0; pass < 2; pass++)
+                {
+                    g_CountAllocations = pass == 1;
+                    for (const std::pair<KDRData::Vertex<CType>, int> &view : views)
+                    {
+                        renderer->SetPlayerCoordinates(view.first, view.second);
+                        renderer->ClearBuffers();
+                        renderer->RefreshFrameBuffer();
+
+                        renderer->ClearBuffers();
+                        renderer->RefreshFrameBuffer();
+
+                        renderer->InvalidateFrame();
+                        renderer->ClearBuffers();
+                        renderer->RefreshFrameBuffer();
+                    }
+                }
+                g_CountAllocations = false;
+
+                std::cout << iPath << ", number type " << static_cast<int>(numberType) << ", render mode " << static_cast<int>(renderMode) << ": "
+                          << g_NbAllocations << " allocations over " << 3u * views.size() << " frames" << std::endl;
+                success = success && !g_NbAllocations;
+            }
+        }
+        return success;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool success = true;
+    for (int i = 1; i < argc; i++)
+        success = CheckMap(argv[i]) && success;
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
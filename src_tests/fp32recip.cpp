@@ -0,0 +1,83 @@
+// Error of the exact FP32Recip (see FP32.h) against operator/
+// Numerators and denominators are random raw values of any magnitude, pairs whose quotient doesn't fit are skipped
+
+#include "FP32.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+namespace
+{
+    const unsigned int NB_PAIRS = 2000000u;
+
+    // Random raw value, as likely to be small as to be large
+    int32_t PickRaw(std::mt19937 &ioRng)
+    {
+        int32_t raw = static_cast<int32_t>((ioRng() >> 1u) >> (ioRng() % 32u));
+        return (ioRng() & 1u) ? -raw : raw;
+    }
+
+    // iRaw is above iExpected (in magnitude) by at most 1 + |iExpected| / 2^29, see FP32Recip
+    bool IsWithinBound(int64_t iRaw, int64_t iExpected, int64_t &ioMaxError)
+    {
+        int64_t error = std::llabs(iRaw) - std::llabs(iExpected);
+        if (error > ioMaxError)
+            ioMaxError = error;
+        return (iRaw == iExpected || (iRaw < 0) == (iExpected < 0)) && error >= 0 && error <= 1 + (std::llabs(iExpected) >> 29);
+    }
+
+    template <unsigned int P>
+    bool CheckRecip()
+    {
+        std::mt19937 rng(42);
+        unsigned int nbPairs = 0u, nbDifferent = 0u, nbOutOfBound = 0u;
+        int64_t maxError = 0;
+        int64_t maxErrorFromInt = 0;
+        for (unsigned int i = 0; i < NB_PAIRS; i++)
+        {
+            int32_t num = PickRaw(rng);
+            int32_t den = PickRaw(rng);
+            if (!den)
+                continue;
+
+            // Same as operator/(FP32, FP32), whose result would wrap outside of that range
+            int64_t expected = (static_cast<int64_t>(num) << P) / den;
+            if (expected > INT32_MAX || expected <= INT32_MIN)
+                continue;
+            nbPairs++;
+
+            int32_t raw = (FP32<P>::FromFPVal(num) * FP32Recip<P>(FP32<P>::FromFPVal(den))).GetRawValue();
+            if (raw != expected)
+                nbDifferent++;
+            if (!IsWithinBound(raw, expected, maxError))
+            {
+                if (!nbOutOfBound)
+                    std::cout << "Error: " << num << " / " << den << " (raw) gives " << raw << " instead of " << expected << std::endl;
+                nbOutOfBound++;
+            }
+
+            // Same as operator/(FP32, int)
+            int32_t rawFromInt = (FP32<P>::FromFPVal(num) * FP32Recip<P>::FromInt(den)).GetRawValue();
+            if (!IsWithinBound(rawFromInt, num / den, maxErrorFromInt))
+            {
+                if (!nbOutOfBound)
+                    std::cout << "Error: " << num << " / int " << den << " (raw) gives " << rawFromInt << " instead of " << num / den << std::endl;
+                nbOutOfBound++;
+            }
+        }
+
+        std::cout << "FP32<" << P << ">, " << nbPairs << " pairs" << std::endl;
+        std::cout << "    FP32Recip: " << nbDifferent << " different from operator/, max error " << maxError << " LSB" << std::endl;
+        std::cout << "    FP32Recip::FromInt: max error " << maxErrorFromInt << " LSB" << std::endl;
+        return !nbOutOfBound;
+    }
+}
+
+int main()
+{
+    bool success = CheckRecip<14>();
+    success = CheckRecip<16>() && success;
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+// The potentially visible sets (see PVSOperator) must be conservative: renders from random views in the maps given
+// as arguments (.kdm) are compared with the ones of the same map without its sets, for all the number types and
+// render modes
+
+#include "KDTreeMap.h"
+#include "KDTreeRenderer.h"
+#include "GeomUtils.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+    const unsigned int NB_VIEWS = 100u;
+    const unsigned int FRAME_BUFFER_SIZE = 4u * WINDOW_WIDTH * WINDOW_HEIGHT;
+
+    bool LoadMap(const char *iPath, KDTreeMap &oMap)
+    {
+        std::ifstream mapStream(iPath, std::ios::binary | std::ios::in);
+        if (!mapStream.is_open())
+            return false;
+
+        mapStream.seekg(0, mapStream.end);
+        std::vector<char> data(static_cast<size_t>(mapStream.tellg()));
+        mapStream.seekg(0, mapStream.beg);
+        mapStream.read(data.data(), data.size());
+
+        unsigned int nbBytesRead;
+        oMap.UnStream(data.data(), nbBytesRead);
+        return true;
+    }
+
+    // Views in a sector, as they are when playing
+    std::vector<std::pair<KDRData::Vertex<CType>, int>> PickViews(const KDTreeMap &iMap)
+    {
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views;
+        if (!iMap.GetNbOfNodes())
+            return views;
+
+        const KDTreeFlatNode &root = iMap.GetNode(0u);
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> xDist(root.m_AABBMin.m_X, root.m_AABBMax.m_X);
+        std::uniform_real_distribution<float> yDist(root.m_AABBMin.m_Y, root.m_AABBMax.m_Y);
+        std::uniform_int_distribution<int> directionDist(0, ANGLE_FULL - 1);
+        for (unsigned int i = 0; i < 100u * NB_VIEWS && views.size() < NB_VIEWS; i++)
+        {
+            KDRData::Vertex<CType> position;
+            position.m_X = CType(xDist(rng) / POSITION_SCALE);
+            position.m_Y = CType(yDist(rng) / POSITION_SCALE);
+            int direction = directionDist(rng);
+            if (iMap.LocateSector(position.m_X, position.m_Y) >= 0)
+                views.push_back({position, direction});
+        }
+        return views;
+    }
+
+    const unsigned char *Render(KDTreeRendererBase &ioRenderer, const KDRData::Vertex<CType> &iPosition, int iDirection)
+    {
+        // Pixels the renderer doesn't write are compared as well
+        memset(ioRenderer.GetFrameBuffer(), 0, FRAME_BUFFER_SIZE);
+        ioRenderer.InvalidateFrame();
+
+        ioRenderer.SetPlayerCoordinates(iPosition, iDirection);
+        ioRenderer.ClearBuffers();
+        ioRenderer.RefreshFrameBuffer();
+        return ioRenderer.GetFrameBuffer();
+    }
+
+    bool CheckMap(const char *iPath)
+    {
+        KDTreeMap map;
+        if (!LoadMap(iPath, map))
+        {
+            std::cout << "Error: could not open " << iPath << std::endl;
+            return false;
+        }
+
+        // Both renders of a view are done at different moments, flickering lights would not be the same in both.
+        // The copy is made once they are frozen, so that it gets the same values
+        map.FreezeLights();
+        KDTreeMap mapWithoutPVS;
+        char *pData = nullptr;
+        unsigned int size;
+        map.Stream(pData, size);
+        mapWithoutPVS.UnStream(pData, size);
+        delete[] pData;
+        mapWithoutPVS.ClearPVS();
+
+        std::vector<std::pair<KDRData::Vertex<CType>, int>> views = PickViews(map);
+
+        bool success = true;
+        for (KDRData::NumberType numberType : {KDRData::NumberType::FP32_14, KDRData::NumberType::FP32_16, KDRData::NumberType::FLOAT, KDRData::NumberType::DOUBLE})
+        {
+            for (KDRData::RenderMode renderMode : {KDRData::RenderMode::KDTree, KDRData::RenderMode::Portals})
+            {
+                std::unique_ptr<KDTreeRendererBase> renderer = CreateKDTreeRenderer(map, numberType);
+                std::unique_ptr<KDTreeRendererBase> rendererWithoutPVS = CreateKDTreeRenderer(mapWithoutPVS, numberType);
+                renderer->SetRenderMode(renderMode);
+                rendererWithoutPVS->SetRenderMode(renderMode);
+
+                unsigned int nbMismatches = 0u;
+                for (const std::pair<KDRData::Vertex<CType>, int> &view : views)
+                {
+                    const unsigned char *pFrame = Render(*renderer, view.first, view.second);
+                    const unsigned char *pFrameWithoutPVS = Render(*rendererWithoutPVS, view.first, view.second);
+                    if (memcmp(pFrame, pFrameWithoutPVS, FRAME_BUFFER_SIZE))
+                    {
+                        if (!nbMismatches)
+                            std::cout << "Error: different render at (" << static_cast<float>(view.first.m_X) << ", " << static_cast<float>(view.first.m_Y) << "), direction " << view.second << std::endl;
+                        nbMismatches++;
+                    }
+                }
+
+                std::cout << iPath << ", number type " << static_cast<int>(numberType) << ", render mode " << static_cast<int>(renderMode) << ": "
+                          << nbMismatches << " mismatches out of " << views.size() << " views" << std::endl;
+                success = success && !nbMismatches;
+            }
+        }
+        return success;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool success = true;
+    for (int i = 1; i < argc; i++)
+        success = CheckMap(argv[i]) && success;
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
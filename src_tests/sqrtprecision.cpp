@@ -0,0 +1,74 @@
+// Precision of the fixed point SqrtInt and InvSqrtInt (see GeomUtils.h) against std::sqrt
+// Inputs are squared distances in [0, 800], which covers coordinates of +-10 render units (all shipped maps fit)
+
+#include "FP32.h"
+#include "GeomUtils.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+    const double MAX_SQUARED_DIST = 800.0;
+
+    // Errors are checked in LSBs of the fixed point type
+    template <unsigned int P>
+    bool CheckPrecision()
+    {
+        const double lsb = 1.0 / static_cast<double>(1 << P);
+        const int32_t maxRaw = static_cast<int32_t>(MAX_SQUARED_DIST / lsb);
+        // Same number of samples whatever P
+        const int32_t rawStep = 7 << (P - 14);
+
+        double sqrtMaxAbs = 0.0, sqrtMaxRel = 0.0;
+        double invSqrtMaxAbs = 0.0, invSqrtMaxRel = 0.0;
+        unsigned int nbSamples = 0;
+        for (int32_t raw = 0; raw <= maxRaw; raw += rawStep, nbSamples++)
+        {
+            FP32<P> val = FP32<P>::FromFPVal(raw);
+            double x = raw * lsb;
+
+            double sqrtRef = std::sqrt(x);
+            double sqrtError = std::abs(static_cast<double>(SqrtInt(val)) - sqrtRef);
+            sqrtMaxAbs = std::max(sqrtMaxAbs, sqrtError);
+            if (raw)
+                sqrtMaxRel = std::max(sqrtMaxRel, sqrtError / sqrtRef);
+
+            // Below that, 1 / sqrt(x) is too large for the LSB to be meaningful
+            if (x >= 1.0 / 64.0)
+            {
+                double invSqrtRef = 1.0 / sqrtRef;
+                double invSqrtError = std::abs(static_cast<double>(InvSqrtInt(val)) - invSqrtRef);
+                invSqrtMaxAbs = std::max(invSqrtMaxAbs, invSqrtError);
+                invSqrtMaxRel = std::max(invSqrtMaxRel, invSqrtError / invSqrtRef);
+            }
+        }
+
+        std::cout << "FP32<" << P << ">, " << nbSamples << " samples" << std::endl;
+        std::cout << "    SqrtInt: max abs error " << sqrtMaxAbs << " (" << sqrtMaxAbs / lsb << " LSB), max rel error " << sqrtMaxRel << std::endl;
+        std::cout << "    InvSqrtInt: max abs error " << invSqrtMaxAbs << " (" << invSqrtMaxAbs / lsb << " LSB), max rel error " << invSqrtMaxRel << std::endl;
+
+        // SqrtInt is rounded to nearest, InvSqrtInt is rounded twice
+        bool success = true;
+        if (sqrtMaxAbs > 0.5 * lsb)
+        {
+            std::cout << "Error: SqrtInt is off by more than half a LSB" << std::endl;
+            success = false;
+        }
+        if (invSqrtMaxAbs > lsb)
+        {
+            std::cout << "Error: InvSqrtInt is off by more than a LSB" << std::endl;
+            success = false;
+        }
+        return success;
+    }
+}
+
+int main()
+{
+    bool success = CheckPrecision<14>();
+    success = CheckPrecision<16>() && success;
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}